@@ -0,0 +1,92 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <new>
+#include <type_traits>
+#include <utility>
+#include <vector>
+
+// Contiguous run of arena-owned items. Trivially copyable, so AST nodes holding one stay
+// trivially destructible and the arena can drop them without running destructors.
+template <typename T>
+struct ArenaSpan {
+    T* items = nullptr;
+    uint32_t count = 0;
+
+    T* begin() const { return items; }
+    T* end() const { return items + count; }
+    size_t size() const { return count; }
+    bool empty() const { return count == 0; }
+    T& operator[](size_t i) const { return items[i]; }
+};
+
+// Bump allocator: objects are carved out of large blocks and never freed individually.
+// Everything goes away at once when the arena is destroyed or reset(), so only trivially
+// destructible types may be placed in it.
+class Arena
+{
+public:
+    Arena() = default;
+    Arena(Arena&& other) noexcept;
+    Arena& operator=(Arena&& other) noexcept;
+    Arena(const Arena&) = delete;
+    Arena& operator=(const Arena&) = delete;
+
+    void* allocate(size_t size, size_t align) {
+        uintptr_t p = (reinterpret_cast<uintptr_t>(m_cur) + align - 1) & ~(uintptr_t)(align - 1);
+        if (p + size > reinterpret_cast<uintptr_t>(m_end)) {
+            return allocate_slow(size, align);
+        }
+        m_cur = reinterpret_cast<char*>(p + size);
+        return reinterpret_cast<void*>(p);
+    }
+
+    template <typename T, typename... Args>
+    T* make(Args&&... args) {
+        static_assert(std::is_trivially_destructible<T>::value,
+                      "arena objects are never destroyed");
+        return new (allocate(sizeof(T), alignof(T))) T(std::forward<Args>(args)...);
+    }
+
+    template <typename T>
+    ArenaSpan<T> copy(const T* items, size_t count) {
+        static_assert(std::is_trivially_copyable<T>::value, "arena spans are copied bytewise");
+        ArenaSpan<T> span;
+        if (count > 0) {
+            span.items = static_cast<T*>(allocate(sizeof(T) * count, alignof(T)));
+            std::uninitialized_copy(items, items + count, span.items);
+            span.count = static_cast<uint32_t>(count);
+        }
+        return span;
+    }
+
+    // Allocation position to roll back to: release() drops every object made after mark(),
+    // keeping the block the mark points into so the space is reused.
+    struct Mark {
+        size_t blocks;
+        char* cur;
+        char* end;
+        size_t reserved;
+    };
+    Mark mark() const { return {m_blocks.size(), m_cur, m_end, m_reserved}; }
+    void release(const Mark& mark);
+
+    // Takes over the blocks of `other` (e.g. a worker thread's arena); objects in them stay
+    // where they are and are now freed together with this arena.
+    void adopt(Arena&& other);
+    // Releases every block; all pointers handed out so far become invalid.
+    void reset();
+    size_t bytes_reserved() const { return m_reserved; }
+
+private:
+    static constexpr size_t BLOCK_SIZE = 64 * 1024;
+
+    void* allocate_slow(size_t size, size_t align);
+
+    std::vector<std::unique_ptr<char[]>> m_blocks;
+    char* m_cur = nullptr;
+    char* m_end = nullptr;
+    size_t m_reserved = 0;
+};
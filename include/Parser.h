@@ -4,12 +4,17 @@
 #include <memory>
 #include <optional>
 #include <string>
+#include <string_view>
 #include <vector>
 
+#include "Arena.h"
 #include "Tokenizer.h"
-enum class ExprType { IntLit, Ident, BinaryOp };
 
-enum class BinOpType {
+class TokenRing;
+
+enum class ExprType : uint8_t { IntLit, Ident, BinaryOp, UnaryOp, Ternary, Call };
+
+enum class BinOpType : uint8_t {
     Add,
     Sub,
     Mul,
@@ -27,19 +32,72 @@ enum class BinOpType {
     Shr
 };
 
+// AST nodes live in the NodeProg arena. Each kind only carries its own fields; the shared
+// header holds the tag and as<T>() downcasts once the tag has been checked.
 struct NodeExpr {
     ExprType type;
+
+    explicit NodeExpr(ExprType t) : type(t) {
+    }
+    template <typename T>
+    const T* as() const {
+        return static_cast<const T*>(this);
+    }
+};
+
+// IntLit, Ident
+struct NodeTerm : NodeExpr {
     Token token;
 
-    BinOpType bin_op;
+    NodeTerm(ExprType t, const Token& tok) : NodeExpr(t), token(tok) {
+    }
+};
+
+struct NodeBinExpr : NodeExpr {
+    BinOpType op;
     NodeExpr* left;
     NodeExpr* right;
+
+    NodeBinExpr(BinOpType o, NodeExpr* l, NodeExpr* r)
+        : NodeExpr(ExprType::BinaryOp), op(o), left(l), right(r) {
+    }
+};
+
+enum class UnaryOpType : uint8_t { Not, Negate };
+
+struct NodeUnaryExpr : NodeExpr {
+    UnaryOpType op;
+    NodeExpr* operand;
+
+    NodeUnaryExpr(UnaryOpType o, NodeExpr* e) : NodeExpr(ExprType::UnaryOp), op(o), operand(e) {
+    }
+};
+
+// condition ? if_true : if_false
+struct NodeTernary : NodeExpr {
+    NodeExpr* condition;
+    NodeExpr* if_true;
+    NodeExpr* if_false;
+
+    NodeTernary(NodeExpr* c, NodeExpr* t, NodeExpr* f)
+        : NodeExpr(ExprType::Ternary), condition(c), if_true(t), if_false(f) {
+    }
 };
 
-enum class StmtType {
+// f(a, b) used as a value
+struct NodeCallExpr : NodeExpr {
+    Token ident;
+    ArenaSpan<NodeExpr*> args;
+
+    explicit NodeCallExpr(const Token& id) : NodeExpr(ExprType::Call), ident(id) {
+    }
+};
+
+enum class StmtType : uint8_t {
     Auto,
     Extern,
     Assign,
+    Update,
     FuncCall,
     Global,
     If,
@@ -48,48 +106,182 @@ enum class StmtType {
     Case,
     Goto,
     Return,
-    Block
+    Block,
+    Break
 };
 
 struct NodeStmt {
     StmtType type;
+
+    explicit NodeStmt(StmtType t) : type(t) {
+    }
+    template <typename T>
+    const T* as() const {
+        return static_cast<const T*>(this);
+    }
+};
+
+// Auto, Extern
+struct NodeDecl : NodeStmt {
+    ArenaSpan<Token> idents;
+
+    explicit NodeDecl(StmtType t) : NodeStmt(t) {
+    }
+};
+
+struct NodeAssign : NodeStmt {
+    Token ident;
+    NodeExpr* expr;
+
+    NodeAssign(const Token& id, NodeExpr* e) : NodeStmt(StmtType::Assign), ident(id), expr(e) {
+    }
+};
+
+// x op= expr, x++, ++x, x--, --x. expr is null for the increment/decrement forms.
+struct NodeUpdate : NodeStmt {
     Token ident;
-    std::vector<Token> idents;
+    BinOpType op;
     NodeExpr* expr;
-    std::vector<NodeExpr*> args;
 
-    // Control flow fields
-    NodeExpr* condition;          // for if, while
-    NodeStmt* then_stmt;          // for if
-    NodeStmt* else_stmt;          // for if
-    std::vector<NodeStmt*> body;  // for blocks
-    Token label;                  // for case, goto
+    NodeUpdate(const Token& id, BinOpType o, NodeExpr* e)
+        : NodeStmt(StmtType::Update), ident(id), op(o), expr(e) {
+    }
+};
+
+struct NodeCall : NodeStmt {
+    Token ident;
+    ArenaSpan<NodeExpr*> args;
+
+    explicit NodeCall(const Token& id) : NodeStmt(StmtType::FuncCall), ident(id) {
+    }
+};
+
+struct NodeIf : NodeStmt {
+    NodeExpr* condition = nullptr;
+    NodeStmt* then_stmt = nullptr;
+    NodeStmt* else_stmt = nullptr;
+
+    NodeIf() : NodeStmt(StmtType::If) {
+    }
+};
+
+struct NodeWhile : NodeStmt {
+    NodeExpr* condition = nullptr;
+    NodeStmt* body = nullptr;
+
+    NodeWhile() : NodeStmt(StmtType::While) {
+    }
+};
+
+// One `case N:` or `default:` label and the statements up to the next label. Control falls
+// through into the following case unless the body breaks out.
+struct SwitchCase {
+    int value = 0;
+    bool is_default = false;
+    ArenaSpan<NodeStmt*> body;
+};
+
+struct NodeSwitch : NodeStmt {
+    NodeExpr* value = nullptr;
+    ArenaSpan<SwitchCase> cases;  // in source order
+
+    NodeSwitch() : NodeStmt(StmtType::Switch) {
+    }
+};
+
+// Leaves the innermost enclosing switch or while.
+struct NodeBreak : NodeStmt {
+    NodeBreak() : NodeStmt(StmtType::Break) {
+    }
+};
+
+struct NodeReturn : NodeStmt {
+    NodeExpr* expr = nullptr;  // null for a bare `return;`
+
+    NodeReturn() : NodeStmt(StmtType::Return) {
+    }
+};
+
+struct NodeBlock : NodeStmt {
+    ArenaSpan<NodeStmt*> body;
+
+    NodeBlock() : NodeStmt(StmtType::Block) {
+    }
 };
 
 struct NodeFunc {
     Token name;
-    std::vector<NodeStmt*> body;
+    ArenaSpan<Token> params;
+    ArenaSpan<NodeStmt*> body;
 };
 
+// Owns the whole tree: every node is allocated from `arena`, so dropping the NodeProg frees
+// the AST in one go.
 struct NodeProg {
+    Arena arena;
+    std::string_view src;  // backing text for every Token in the tree
     std::vector<Token> globals;
     std::vector<NodeFunc*> funcs;
 };
 
+// Receives a program piece by piece from Parser::parse_direct(). A function arrives with its
+// name and parameters but an empty body; its statements follow one at a time and each is only
+// valid for the duration of the statement() call.
+class StmtSink {
+   public:
+    virtual ~StmtSink() = default;
+    virtual void global(const Token& name) = 0;
+    virtual void function(const NodeFunc& func) = 0;
+    virtual void statement(const NodeStmt* stmt) = 0;
+};
+
 class Parser {
    public:
-    Parser(std::vector<Token> tokens);
+    Parser(std::vector<Token> tokens, std::string_view src);
+    // Streaming mode: tokens are pulled from a ring filled by a tokenizer thread, and only a
+    // small window of them is held at once.
+    Parser(TokenRing& stream, std::string_view src);
     std::optional<NodeProg> parse_prog();
+    // Finds top-level function boundaries by brace matching and parses the functions on
+    // `workers` threads (0 = one per core), each into its own arena that the program adopts
+    // afterwards. Same tree and diagnostics as parse_prog(); streams and small inputs are
+    // parsed serially.
+    std::optional<NodeProg> parse_prog_parallel(unsigned workers = 0);
+    // Hands every top-level statement to `sink` as soon as it is parsed and then reuses its
+    // memory, so no more than one statement's tree exists at a time. Returns false on a
+    // syntax error.
+    bool parse_direct(StmtSink& sink);
 
    private:
+    static constexpr size_t STREAM_BATCH = 1024;
+
     std::vector<Token> m_tokens;
+    TokenRing* m_stream{nullptr};
+    bool m_stream_done{false};
+    std::string_view m_src;
     size_t m_index{0};
+    std::ostream* m_err{&std::cerr};
+
+    // Arena of the program being parsed, and scratch stacks that collect child lists before
+    // they are copied into it. Nested lists push above their parent's entries and pop them
+    // before the parent continues.
+    Arena* m_arena{nullptr};
+    std::vector<NodeStmt*> m_stmt_scratch;
+    std::vector<Token> m_token_scratch;
+    std::vector<SwitchCase> m_case_scratch;
+    std::vector<NodeExpr*> m_expr_scratch;
+
+    template <typename T>
+    ArenaSpan<T> take_scratch(std::vector<T>& scratch, size_t from);
 
-    NodeFunc* parse_f();
+    NodeFunc* parse_f(StmtSink* sink = nullptr);
     NodeStmt* parseStmt();
-    NodeExpr* parseExpr();
+    NodeStmt* parseSwitch();
+    NodeExpr* parseExpr(uint8_t min_power = 0);
     NodeExpr* parsePExpr();
+    bool parseArgs(ArenaSpan<NodeExpr*>& args);
     Token* parseGvar();
-    std::optional<Token> peek(int offset = 0) const;
-    Token consume();
+    const Token* peek(int offset = 0);
+    bool fill(size_t ahead);
+    const Token& consume();
 };
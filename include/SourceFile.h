@@ -0,0 +1,32 @@
+#pragma once
+
+#include <cstddef>
+#include <string>
+#include <string_view>
+
+// Read-only view of a whole source file for the lifetime of the compile.
+// Regular files are mmap'd so the tokenizer scans the page cache directly;
+// stdin ("-"), pipes and anything else that can't be mapped is streamed into
+// an owned buffer instead.
+class SourceFile
+{
+public:
+    SourceFile() = default;
+    ~SourceFile();
+
+    SourceFile(const SourceFile&) = delete;
+    SourceFile& operator=(const SourceFile&) = delete;
+
+    bool open(const std::string& path);
+    std::string_view view() const { return {m_data, m_size}; }
+    bool mapped() const { return m_mapped; }
+
+private:
+    bool read_stream(int fd);
+    void close();
+
+    const char* m_data = nullptr;
+    size_t m_size = 0;
+    bool m_mapped = false;
+    std::string m_buffer;
+};
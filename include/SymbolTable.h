@@ -0,0 +1,41 @@
+#pragma once
+
+#include <cstdint>
+#include <deque>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+#include <vector>
+
+using SymbolId = uint32_t;
+
+// Process-wide identifier interner. The tokenizer interns every identifier once and from
+// then on the AST, the IR and the backends pass around dense ids, so per-name tables are
+// plain vectors indexed by SymbolId rather than string hash maps.
+class SymbolTable
+{
+public:
+    static SymbolTable& instance();
+
+    SymbolId intern(std::string_view name);
+    std::string_view name(SymbolId id) const { return m_names[id]; }
+    size_t size() const { return m_names.size(); }
+
+private:
+    std::deque<std::string> m_names;  // deque keeps the strings (and the map's keys) in place
+    std::unordered_map<std::string_view, SymbolId> m_ids;
+};
+
+// Set of symbols with O(1) membership that iterates in insertion order.
+class SymbolSet
+{
+public:
+    bool insert(SymbolId id);
+    bool contains(SymbolId id) const { return id < m_member.size() && m_member[id]; }
+    const std::vector<SymbolId>& items() const { return m_items; }
+    void clear();
+
+private:
+    std::vector<bool> m_member;
+    std::vector<SymbolId> m_items;
+};
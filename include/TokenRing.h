@@ -0,0 +1,35 @@
+#pragma once
+
+#include <atomic>
+#include <cstddef>
+#include <vector>
+
+#include "Tokenizer.h"
+
+// Bounded lock-free single-producer/single-consumer queue of tokens. The tokenizer thread
+// pushes batches, the parser pops them; either side spins (yielding) while the ring is full
+// or empty. head/tail only ever grow and are masked on access, so capacity must be a power
+// of two.
+class TokenRing
+{
+public:
+    explicit TokenRing(size_t capacity = 1 << 14);
+
+    // Producer side. push() returns false once the consumer has abandoned the stream.
+    bool push(const Token* tokens, size_t count);
+    void close();
+
+    // Consumer side. pop() blocks until at least one token is available and returns 0
+    // only after the producer closed the ring and everything was drained.
+    size_t pop(Token* out, size_t max);
+    void abandon();
+
+private:
+    std::vector<Token> m_buf;
+    size_t m_mask;
+
+    alignas(64) std::atomic<size_t> m_head{0};  // next slot the producer writes
+    alignas(64) std::atomic<size_t> m_tail{0};  // next slot the consumer reads
+    alignas(64) std::atomic<bool> m_closed{false};
+    std::atomic<bool> m_abandoned{false};
+};
@@ -2,11 +2,14 @@
 
 #include <vector>
 #include <string>
+#include <string_view>
 #include <optional>
 #include <iostream>
-#include <cctype>
+#include <cstdint>
 
-enum class TokenType
+#include "SymbolTable.h"
+
+enum class TokenType : uint8_t
 {
     _return,
     int_literal,
@@ -31,6 +34,8 @@ enum class TokenType
     switch_,
     case_,
     goto_,
+    break_,
+    default_,
     // Comparison operators
     equal_equal,
     not_equal,
@@ -66,22 +71,70 @@ enum class TokenType
     colon,
 };
 
+// Tokens don't own their text: offset/length point into the source buffer the
+// Tokenizer was built over, which has to outlive the tokens, the AST and the IR.
+// Identifiers additionally carry their interned SymbolId.
 struct Token
 {
-    TokenType type;
-    std::optional<std::string> value{};
+    TokenType type{};
+    SymbolId sym = 0;
+    uint32_t offset = 0;
+    uint32_t length = 0;
+};
+
+inline std::string_view token_text(std::string_view src, const Token& tok)
+{
+    return src.substr(tok.offset, tok.length);
+}
+
+// Lexer engines, ordered by the CPU features they need. Auto picks the best one the running CPU
+// supports; Scalar is the table-driven fallback that works everywhere.
+enum class LexEngine
+{
+    Auto,
+    Scalar,
+    SSE2,
+    AVX2,
 };
 
+const char* lex_engine_name(LexEngine engine);
+
+class TokenRing;
+
 class Tokenizer
 {
 public:
-    Tokenizer(const std::string& src);
+    explicit Tokenizer(std::string_view src, LexEngine engine = LexEngine::Auto);
     std::vector<Token> tokenize();
+    // Streaming mode: lex into ring batch by batch and close it at the end. Meant to run on
+    // its own thread while a Parser consumes the other end.
+    void tokenize_into(TokenRing& ring);
+    // Lex chunks of the source on `workers` threads (0 = one per core) and stitch them back
+    // together. Produces the same tokens as tokenize(); small inputs just run serially.
+    std::vector<Token> tokenize_parallel(unsigned workers = 0);
+
+    LexEngine engine() const { return m_engine; }
+    static LexEngine best_engine();
 
 private:
+    using ScanFn = size_t (*)(const char* src, size_t index, size_t size);
+    static constexpr size_t NO_POS = static_cast<size_t>(-1);
+
+    Tokenizer(std::string_view src, LexEngine engine, SymbolTable& symbols);
+
+    template <typename Sink>
+    void lex(Sink& tokens);
+    Token make_token(TokenType type, size_t start) const;
     std::optional<char> peek(int ahead = 0) const;
     char consume();
 
-    const std::string m_src;
+    std::string_view m_src;
+    SymbolTable& m_symbols;
     size_t m_index = 0;
+    size_t m_open_comment = NO_POS;  // start of a block comment that ran off the end
+    size_t m_error_at = NO_POS;      // offending byte when m_defer_errors is set
+    bool m_defer_errors = false;
+    LexEngine m_engine = LexEngine::Scalar;
+    ScanFn m_scan_ident = nullptr;
+    ScanFn m_scan_space = nullptr;
 };
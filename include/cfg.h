@@ -0,0 +1,81 @@
+#pragma once
+
+#include <cstddef>
+#include <vector>
+
+#include "ir.h"
+
+// Control-flow analysis of one function of an IrProgram: basic blocks, the CFG, the dominator
+// tree and natural loops. Blocks are numbered in code order; block 0 is the entry and has no
+// predecessors.
+
+struct BasicBlock {
+    size_t first;  // index of the first instruction in IrProgram::code
+    size_t end;    // one past the last
+    vector<int> preds;
+    vector<int> succs;
+    int idom = -1;  // immediate dominator; -1 for the entry and for unreachable blocks
+    int loop = -1;  // innermost natural loop containing the block
+};
+
+struct NaturalLoop {
+    int header;
+    int parent = -1;  // enclosing loop, -1 at the top level
+    int depth = 1;
+    vector<int> blocks;   // header first
+    vector<int> latches;  // sources of the back edges to the header
+};
+
+class Cfg {
+public:
+    // Analyses the function whose funcOp is at prog.code[start], up to the next funcOp.
+    void build(const IrProgram& prog, size_t start);
+    // Marks the analysis stale once a pass adds or removes branches or blocks; passes that only
+    // rewrite operands keep using it.
+    void invalidate() { m_valid = false; }
+    bool valid() const { return m_valid; }
+
+    size_t func_start() const { return m_start; }
+    size_t func_end() const { return m_end; }
+    const vector<BasicBlock>& blocks() const { return m_blocks; }
+    const vector<NaturalLoop>& loops() const { return m_loops; }
+    // Reachable blocks in reverse postorder, entry first.
+    const vector<int>& rpo() const { return m_rpo; }
+    const vector<int>& dom_children(int block) const { return m_dom_children[block]; }
+    // Blocks where the dominance of `block` ends: it dominates a predecessor but not the block.
+    const vector<int>& frontier(int block) const { return m_frontier[block]; }
+
+    int block_of(size_t index) const;
+    int label_block(LabelId label) const { return m_label_block[label]; }
+    bool reachable(int block) const { return m_rpo_index[block] >= 0; }
+    bool dominates(int a, int b) const;
+    bool in_loop(int block, int loop) const;
+    // True if the only way into `block` is from the end of the block before it in code order,
+    // so whatever a linear walk knows at that point still holds.
+    bool fallthrough_only(int block) const;
+
+private:
+    void partition(const IrProgram& prog);
+    void connect(const IrProgram& prog);
+    void order();
+    void dominators();
+    void find_loops();
+
+    bool m_valid = false;
+    size_t m_start = 0;
+    size_t m_end = 0;
+    vector<BasicBlock> m_blocks;
+    vector<NaturalLoop> m_loops;
+    vector<int> m_rpo;
+    vector<int> m_rpo_index;  // position in m_rpo, -1 if unreachable
+    vector<vector<int>> m_dom_children;
+    vector<vector<int>> m_frontier;
+    vector<int> m_dom_pre;  // dominator tree DFS numbering for O(1) dominance queries
+    vector<int> m_dom_post;
+    // LabelId -> block. Labels belong to one function, so entries left over from an earlier
+    // build are never looked up and the table is only ever grown, not cleared.
+    vector<int> m_label_block;
+};
+
+// Index of every funcOp in the program, in order.
+vector<size_t> function_starts(const IrProgram& prog);
@@ -0,0 +1,87 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+#include "cfg.h"
+#include "ir.h"
+
+// Fixed-size set of small integers, one bit each.
+class BitSet {
+public:
+    BitSet() = default;
+    explicit BitSet(size_t bits) : m_bits(bits), m_words((bits + 63) / 64, 0) {}
+
+    size_t size() const { return m_bits; }
+
+    bool test(size_t i) const { return (m_words[i / 64] >> (i % 64)) & 1; }
+    void set(size_t i) { m_words[i / 64] |= uint64_t(1) << (i % 64); }
+    void reset(size_t i) { m_words[i / 64] &= ~(uint64_t(1) << (i % 64)); }
+    void fill(bool value);
+
+    // The in-place set operations report whether this set changed.
+    bool unite(const BitSet& other);
+    bool intersect(const BitSet& other);
+    bool subtract(const BitSet& other);
+    bool operator==(const BitSet& other) const { return m_words == other.m_words; }
+
+    template <typename F>
+    void for_each(F&& f) const {
+        for (size_t w = 0; w < m_words.size(); w++) {
+            for (uint64_t bits = m_words[w]; bits != 0; bits &= bits - 1) {
+                f(w * 64 + __builtin_ctzll(bits));
+            }
+        }
+    }
+
+private:
+    size_t m_bits = 0;
+    vector<uint64_t> m_words;
+};
+
+// Dense numbering of the locals and temporaries one function mentions, so per-variable
+// tables are sized to what the function uses rather than to the largest number in it.
+// Variables some block reads before writing come first; they are the only ones that can be
+// live into or out of a block, so per-block sets only need across() bits. The rest, mostly
+// expression temporaries, are written and read within one block.
+class VarNumbering {
+public:
+    void build(const IrProgram& prog, const Cfg& cfg);
+
+    size_t size() const { return m_vars.size(); }
+    size_t across() const { return m_across; }
+    // Dense index of local or temporary `var`, -1 if the function never mentions it.
+    int index(int var) const { return var < (int)m_index.size() ? m_index[var] : -1; }
+    int var(int index) const { return m_vars[index]; }
+
+private:
+    vector<int> m_index;
+    vector<int> m_vars;
+    size_t m_across = 0;
+};
+
+// A gen/kill bit-vector problem over the blocks of a Cfg: out = gen | (in - kill) going
+// forward, in = gen | (out - kill) going backward. Blocks meet by union ("may") or by
+// intersection ("must").
+struct BitProblem {
+    bool forward = true;
+    bool must = false;
+    size_t bits = 0;
+    vector<BitSet> gen;
+    vector<BitSet> kill;
+    BitSet boundary;  // value at the entry (forward) or at the exits (backward)
+};
+
+struct BitSolution {
+    vector<BitSet> in;
+    vector<BitSet> out;
+};
+
+// Iterates to the fixpoint with a worklist seeded in (reverse) postorder, so each block is
+// revisited only when something it depends on changed. Unreachable blocks keep empty sets.
+BitSolution solve(const Cfg& cfg, const BitProblem& problem);
+
+// Variables live on entry to and exit from each block, by dense index. The sets have
+// vars.across() bits; a variable past that is never live at a block boundary.
+BitSolution liveness(const IrProgram& prog, const Cfg& cfg, const VarNumbering& vars);
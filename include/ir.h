@@ -1,32 +1,48 @@
 #pragma once
 
+#include <cstddef>
+#include <cstdint>
 #include <optional>
 #include <string>
+#include <string_view>
 #include <vector>
 
+#include "SymbolTable.h"
+
 using namespace std;
 
-enum class ArgType { Var, Global, Literal };
+enum class ArgType : uint8_t { Var, Global, Literal };
 
 struct Arg {
     ArgType type;
     int value;
 };
 
-enum class Opkind {
+enum class Opkind : uint8_t {
+    function,
     autovar,
     autoassign,
-    funcall,
     externvar,
     binop,
     globalvar,
     globalassign,
     unaryop,
+    update,
+    select,
     label,
     jump,
     jumpiffalse,
+    jumptable,
     call,
-    ret
+    ret,
+    nop  // removed by an optimisation pass; dropped before the IR leaves optimisation()
+};
+
+// Starts a function: every instruction up to the next function op belongs to it. Parameters
+// arrive in locals 0..params-1, declared by the autovar that follows.
+struct funcOp {
+    SymbolId name;
+    int params;
 };
 
 struct autoVar {
@@ -38,16 +54,11 @@ struct autoaAssignOp {
     Arg arg;
 };
 
-struct funCallOp {
-    string name;
-    optional<Arg> arg;
-};
-
 struct externVarOp {
-    string name;
+    SymbolId name;
 };
 
-enum class BinOp {
+enum class BinOp : uint8_t {
     Add,
     Sub,
     Mul,
@@ -65,7 +76,14 @@ enum class BinOp {
     Shr
 };
 
-enum class UnaryOp { Not, Negate, PreIncrement, PostIncrement, PreDecrement, PostDecrement };
+enum class UnaryOp : uint8_t {
+    Not,
+    Negate,
+    PreIncrement,
+    PostIncrement,
+    PreDecrement,
+    PostDecrement
+};
 
 struct binopOp {
     int dest;
@@ -89,54 +107,228 @@ struct unaryOp {
     UnaryOp op;
 };
 
-struct labelOp {
+// In-place read-modify-write of a local or global (`dest op= value`), for ++/-- and compound
+// assignments. Only Add, Sub, Shl and Shr are emitted; they map to single memory-operand
+// instructions on x86-64.
+struct updateOp {
+    Arg dest;  // Var or Global
+    Arg value;
+    BinOp op;
+};
+
+// dest = condition ? if_true : if_false, with both values already computed (cmov / csel /
+// wasm select).
+struct selectOp {
+    int dest;
+    Arg condition;
+    Arg if_true;
+    Arg if_false;
+};
+
+// Labels are numbered per program; IrProgram::labels holds their names and what they start.
+using LabelId = int;
+
+// Recorded when the label is made, so passes and backends read control structure off the
+// label instead of recovering it from the name.
+enum class LabelKind : uint8_t {
+    Plain,     // if/else arms
+    LoopHead,  // top of a while loop, where its condition is tested
+    LoopExit,  // first instruction after a while loop
+    Merge,     // switch cases and ternary arms, entered by a jump and not just by falling in
+    Cond,      // short-circuit targets, only ever reached by forward jumps
+};
+
+struct LabelInfo {
     string name;
+    LabelKind kind;
+    LabelId pair;  // LoopHead: the loop's exit, LoopExit: its head, otherwise -1
+};
+
+struct labelOp {
+    LabelId label;
 };
 
 struct jumpOp {
-    string label;
+    LabelId label;
 };
 
 struct jumpIfFalseOp {
-    string label;
+    LabelId label;
     Arg condition;
 };
 
+// Bounds-checked indirect jump for dense switches: `value - low` indexes the targets of
+// IrProgram::jump_tables[table] and anything outside goes to its default label.
+struct jumpTableOp {
+    Arg value;
+    int low;
+    int table;
+};
+
+// Call to a function of this program or an extern. The arguments are
+// IrProgram::call_args[first_arg, first_arg + arg_count); the result lands in local `dest`, or
+// is dropped when dest is -1.
 struct callOp {
-    string function;
-    vector<Arg> args;
+    SymbolId function;
     int dest;
+    uint32_t first_arg;
+    uint32_t arg_count;
 };
 
 struct retOp {
-    optional<Arg> value;
+    Arg value;
+    bool has_value;
 };
 
+// One IR instruction: the kind tag and the payload for that kind. Payloads are plain data that
+// share storage, and anything of variable length lives in a side table of the IrProgram, so
+// the instruction stream is one flat array of small fixed-size records.
 struct inst {
     Opkind kind;
 
-    autoVar autovar;
-    autoaAssignOp autoassign;
-    funCallOp funcall;
-    externVarOp externvar;
-    binopOp binop;
-    gVarOp globalvar;
-    gAssignOp gAssign;
-    unaryOp unary;
-    labelOp label;
-    jumpOp jump;
-    jumpIfFalseOp jumpiffalse;
-    callOp call;
-    retOp ret;
+    union {
+        funcOp func;
+        autoVar autovar;
+        autoaAssignOp autoassign;
+        externVarOp externvar;
+        binopOp binop;
+        gVarOp globalvar;
+        gAssignOp gAssign;
+        unaryOp unary;
+        updateOp update;
+        selectOp select;
+        labelOp label;
+        jumpOp jump;
+        jumpIfFalseOp jumpiffalse;
+        jumpTableOp jumptable;
+        callOp call;
+        retOp ret;
+    };
+};
+
+static_assert(sizeof(inst) <= 32, "IR instructions are meant to stay small");
+
+// Targets of a dense switch. end_label is where the switch ends, for backends that have to
+// wrap the case bodies in structured blocks.
+struct JumpTable {
+    vector<LabelId> targets;
+    LabelId default_label;
+    LabelId end_label;
+};
+
+// A lowered program: the instruction stream plus the side tables its instructions index into.
+struct IrProgram {
+    vector<inst> code;
+    vector<Arg> call_args;  // argument lists of all calls, back to back
+    vector<LabelInfo> labels;
+    vector<JumpTable> jump_tables;
+
+    void emit(const inst& instr) {
+        code.push_back(instr);
+    }
+    // Fresh label named prefix + its id, so names are unique across the program.
+    LabelId new_label(const char* prefix, LabelKind kind = LabelKind::Plain) {
+        labels.push_back({prefix + to_string(labels.size()), kind, -1});
+        return static_cast<LabelId>(labels.size() - 1);
+    }
+    // Head and exit label of a new while loop, linked to each other.
+    pair<LabelId, LabelId> new_loop() {
+        const LabelId head = new_label("while_start_", LabelKind::LoopHead);
+        const LabelId exit = new_label("while_end_", LabelKind::LoopExit);
+        labels[head].pair = exit;
+        labels[exit].pair = head;
+        return {head, exit};
+    }
+    const string& label_name(LabelId label) const {
+        return labels[label].name;
+    }
+    const LabelInfo& label_info(LabelId label) const {
+        return labels[label];
+    }
+    Arg* args(const callOp& call) {
+        return call_args.data() + call.first_arg;
+    }
+    const Arg* args(const callOp& call) const {
+        return call_args.data() + call.first_arg;
+    }
 };
 
+// Local or temporary `instr` writes, -1 if none.
+int written_var(const inst& instr);
+
+// Calls f on every operand `instr` reads, call arguments included; an update reads the
+// destination it writes. Takes const and mutable programs alike.
+template <typename Program, typename Inst, typename F>
+void for_each_operand(Program& prog, Inst& instr, F&& f) {
+    switch (instr.kind) {
+        case Opkind::autoassign:
+            f(instr.autoassign.arg);
+            break;
+        case Opkind::globalassign:
+            f(instr.gAssign.arg);
+            break;
+        case Opkind::binop:
+            f(instr.binop.left);
+            f(instr.binop.right);
+            break;
+        case Opkind::unaryop:
+            f(instr.unary.operand);
+            break;
+        case Opkind::update:
+            f(instr.update.dest);
+            f(instr.update.value);
+            break;
+        case Opkind::select:
+            f(instr.select.condition);
+            f(instr.select.if_true);
+            f(instr.select.if_false);
+            break;
+        case Opkind::jumpiffalse:
+            f(instr.jumpiffalse.condition);
+            break;
+        case Opkind::jumptable:
+            f(instr.jumptable.value);
+            break;
+        case Opkind::call:
+            for (uint32_t i = 0; i < instr.call.arg_count; i++) {
+                f(prog.args(instr.call)[i]);
+            }
+            break;
+        case Opkind::ret:
+            if (instr.ret.has_value) {
+                f(instr.ret.value);
+            }
+            break;
+        default:
+            break;
+    }
+}
+
+inst cFuncOp(SymbolId name, int params);
 inst cAutoVar(int count);
 inst cAutoAssignOp(int index, const Arg& arg);
-inst cFunCallOp(const string& name, const optional<Arg>& arg);
-inst cExternVarOp(const string& name);
+inst cExternVarOp(SymbolId name);
 inst cBinopOp(int dest, const Arg& left, const Arg& right, BinOp op);
 inst cGlobalVar(int count);
 inst cGAssignOp(int index, const Arg& arg);
-void Pir(const vector<inst>& inst);
-vector<inst> astToIr(const struct NodeProg& prog);
-vector<inst> optimisation(vector<inst> ir);
+inst cUpdateOp(const Arg& dest, const Arg& value, BinOp op);
+inst cSelectOp(int dest, const Arg& condition, const Arg& if_true, const Arg& if_false);
+inst cCallOp(SymbolId function, uint32_t first_arg, uint32_t arg_count, int dest);
+inst cLabelOp(LabelId label);
+inst cJumpOp(LabelId label);
+inst cJumpIfFalseOp(LabelId label, const Arg& condition);
+inst cJumpTableOp(const Arg& value, int low, int table);
+void Pir(const IrProgram& ir);
+IrProgram astToIr(const struct NodeProg& prog);
+// Lowers each statement as soon as the parser recognises it, without building the program's
+// tree. Names must be declared before use; nullopt on a syntax error.
+optional<IrProgram> parseToIr(class Parser& parser, string_view src);
+// How far optimisation() unrolls loops: `factor` copies of a body per test, and no loop grown
+// past `budget` instructions, which the target sets since code size costs more on some. A small
+// loop with a known trip count is unrolled completely if it fits the budget. A factor below 2
+// turns unrolling off.
+struct UnrollLimits {
+    int factor = 1;
+    size_t budget = 0;
+};
+IrProgram optimisation(IrProgram ir, const UnrollLimits& unroll = UnrollLimits());
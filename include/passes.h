@@ -0,0 +1,64 @@
+#pragma once
+
+#include <cstddef>
+#include <utility>
+#include <vector>
+
+#include "cfg.h"
+#include "dataflow.h"
+#include "ir.h"
+#include "ssa.h"
+
+// Optimisation passes over one function of an IrProgram, run by optimisation(). A pass never
+// erases instructions: what it deletes becomes a nop, so the function keeps its length until
+// optimisation() compacts it. A pass may add code with insert_code(), which is cheap because
+// the function being optimised is always the last one in the program. Passes that can add or
+// remove a branch, or move or add code, return true when they did. Then the Cfg no longer
+// describes the function and has to be rebuilt. An SsaForm describes the code as it was when
+// built, so it is rebuilt after any pass that edits instructions before another pass reads it.
+
+// Inserts each instruction before the one at its index in the code as it is, in the order
+// given for the same index; an index of code.size() appends.
+void insert_code(IrProgram& prog, vector<pair<size_t, inst>> code);
+
+// First variable number the function leaves unused, for the temporaries a pass adds.
+int first_free_var(const IrProgram& prog, const Cfg& cfg, const VarNumbering& vars);
+
+// Where code can go so that it runs once on the way into loop `l`: just above the label of its
+// header. Returns that label's index, or 0 if the loop can be entered any other way.
+size_t loop_preheader(const IrProgram& prog, const Cfg& cfg, int l);
+
+// Sparse conditional constant propagation (Wegman and Zadeck): follows constants through the
+// SSA values and only along branches that can be taken, then substitutes them into operands,
+// folds branches with a known outcome and deletes the blocks left unreachable.
+bool propagate_constants(IrProgram& prog, const Cfg& cfg, const SsaForm& ssa);
+
+// Global value numbering over the dominator tree: an expression already computed by a dominating
+// instruction, from operands with the same value numbers, becomes a copy of that result.
+void number_values(IrProgram& prog, const Cfg& cfg, const VarNumbering& vars,
+                   const SsaForm& ssa);
+
+// Deletes what nothing reads: writes to locals that are dead by liveness, stores to globals that
+// are stored to again further down the block before a call or return could read them, results
+// of calls nobody uses, and branches to the block that comes next anyway.
+bool remove_dead_code(IrProgram& prog, const Cfg& cfg, const VarNumbering& vars);
+
+// Loop-invariant code motion: moves computations whose operands do not change in a loop to just
+// above its header, as far out as they stay invariant. Only code that cannot trap moves, apart
+// from a division in the header, which runs on the way in regardless.
+bool hoist_invariants(IrProgram& prog, const Cfg& cfg, const VarNumbering& vars,
+                      const SsaForm& ssa, const BitSolution& live);
+
+// Strength reduction of induction variables. A variable stepped by a constant once per
+// iteration is a basic induction variable; i * k + b computed from one becomes a copy of a new
+// variable set up above the loop and stepped by k times as much next to i. When the loop then
+// only needs i to test i < n, the test moves to the new variable and i goes.
+bool reduce_induction_variables(IrProgram& prog, const Cfg& cfg, const VarNumbering& vars,
+                                const SsaForm& ssa);
+
+// Unrolls innermost counted loops (see UnrollLimits) so that the test and the jump back are paid
+// once per several iterations, and the copies of the body form larger blocks for the passes that
+// run after it. Only loops that step one variable by a constant and test it against a bound that
+// the loop does not change are unrolled; loops with a break or a switch are left alone.
+bool unroll_loops(IrProgram& prog, const Cfg& cfg, const VarNumbering& vars,
+                  const UnrollLimits& limits);
@@ -0,0 +1,75 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+#include "cfg.h"
+#include "dataflow.h"
+#include "ir.h"
+
+// SSA form of one function, kept beside the IR rather than written into it. Every definition
+// of a local or temporary is a value, phis join the values that meet at a block, and each
+// variable operand is mapped to the single value that reaches it. Passes reason about values
+// and then edit the ordinary instructions, so nothing downstream ever sees a phi.
+
+enum class ValueKind : uint8_t { Entry, Inst, Phi };
+
+struct SsaValue {
+    ValueKind kind;
+    int var;     // dense index from VarNumbering
+    int block;
+    size_t def;  // Inst: index in IrProgram::code, Phi: index in SsaForm::phis()
+};
+
+struct Phi {
+    int value;
+    int block;
+    vector<int> args;  // incoming value per predecessor, in preds order; -1 if unreachable
+};
+
+// Users of a value: an instruction as its offset from the function start (>= 0), or a phi p
+// as ~p.
+struct SsaUsers {
+    const int* first;
+    const int* last;
+    const int* begin() const { return first; }
+    const int* end() const { return last; }
+};
+
+class SsaForm {
+public:
+    // Cytron et al.: phis at the iterated dominance frontier of each variable's definitions,
+    // pruned to where the variable is live, then renaming down the dominator tree.
+    void build(const IrProgram& prog, const Cfg& cfg, const VarNumbering& vars,
+               const BitSolution& live);
+
+    const vector<SsaValue>& values() const { return m_values; }
+    const vector<Phi>& phis() const { return m_phis; }
+    const vector<int>& block_phis(int block) const { return m_block_phis[block]; }
+
+    // Value instruction `index` defines, -1 if none or if it is unreachable.
+    int def(size_t index) const { return m_defs[index - m_start]; }
+    // Value read by operand `slot` of instruction `index`, counting operands in
+    // for_each_operand order; -1 unless the operand is a variable in reachable code.
+    int use(size_t index, int slot) const { return m_uses[m_use_begin[index - m_start] + slot]; }
+    SsaUsers users(int value) const {
+        return {m_users.data() + m_user_begin[value], m_users.data() + m_user_begin[value + 1]};
+    }
+
+private:
+    void place_phis(const IrProgram& prog, const Cfg& cfg, const VarNumbering& vars,
+                    const BitSolution& live);
+    void rename(const IrProgram& prog, const Cfg& cfg, const VarNumbering& vars);
+    void link_users(const Cfg& cfg);
+
+    size_t m_start = 0;
+    vector<SsaValue> m_values;  // the first vars.size() are the values on function entry
+    vector<Phi> m_phis;
+    vector<vector<int>> m_block_phis;
+    vector<int> m_defs;
+    vector<int> m_uses;
+    vector<uint32_t> m_use_begin;  // per instruction, into m_uses; one extra at the end
+    vector<int> m_users;
+    vector<uint32_t> m_user_begin;  // per value, into m_users; one extra at the end
+};
@@ -15,7 +15,7 @@ public:
     virtual ~TargetAPI() = default;
     
     
-    virtual string gcode(const vector<inst>& ir) = 0;
+    virtual string gcode(const IrProgram& ir) = 0;
     
     
     virtual string asm_ext() const = 0;
@@ -31,6 +31,9 @@ public:
     
     
     virtual bool avail() const = 0;
+    
+    // Instructions of IR an unrolled loop may grow to; see UnrollLimits.
+    virtual size_t unroll_budget() const { return 64; }
 };
 
 
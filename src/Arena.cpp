@@ -0,0 +1,64 @@
+#include "Arena.h"
+
+#include <algorithm>
+#include <utility>
+
+Arena::Arena(Arena&& other) noexcept
+    : m_blocks(std::move(other.m_blocks)),
+      m_cur(other.m_cur),
+      m_end(other.m_end),
+      m_reserved(other.m_reserved) {
+    other.m_blocks.clear();
+    other.m_cur = other.m_end = nullptr;
+    other.m_reserved = 0;
+}
+
+Arena& Arena::operator=(Arena&& other) noexcept {
+    if (this != &other) {
+        m_blocks = std::move(other.m_blocks);
+        m_cur = other.m_cur;
+        m_end = other.m_end;
+        m_reserved = other.m_reserved;
+        other.m_blocks.clear();
+        other.m_cur = other.m_end = nullptr;
+        other.m_reserved = 0;
+    }
+    return *this;
+}
+
+void Arena::adopt(Arena&& other) {
+    for (auto& block : other.m_blocks) {
+        m_blocks.push_back(std::move(block));
+    }
+    m_reserved += other.m_reserved;
+    other.reset();
+}
+
+void Arena::release(const Mark& mark) {
+    m_blocks.resize(mark.blocks);
+    m_cur = mark.cur;
+    m_end = mark.end;
+    m_reserved = mark.reserved;
+}
+
+void Arena::reset() {
+    m_blocks.clear();
+    m_cur = m_end = nullptr;
+    m_reserved = 0;
+}
+
+void* Arena::allocate_slow(size_t size, size_t align) {
+    // oversized requests get a block of their own so the current one keeps being filled
+    size_t block = std::max(BLOCK_SIZE, size + align);
+    m_blocks.emplace_back(new char[block]);
+    m_reserved += block;
+
+    char* base = m_blocks.back().get();
+    if (size + align > BLOCK_SIZE) {
+        uintptr_t p = (reinterpret_cast<uintptr_t>(base) + align - 1) & ~(uintptr_t)(align - 1);
+        return reinterpret_cast<void*>(p);
+    }
+    m_cur = base;
+    m_end = base + block;
+    return allocate(size, align);
+}
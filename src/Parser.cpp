@@ -1,14 +1,34 @@
 #include "Parser.h"
 
-Parser::Parser(std::vector<Token> tokens) : m_tokens(std::move(tokens)) {
+#include <algorithm>
+#include <array>
+#include <charconv>
+#include <cstdint>
+#include <sstream>
+#include <system_error>
+#include <thread>
+
+#include "TokenRing.h"
+
+Parser::Parser(std::vector<Token> tokens, std::string_view src)
+    : m_tokens(std::move(tokens)), m_src(src) {
+}
+
+Parser::Parser(TokenRing& stream, std::string_view src) : m_stream(&stream), m_src(src) {
 }
 
 std::optional<NodeProg> Parser::parse_prog() {
     NodeProg prog;
-
-    while (peek().has_value()) {
-        if (peek().has_value() && peek().value().type == TokenType::ident) {
-            if (peek(1).has_value() && peek(1).value().type == TokenType::semi) {
+    prog.src = m_src;
+    m_arena = &prog.arena;
+    m_stmt_scratch.clear();
+    m_token_scratch.clear();
+    m_case_scratch.clear();
+    m_expr_scratch.clear();
+
+    while (peek()) {
+        if (peek() && peek()->type == TokenType::ident) {
+            if (peek(1) && peek(1)->type == TokenType::semi) {
                 Token global_var = consume();
                 consume();
                 prog.globals.push_back(global_var);
@@ -26,43 +46,214 @@ std::optional<NodeProg> Parser::parse_prog() {
     return prog;
 }
 
-NodeFunc* Parser::parse_f() {
-    if (!peek().has_value() || peek().value().type != TokenType::ident) {
-        std::cerr << "Expected function name" << std::endl;
+bool Parser::parse_direct(StmtSink& sink) {
+    Arena arena;
+    m_arena = &arena;
+    m_stmt_scratch.clear();
+    m_token_scratch.clear();
+    m_case_scratch.clear();
+    m_expr_scratch.clear();
+
+    while (peek()) {
+        if (peek()->type == TokenType::ident && peek(1) && peek(1)->type == TokenType::semi) {
+            sink.global(consume());
+            consume();
+            continue;
+        }
+
+        const Arena::Mark mark = arena.mark();
+        if (parse_f(&sink) == nullptr) {
+            m_arena = nullptr;
+            return false;
+        }
+        arena.release(mark);
+    }
+
+    m_arena = nullptr;
+    return true;
+}
+
+std::optional<NodeProg> Parser::parse_prog_parallel(unsigned workers) {
+    static constexpr size_t MIN_TOKENS_PER_WORKER = 64 * 1024;
+
+    if (workers == 0) {
+        workers = std::max(1u, std::thread::hardware_concurrency());
+    }
+    workers = static_cast<unsigned>(
+        std::min<size_t>(workers, m_tokens.size() / MIN_TOKENS_PER_WORKER));
+    if (m_stream != nullptr || workers <= 1) {
+        return parse_prog();
+    }
+
+    // Pre-pass: split the top level into globals and [begin, end) token ranges of functions by
+    // matching braces. Anything that doesn't fit the `name ... { ... }` shape is left to the
+    // serial parser so it reports the error exactly as before.
+    struct FuncSpan {
+        size_t begin;
+        size_t end;
+    };
+    NodeProg prog;
+    prog.src = m_src;
+    std::vector<FuncSpan> spans;
+    const size_t count = m_tokens.size();
+    for (size_t i = 0; i < count;) {
+        if (m_tokens[i].type == TokenType::ident && i + 1 < count &&
+            m_tokens[i + 1].type == TokenType::semi) {
+            prog.globals.push_back(m_tokens[i]);
+            i += 2;
+            continue;
+        }
+
+        size_t j = i;
+        while (j < count && m_tokens[j].type != TokenType::open_curly &&
+               m_tokens[j].type != TokenType::close_curly) {
+            j++;
+        }
+        if (j == count || m_tokens[j].type != TokenType::open_curly) {
+            return parse_prog();
+        }
+        size_t depth = 0;
+        for (; j < count; j++) {
+            if (m_tokens[j].type == TokenType::open_curly) {
+                depth++;
+            } else if (m_tokens[j].type == TokenType::close_curly && --depth == 0) {
+                break;
+            }
+        }
+        if (j == count) {
+            return parse_prog();
+        }
+        spans.push_back({i, j + 1});
+        i = j + 1;
+    }
+    if (spans.size() < 2) {
+        return parse_prog();
+    }
+
+    // Hand each worker a contiguous run of functions holding about the same number of tokens.
+    // Workers parse into their own arena and buffer their diagnostics; only the first failure
+    // in source order gets reported.
+    struct Worker {
+        size_t first = 0;
+        size_t last = 0;
+        Arena arena;
+        std::vector<NodeFunc*> funcs;
+        std::ostringstream err;
+        size_t failed = SIZE_MAX;
+    };
+    workers = static_cast<unsigned>(std::min<size_t>(workers, spans.size()));
+    std::vector<Worker> jobs(workers);
+    size_t next = 0;
+    for (unsigned w = 0; w < workers; w++) {
+        const size_t target = count * (w + 1) / workers;
+        jobs[w].first = next;
+        while (next < spans.size() && (spans[next].end <= target || w + 1 == workers)) {
+            next++;
+        }
+        jobs[w].last = next;
+    }
+
+    std::vector<std::thread> threads;
+    for (Worker& job : jobs) {
+        if (job.first == job.last) {
+            continue;
+        }
+        threads.emplace_back([this, &job, &spans] {
+            const size_t base = spans[job.first].begin;
+            Parser parser(std::vector<Token>(m_tokens.begin() + base,
+                                             m_tokens.begin() + spans[job.last - 1].end),
+                          m_src);
+            parser.m_arena = &job.arena;
+            parser.m_err = &job.err;
+            for (size_t f = job.first; f < job.last; f++) {
+                parser.m_index = spans[f].begin - base;
+                NodeFunc* func = parser.parse_f();
+                if (func == nullptr || parser.m_index != spans[f].end - base) {
+                    job.failed = f;
+                    return;
+                }
+                job.funcs.push_back(func);
+            }
+        });
+    }
+    for (std::thread& t : threads) {
+        t.join();
+    }
+
+    for (Worker& job : jobs) {
+        if (job.failed != SIZE_MAX) {
+            // brace matching and the grammar disagree: let the serial parser explain why
+            if (job.err.str().empty()) {
+                return parse_prog();
+            }
+            *m_err << job.err.str();
+            return {};
+        }
+        prog.funcs.insert(prog.funcs.end(), job.funcs.begin(), job.funcs.end());
+        prog.arena.adopt(std::move(job.arena));
+    }
+    return prog;
+}
+
+// With a sink the body statements are handed over one by one instead of being collected.
+NodeFunc* Parser::parse_f(StmtSink* sink) {
+    if (!peek() || peek()->type != TokenType::ident) {
+        *m_err << "Expected function name" << std::endl;
         return nullptr;
     }
 
-    NodeFunc* func = new NodeFunc();
+    NodeFunc* func = m_arena->make<NodeFunc>();
     func->name = consume();
 
-    if (!peek().has_value() || peek().value().type != TokenType::open_paren) {
-        std::cerr << "Expected '(' after function name" << std::endl;
+    if (!peek() || peek()->type != TokenType::open_paren) {
+        *m_err << "Expected '(' after function name" << std::endl;
         return nullptr;
     }
     consume();
 
-    if (!peek().has_value() || peek().value().type != TokenType::close_paren) {
-        std::cerr << "Expected ')' after function parameters" << std::endl;
+    const size_t first_param = m_token_scratch.size();
+    while (peek() && peek()->type == TokenType::ident) {
+        m_token_scratch.push_back(consume());
+        if (!peek() || peek()->type != TokenType::comma) {
+            break;
+        }
+        consume();
+    }
+    func->params = take_scratch(m_token_scratch, first_param);
+
+    if (!peek() || peek()->type != TokenType::close_paren) {
+        *m_err << "Expected ')' after function parameters" << std::endl;
         return nullptr;
     }
     consume();
 
-    if (!peek().has_value() || peek().value().type != TokenType::open_curly) {
-        std::cerr << "Expected '{' after function signature" << std::endl;
+    if (!peek() || peek()->type != TokenType::open_curly) {
+        *m_err << "Expected '{' after function signature" << std::endl;
         return nullptr;
     }
     consume();
 
-    while (peek().has_value() && peek().value().type != TokenType::close_curly) {
+    if (sink != nullptr) {
+        sink->function(*func);
+    }
+    const Arena::Mark body_mark = m_arena->mark();
+    const size_t first = m_stmt_scratch.size();
+    while (peek() && peek()->type != TokenType::close_curly) {
         NodeStmt* stmt = parseStmt();
         if (stmt == nullptr) {
             return nullptr;
         }
-        func->body.push_back(stmt);
+        if (sink != nullptr) {
+            sink->statement(stmt);
+            m_arena->release(body_mark);
+        } else {
+            m_stmt_scratch.push_back(stmt);
+        }
     }
+    func->body = take_scratch(m_stmt_scratch, first);
 
-    if (!peek().has_value() || peek().value().type != TokenType::close_curly) {
-        std::cerr << "Expected '}' after function body" << std::endl;
+    if (!peek() || peek()->type != TokenType::close_curly) {
+        *m_err << "Expected '}' after function body" << std::endl;
         return nullptr;
     }
     consume();
@@ -70,39 +261,71 @@ NodeFunc* Parser::parse_f() {
     return func;
 }
 
+// `+=` and friends: the binary operator applied in place, if `type` is one of them
+static bool compound_assign_op(TokenType type, BinOpType& op) {
+    switch (type) {
+        case TokenType::plus_equal:
+            op = BinOpType::Add;
+            return true;
+        case TokenType::minus_equal:
+            op = BinOpType::Sub;
+            return true;
+        case TokenType::mul_equal:
+            op = BinOpType::Mul;
+            return true;
+        case TokenType::div_equal:
+            op = BinOpType::Div;
+            return true;
+        case TokenType::mod_equal:
+            op = BinOpType::Mod;
+            return true;
+        case TokenType::shl_equal:
+            op = BinOpType::Shl;
+            return true;
+        case TokenType::shr_equal:
+            op = BinOpType::Shr;
+            return true;
+        case TokenType::and_equal:
+            op = BinOpType::And;
+            return true;
+        case TokenType::or_equal:
+            op = BinOpType::Or;
+            return true;
+        default:
+            return false;
+    }
+}
+
 NodeStmt* Parser::parseStmt() {
-    if (!peek().has_value()) {
-        std::cerr << "Unexpected end of file" << std::endl;
+    if (!peek()) {
+        *m_err << "Unexpected end of file" << std::endl;
         return nullptr;
     }
 
-    Token current = peek().value();
+    const Token current = *peek();
 
     if (current.type == TokenType::auto_) {
         consume();
-        NodeStmt* stmt = new NodeStmt();
-        stmt->type = StmtType::Auto;
+        NodeDecl* stmt = m_arena->make<NodeDecl>(StmtType::Auto);
 
+        const size_t first = m_token_scratch.size();
         while (true) {
-            if (!peek().has_value() || peek().value().type != TokenType::ident) {
-                std::cerr << "Expected identifier after 'auto'" << std::endl;
+            if (!peek() || peek()->type != TokenType::ident) {
+                *m_err << "Expected identifier after 'auto'" << std::endl;
                 return nullptr;
             }
-            Token id = consume();
-            stmt->idents.push_back(id);
-            if (stmt->idents.size() == 1) {
-                stmt->ident = id;
-            }
+            m_token_scratch.push_back(consume());
 
-            if (peek().has_value() && peek().value().type == TokenType::comma) {
+            if (peek() && peek()->type == TokenType::comma) {
                 consume();
                 continue;
             }
             break;
         }
+        stmt->idents = take_scratch(m_token_scratch, first);
 
-        if (!peek().has_value() || peek().value().type != TokenType::semi) {
-            std::cerr << "Expected ';' after auto declaration" << std::endl;
+        if (!peek() || peek()->type != TokenType::semi) {
+            *m_err << "Expected ';' after auto declaration" << std::endl;
             return nullptr;
         }
         consume();
@@ -112,29 +335,26 @@ NodeStmt* Parser::parseStmt() {
 
     if (current.type == TokenType::extern_) {
         consume();
-        NodeStmt* stmt = new NodeStmt();
-        stmt->type = StmtType::Extern;
+        NodeDecl* stmt = m_arena->make<NodeDecl>(StmtType::Extern);
 
+        const size_t first = m_token_scratch.size();
         while (true) {
-            if (!peek().has_value() || peek().value().type != TokenType::ident) {
-                std::cerr << "Expected identifier after 'extern'" << std::endl;
+            if (!peek() || peek()->type != TokenType::ident) {
+                *m_err << "Expected identifier after 'extern'" << std::endl;
                 return nullptr;
             }
-            Token id = consume();
-            stmt->idents.push_back(id);
-            if (stmt->idents.size() == 1) {
-                stmt->ident = id;
-            }
+            m_token_scratch.push_back(consume());
 
-            if (peek().has_value() && peek().value().type == TokenType::comma) {
+            if (peek() && peek()->type == TokenType::comma) {
                 consume();
                 continue;
             }
             break;
         }
+        stmt->idents = take_scratch(m_token_scratch, first);
 
-        if (!peek().has_value() || peek().value().type != TokenType::semi) {
-            std::cerr << "Expected ';' after extern declaration" << std::endl;
+        if (!peek() || peek()->type != TokenType::semi) {
+            *m_err << "Expected ';' after extern declaration" << std::endl;
             return nullptr;
         }
         consume();
@@ -144,11 +364,10 @@ NodeStmt* Parser::parseStmt() {
 
     if (current.type == TokenType::if_) {
         consume();
-        NodeStmt* stmt = new NodeStmt();
-        stmt->type = StmtType::If;
+        NodeIf* stmt = m_arena->make<NodeIf>();
 
-        if (!peek().has_value() || peek().value().type != TokenType::open_paren) {
-            std::cerr << "Expected '(' after 'if'" << std::endl;
+        if (!peek() || peek()->type != TokenType::open_paren) {
+            *m_err << "Expected '(' after 'if'" << std::endl;
             return nullptr;
         }
         consume();
@@ -158,8 +377,8 @@ NodeStmt* Parser::parseStmt() {
             return nullptr;
         }
 
-        if (!peek().has_value() || peek().value().type != TokenType::close_paren) {
-            std::cerr << "Expected ')' after if condition" << std::endl;
+        if (!peek() || peek()->type != TokenType::close_paren) {
+            *m_err << "Expected ')' after if condition" << std::endl;
             return nullptr;
         }
         consume();
@@ -169,7 +388,7 @@ NodeStmt* Parser::parseStmt() {
             return nullptr;
         }
 
-        if (peek().has_value() && peek().value().type == TokenType::else_) {
+        if (peek() && peek()->type == TokenType::else_) {
             consume();
             stmt->else_stmt = parseStmt();
             if (stmt->else_stmt == nullptr) {
@@ -182,11 +401,10 @@ NodeStmt* Parser::parseStmt() {
 
     if (current.type == TokenType::while_) {
         consume();
-        NodeStmt* stmt = new NodeStmt();
-        stmt->type = StmtType::While;
+        NodeWhile* stmt = m_arena->make<NodeWhile>();
 
-        if (!peek().has_value() || peek().value().type != TokenType::open_paren) {
-            std::cerr << "Expected '(' after 'while'" << std::endl;
+        if (!peek() || peek()->type != TokenType::open_paren) {
+            *m_err << "Expected '(' after 'while'" << std::endl;
             return nullptr;
         }
         consume();
@@ -196,40 +414,53 @@ NodeStmt* Parser::parseStmt() {
             return nullptr;
         }
 
-        if (!peek().has_value() || peek().value().type != TokenType::close_paren) {
-            std::cerr << "Expected ')' after while condition" << std::endl;
+        if (!peek() || peek()->type != TokenType::close_paren) {
+            *m_err << "Expected ')' after while condition" << std::endl;
             return nullptr;
         }
         consume();
 
-        stmt->then_stmt = parseStmt();
-        if (stmt->then_stmt == nullptr) {
+        stmt->body = parseStmt();
+        if (stmt->body == nullptr) {
             return nullptr;
         }
 
         return stmt;
     }
 
+    if (current.type == TokenType::switch_) {
+        return parseSwitch();
+    }
+
+    if (current.type == TokenType::break_) {
+        consume();
+        if (!peek() || peek()->type != TokenType::semi) {
+            *m_err << "Expected ';' after 'break'" << std::endl;
+            return nullptr;
+        }
+        consume();
+        return m_arena->make<NodeBreak>();
+    }
+
     if (current.type == TokenType::_return) {
         consume();
-        NodeStmt* stmt = new NodeStmt();
-        stmt->type = StmtType::Return;
+        NodeReturn* stmt = m_arena->make<NodeReturn>();
 
-        if (peek().has_value() && peek().value().type == TokenType::open_paren) {
+        if (peek() && peek()->type == TokenType::open_paren) {
             consume();
             stmt->expr = parseExpr();
             if (stmt->expr == nullptr) {
                 return nullptr;
             }
-            if (!peek().has_value() || peek().value().type != TokenType::close_paren) {
-                std::cerr << "Expected ')' after return expression" << std::endl;
+            if (!peek() || peek()->type != TokenType::close_paren) {
+                *m_err << "Expected ')' after return expression" << std::endl;
                 return nullptr;
             }
             consume();
         }
 
-        if (!peek().has_value() || peek().value().type != TokenType::semi) {
-            std::cerr << "Expected ';' after return statement" << std::endl;
+        if (!peek() || peek()->type != TokenType::semi) {
+            *m_err << "Expected ';' after return statement" << std::endl;
             return nullptr;
         }
         consume();
@@ -239,19 +470,20 @@ NodeStmt* Parser::parseStmt() {
 
     if (current.type == TokenType::open_curly) {
         consume();
-        NodeStmt* stmt = new NodeStmt();
-        stmt->type = StmtType::Block;
+        NodeBlock* stmt = m_arena->make<NodeBlock>();
 
-        while (peek().has_value() && peek().value().type != TokenType::close_curly) {
+        const size_t first = m_stmt_scratch.size();
+        while (peek() && peek()->type != TokenType::close_curly) {
             NodeStmt* sub_stmt = parseStmt();
             if (sub_stmt == nullptr) {
                 return nullptr;
             }
-            stmt->body.push_back(sub_stmt);
+            m_stmt_scratch.push_back(sub_stmt);
         }
+        stmt->body = take_scratch(m_stmt_scratch, first);
 
-        if (!peek().has_value() || peek().value().type != TokenType::close_curly) {
-            std::cerr << "Expected '}' after block" << std::endl;
+        if (!peek() || peek()->type != TokenType::close_curly) {
+            *m_err << "Expected '}' after block" << std::endl;
             return nullptr;
         }
         consume();
@@ -259,188 +491,426 @@ NodeStmt* Parser::parseStmt() {
         return stmt;
     }
 
+    if (current.type == TokenType::plus_plus || current.type == TokenType::minus_minus) {
+        consume();
+        if (!peek() || peek()->type != TokenType::ident) {
+            *m_err << "Expected identifier after '++' or '--'" << std::endl;
+            return nullptr;
+        }
+        Token ident = consume();
+        if (!peek() || peek()->type != TokenType::semi) {
+            *m_err << "Expected ';' after increment" << std::endl;
+            return nullptr;
+        }
+        consume();
+
+        BinOpType op = current.type == TokenType::plus_plus ? BinOpType::Add : BinOpType::Sub;
+        return m_arena->make<NodeUpdate>(ident, op, nullptr);
+    }
+
     if (current.type == TokenType::ident) {
         Token ident = consume();
 
-        if (peek().has_value() && peek().value().type == TokenType::equal) {
+        if (peek() && (peek()->type == TokenType::plus_plus ||
+                       peek()->type == TokenType::minus_minus)) {
+            BinOpType op = peek()->type == TokenType::plus_plus ? BinOpType::Add : BinOpType::Sub;
+            consume();
+            if (!peek() || peek()->type != TokenType::semi) {
+                *m_err << "Expected ';' after increment" << std::endl;
+                return nullptr;
+            }
+            consume();
+            return m_arena->make<NodeUpdate>(ident, op, nullptr);
+        }
+
+        BinOpType compound_op;
+        if (peek() && compound_assign_op(peek()->type, compound_op)) {
             consume();
 
             NodeExpr* expr = parseExpr();
             if (expr == nullptr) {
-                std::cerr << "ERROR: parse_expr returned nullptr" << std::endl;
                 return nullptr;
             }
-
-            NodeStmt* stmt = new NodeStmt();
-            stmt->type = StmtType::Assign;
-            stmt->ident = ident;
-            stmt->expr = expr;
-
-            if (!peek().has_value() || peek().value().type != TokenType::semi) {
-                std::cerr << "Expected ';' after assignment";
-                if (peek().has_value()) {
-                    std::cerr << ", but found token type " << (int)peek().value().type;
-                }
-                std::cerr << std::endl;
+            if (!peek() || peek()->type != TokenType::semi) {
+                *m_err << "Expected ';' after compound assignment" << std::endl;
                 return nullptr;
             }
             consume();
+            return m_arena->make<NodeUpdate>(ident, compound_op, expr);
+        }
 
-            return stmt;
-        } else if (peek().has_value() && peek().value().type == TokenType::open_paren) {
+        if (peek() && peek()->type == TokenType::equal) {
             consume();
 
-            NodeStmt* stmt = new NodeStmt();
-            stmt->type = StmtType::FuncCall;
-            stmt->ident = ident;
-            stmt->expr = nullptr;
+            NodeExpr* expr = parseExpr();
+            if (expr == nullptr) {
+                *m_err << "ERROR: parse_expr returned nullptr" << std::endl;
+                return nullptr;
+            }
 
-            if (peek().has_value() && peek().value().type != TokenType::close_paren) {
-                NodeExpr* expr = parseExpr();
-                if (expr == nullptr) {
-                    return nullptr;
+            NodeAssign* stmt = m_arena->make<NodeAssign>(ident, expr);
+
+            if (!peek() || peek()->type != TokenType::semi) {
+                *m_err << "Expected ';' after assignment";
+                if (peek()) {
+                    *m_err << ", but found token type " << (int)peek()->type;
                 }
-                stmt->args.push_back(expr);
+                *m_err << std::endl;
+                return nullptr;
             }
+            consume();
 
-            if (!peek().has_value() || peek().value().type != TokenType::close_paren) {
-                std::cerr << "Expected ')' after function arguments" << std::endl;
+            return stmt;
+        } else if (peek() && peek()->type == TokenType::open_paren) {
+            consume();
+
+            NodeCall* stmt = m_arena->make<NodeCall>(ident);
+            if (!parseArgs(stmt->args)) {
                 return nullptr;
             }
-            consume();
 
-            if (!peek().has_value() || peek().value().type != TokenType::semi) {
-                std::cerr << "Expected ';' after function call" << std::endl;
+            if (!peek() || peek()->type != TokenType::semi) {
+                *m_err << "Expected ';' after function call" << std::endl;
                 return nullptr;
             }
             consume();
 
             return stmt;
         } else {
-            std::cerr << "Expected '=' or '(' after identifier" << std::endl;
+            *m_err << "Expected '=' or '(' after identifier" << std::endl;
             return nullptr;
         }
     }
 
-    std::cerr << "Unexpected token in statement" << std::endl;
+    *m_err << "Unexpected token in statement" << std::endl;
     return nullptr;
 }
 
-NodeExpr* Parser::parseExpr() {
+// switch (expr) { case N: stmts... case -N: stmts... default: stmts... }
+// Case values are integer constants; each label owns the statements up to the next one.
+NodeStmt* Parser::parseSwitch() {
+    consume();
+    NodeSwitch* stmt = m_arena->make<NodeSwitch>();
+
+    if (!peek() || peek()->type != TokenType::open_paren) {
+        *m_err << "Expected '(' after 'switch'" << std::endl;
+        return nullptr;
+    }
+    consume();
+
+    stmt->value = parseExpr();
+    if (stmt->value == nullptr) {
+        return nullptr;
+    }
+
+    if (!peek() || peek()->type != TokenType::close_paren) {
+        *m_err << "Expected ')' after switch value" << std::endl;
+        return nullptr;
+    }
+    consume();
+
+    if (!peek() || peek()->type != TokenType::open_curly) {
+        *m_err << "Expected '{' after switch" << std::endl;
+        return nullptr;
+    }
+    consume();
+
+    const size_t first_case = m_case_scratch.size();
+    bool seen_default = false;
+    while (peek() && peek()->type != TokenType::close_curly) {
+        SwitchCase label;
+        if (peek()->type == TokenType::default_) {
+            consume();
+            if (seen_default) {
+                *m_err << "Multiple 'default' labels in switch" << std::endl;
+                return nullptr;
+            }
+            seen_default = true;
+            label.is_default = true;
+        } else if (peek()->type == TokenType::case_) {
+            consume();
+            bool negative = false;
+            if (peek() && peek()->type == TokenType::minus) {
+                consume();
+                negative = true;
+            }
+            if (!peek() || peek()->type != TokenType::int_literal) {
+                *m_err << "Expected integer constant after 'case'" << std::endl;
+                return nullptr;
+            }
+            std::string_view text = token_text(m_src, consume());
+            int64_t value = 0;
+            const auto [end, ec] = std::from_chars(text.data(), text.data() + text.size(), value);
+            if (negative) {
+                value = -value;
+            }
+            if (ec != std::errc{} || end != text.data() + text.size() || value < INT32_MIN ||
+                value > INT32_MAX) {
+                *m_err << "Case value " << (negative ? "-" : "") << text
+                       << " does not fit in 32 bits" << std::endl;
+                return nullptr;
+            }
+            label.value = (int)value;
+        } else {
+            *m_err << "Expected 'case' or 'default' in switch" << std::endl;
+            return nullptr;
+        }
+
+        if (!peek() || peek()->type != TokenType::colon) {
+            *m_err << "Expected ':' after case label" << std::endl;
+            return nullptr;
+        }
+        consume();
+
+        const size_t first = m_stmt_scratch.size();
+        while (peek() && peek()->type != TokenType::case_ && peek()->type != TokenType::default_ &&
+               peek()->type != TokenType::close_curly) {
+            NodeStmt* sub_stmt = parseStmt();
+            if (sub_stmt == nullptr) {
+                return nullptr;
+            }
+            m_stmt_scratch.push_back(sub_stmt);
+        }
+        label.body = take_scratch(m_stmt_scratch, first);
+        m_case_scratch.push_back(label);
+    }
+    stmt->cases = take_scratch(m_case_scratch, first_case);
+
+    std::vector<int> values;
+    for (const SwitchCase& label : stmt->cases) {
+        if (!label.is_default) {
+            values.push_back(label.value);
+        }
+    }
+    std::sort(values.begin(), values.end());
+    const auto repeated = std::adjacent_find(values.begin(), values.end());
+    if (repeated != values.end()) {
+        *m_err << "Duplicate case value " << *repeated << " in switch" << std::endl;
+        return nullptr;
+    }
+
+    if (!peek() || peek()->type != TokenType::close_curly) {
+        *m_err << "Expected '}' after switch body" << std::endl;
+        return nullptr;
+    }
+    consume();
+
+    return stmt;
+}
+
+// Infix operators by token: binding power (0 = not an infix operator) and the node's operator.
+// Higher binds tighter; all binary operators are left-associative. `&`/`&&` and `|`/`||` lex
+// to the same tokens and take C's logical-operator precedence.
+struct InfixOp {
+    uint8_t power;
+    BinOpType op;
+};
+
+static constexpr uint8_t PREFIX_POWER = 20;
+// `?:` binds looser than every binary operator and associates to the right.
+static constexpr uint8_t TERNARY_POWER = 1;
+
+static constexpr std::array<InfixOp, 256> make_infix_table() {
+    std::array<InfixOp, 256> table{};
+    auto set = [&table](TokenType type, uint8_t power, BinOpType op) {
+        table[static_cast<uint8_t>(type)] = {power, op};
+    };
+    set(TokenType::or_, 2, BinOpType::Or);
+    set(TokenType::and_, 4, BinOpType::And);
+    set(TokenType::equal_equal, 6, BinOpType::EqualEqual);
+    set(TokenType::not_equal, 6, BinOpType::NotEqual);
+    set(TokenType::less, 8, BinOpType::Less);
+    set(TokenType::less_equal, 8, BinOpType::LessEqual);
+    set(TokenType::greater, 8, BinOpType::Greater);
+    set(TokenType::greater_equal, 8, BinOpType::GreaterEqual);
+    set(TokenType::shl, 10, BinOpType::Shl);
+    set(TokenType::shr, 10, BinOpType::Shr);
+    set(TokenType::plus, 12, BinOpType::Add);
+    set(TokenType::minus, 12, BinOpType::Sub);
+    set(TokenType::multi, 14, BinOpType::Mul);
+    set(TokenType::div, 14, BinOpType::Div);
+    set(TokenType::mod, 14, BinOpType::Mod);
+    return table;
+}
+
+static constexpr std::array<InfixOp, 256> kInfixOps = make_infix_table();
+
+static_assert(kInfixOps[static_cast<uint8_t>(TokenType::multi)].power >
+                  kInfixOps[static_cast<uint8_t>(TokenType::plus)].power,
+              "multiplicative operators must bind tighter than additive ones");
+
+// Precedence climbing: parse a prefix operand, then keep folding in operators that bind tighter
+// than `min_power`. The right operand is parsed at the operator's own power, which makes
+// operators of equal precedence associate to the left.
+NodeExpr* Parser::parseExpr(uint8_t min_power) {
     NodeExpr* left = parsePExpr();
     if (left == nullptr) {
         return nullptr;
     }
 
-    while (peek().has_value()) {
-        Token op_token = peek().value();
-        BinOpType bin_op;
-        bool is_binop = false;
-
-        if (op_token.type == TokenType::plus) {
-            bin_op = BinOpType::Add;
-            is_binop = true;
-        } else if (op_token.type == TokenType::minus) {
-            bin_op = BinOpType::Sub;
-            is_binop = true;
-        } else if (op_token.type == TokenType::multi) {
-            bin_op = BinOpType::Mul;
-            is_binop = true;
-        } else if (op_token.type == TokenType::div) {
-            bin_op = BinOpType::Div;
-            is_binop = true;
-        } else if (op_token.type == TokenType::mod) {
-            bin_op = BinOpType::Mod;
-            is_binop = true;
-        } else if (op_token.type == TokenType::equal_equal) {
-            bin_op = BinOpType::EqualEqual;
-            is_binop = true;
-        } else if (op_token.type == TokenType::not_equal) {
-            bin_op = BinOpType::NotEqual;
-            is_binop = true;
-        } else if (op_token.type == TokenType::less) {
-            bin_op = BinOpType::Less;
-            is_binop = true;
-        } else if (op_token.type == TokenType::less_equal) {
-            bin_op = BinOpType::LessEqual;
-            is_binop = true;
-        } else if (op_token.type == TokenType::greater) {
-            bin_op = BinOpType::Greater;
-            is_binop = true;
-        } else if (op_token.type == TokenType::greater_equal) {
-            bin_op = BinOpType::GreaterEqual;
-            is_binop = true;
-        } else if (op_token.type == TokenType::and_) {
-            bin_op = BinOpType::And;
-            is_binop = true;
-        } else if (op_token.type == TokenType::or_) {
-            bin_op = BinOpType::Or;
-            is_binop = true;
-        } else if (op_token.type == TokenType::shl) {
-            bin_op = BinOpType::Shl;
-            is_binop = true;
-        } else if (op_token.type == TokenType::shr) {
-            bin_op = BinOpType::Shr;
-            is_binop = true;
-        }
-
-        if (!is_binop) {
-            break;
+    while (peek()) {
+        if (peek()->type == TokenType::question) {
+            if (TERNARY_POWER <= min_power) {
+                break;
+            }
+            consume();
+
+            NodeExpr* if_true = parseExpr();
+            if (if_true == nullptr) {
+                return nullptr;
+            }
+            if (!peek() || peek()->type != TokenType::colon) {
+                *m_err << "Expected ':' in conditional expression" << std::endl;
+                return nullptr;
+            }
+            consume();
+
+            NodeExpr* if_false = parseExpr(TERNARY_POWER - 1);
+            if (if_false == nullptr) {
+                return nullptr;
+            }
+            left = m_arena->make<NodeTernary>(left, if_true, if_false);
+            continue;
         }
 
+        const InfixOp infix = kInfixOps[static_cast<uint8_t>(peek()->type)];
+        if (infix.power <= min_power) {
+            break;
+        }
         consume();
 
-        NodeExpr* right = parsePExpr();
+        NodeExpr* right = parseExpr(infix.power);
         if (right == nullptr) {
             return nullptr;
         }
-
-        NodeExpr* bin_expr = new NodeExpr();
-        bin_expr->type = ExprType::BinaryOp;
-        bin_expr->bin_op = bin_op;
-        bin_expr->left = left;
-        bin_expr->right = right;
-        bin_expr->token = op_token;
-
-        left = bin_expr;
+        left = m_arena->make<NodeBinExpr>(infix.op, left, right);
     }
 
     return left;
 }
 
 NodeExpr* Parser::parsePExpr() {
-    if (!peek().has_value()) {
-        std::cerr << "Expected expression" << std::endl;
+    if (!peek()) {
+        *m_err << "Expected expression" << std::endl;
         return nullptr;
     }
 
-    Token current = peek().value();
+    const Token current = *peek();
 
     if (current.type == TokenType::int_literal) {
-        NodeExpr* expr = new NodeExpr();
-        expr->type = ExprType::IntLit;
-        expr->token = consume();
-        return expr;
+        const std::string_view text = token_text(m_src, current);
+        int value = 0;
+        const auto [end, ec] = std::from_chars(text.data(), text.data() + text.size(), value);
+        if (ec != std::errc{} || end != text.data() + text.size()) {
+            *m_err << "Integer literal " << text << " does not fit in 32 bits" << std::endl;
+            return nullptr;
+        }
+        return m_arena->make<NodeTerm>(ExprType::IntLit, consume());
     }
 
     if (current.type == TokenType::ident) {
-        NodeExpr* expr = new NodeExpr();
-        expr->type = ExprType::Ident;
-        expr->token = consume();
-        return expr;
+        if (peek(1) && peek(1)->type == TokenType::open_paren) {
+            NodeCallExpr* call = m_arena->make<NodeCallExpr>(consume());
+            consume();
+            if (!parseArgs(call->args)) {
+                return nullptr;
+            }
+            return call;
+        }
+        return m_arena->make<NodeTerm>(ExprType::Ident, consume());
     }
 
-    std::cerr << "Expected int literal or identifier in expression" << std::endl;
+    if (current.type == TokenType::open_paren) {
+        consume();
+        NodeExpr* inner = parseExpr();
+        if (inner == nullptr) {
+            return nullptr;
+        }
+        if (!peek() || peek()->type != TokenType::close_paren) {
+            *m_err << "Expected ')' after expression" << std::endl;
+            return nullptr;
+        }
+        consume();
+        return inner;
+    }
+
+    if (current.type == TokenType::not_ || current.type == TokenType::minus) {
+        consume();
+        NodeExpr* operand = parseExpr(PREFIX_POWER);
+        if (operand == nullptr) {
+            return nullptr;
+        }
+        UnaryOpType op = current.type == TokenType::not_ ? UnaryOpType::Not : UnaryOpType::Negate;
+        return m_arena->make<NodeUnaryExpr>(op, operand);
+    }
+
+    *m_err << "Expected int literal or identifier in expression" << std::endl;
     return nullptr;
 }
 
-std::optional<Token> Parser::peek(int offset) const {
-    if (m_index + offset >= m_tokens.size()) {
-        return {};
+// Comma-separated call arguments after the '(' up to and including the ')'.
+bool Parser::parseArgs(ArenaSpan<NodeExpr*>& args) {
+    const size_t first = m_expr_scratch.size();
+    if (peek() && peek()->type != TokenType::close_paren) {
+        while (true) {
+            NodeExpr* expr = parseExpr();
+            if (expr == nullptr) {
+                return false;
+            }
+            m_expr_scratch.push_back(expr);
+            if (!peek() || peek()->type != TokenType::comma) {
+                break;
+            }
+            consume();
+        }
+    }
+    args = take_scratch(m_expr_scratch, first);
+
+    if (!peek() || peek()->type != TokenType::close_paren) {
+        *m_err << "Expected ')' after function arguments" << std::endl;
+        return false;
+    }
+    consume();
+    return true;
+}
+
+// Moves scratch[from..] into the arena and pops it off the scratch stack.
+template <typename T>
+ArenaSpan<T> Parser::take_scratch(std::vector<T>& scratch, size_t from) {
+    ArenaSpan<T> span = m_arena->copy(scratch.data() + from, scratch.size() - from);
+    scratch.resize(from);
+    return span;
+}
+
+const Token* Parser::peek(int offset) {
+    if (m_index + offset >= m_tokens.size() && !fill(offset + 1)) {
+        return nullptr;
+    }
+    return &m_tokens[m_index + offset];
+}
+
+// Streaming mode only: drop the consumed prefix of the window and pull batches from the ring
+// until `ahead` tokens past m_index are buffered. Invalidates earlier peek() pointers.
+bool Parser::fill(size_t ahead) {
+    if (m_stream == nullptr || m_stream_done) {
+        return false;
+    }
+
+    m_tokens.erase(m_tokens.begin(), m_tokens.begin() + m_index);
+    m_index = 0;
+    while (m_tokens.size() < ahead) {
+        size_t have = m_tokens.size();
+        m_tokens.resize(have + STREAM_BATCH);
+        size_t got = m_stream->pop(m_tokens.data() + have, STREAM_BATCH);
+        m_tokens.resize(have + got);
+        if (got == 0) {
+            m_stream_done = true;
+            return false;
+        }
     }
-    return m_tokens[m_index + offset];
+    return true;
 }
 
-Token Parser::consume() {
+const Token& Parser::consume() {
     return m_tokens[m_index++];
 }
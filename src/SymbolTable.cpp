@@ -0,0 +1,36 @@
+#include "SymbolTable.h"
+
+SymbolTable& SymbolTable::instance() {
+    static SymbolTable table;
+    return table;
+}
+
+SymbolId SymbolTable::intern(std::string_view name) {
+    auto it = m_ids.find(name);
+    if (it != m_ids.end()) {
+        return it->second;
+    }
+    SymbolId id = static_cast<SymbolId>(m_names.size());
+    const std::string& stored = m_names.emplace_back(name);
+    m_ids.emplace(stored, id);
+    return id;
+}
+
+bool SymbolSet::insert(SymbolId id) {
+    if (id >= m_member.size()) {
+        m_member.resize(id + 1, false);
+    }
+    if (m_member[id]) {
+        return false;
+    }
+    m_member[id] = true;
+    m_items.push_back(id);
+    return true;
+}
+
+void SymbolSet::clear() {
+    for (SymbolId id : m_items) {
+        m_member[id] = false;
+    }
+    m_items.clear();
+}
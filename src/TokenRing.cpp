@@ -0,0 +1,76 @@
+#include "TokenRing.h"
+
+#include <algorithm>
+#include <thread>
+
+static size_t round_up_pow2(size_t n) {
+    size_t p = 1;
+    while (p < n) p <<= 1;
+    return p;
+}
+
+TokenRing::TokenRing(size_t capacity) {
+    capacity = round_up_pow2(std::max<size_t>(capacity, 2));
+    m_buf.resize(capacity);
+    m_mask = capacity - 1;
+}
+
+bool TokenRing::push(const Token* tokens, size_t count) {
+    const size_t capacity = m_buf.size();
+    size_t head = m_head.load(std::memory_order_relaxed);
+    while (count > 0) {
+        size_t tail = m_tail.load(std::memory_order_acquire);
+        size_t space = capacity - (head - tail);
+        if (space == 0) {
+            if (m_abandoned.load(std::memory_order_relaxed)) {
+                return false;
+            }
+            std::this_thread::yield();
+            continue;
+        }
+
+        size_t n = std::min(space, count);
+        for (size_t i = 0; i < n; i++) {
+            m_buf[(head + i) & m_mask] = tokens[i];
+        }
+        head += n;
+        tokens += n;
+        count -= n;
+        m_head.store(head, std::memory_order_release);
+    }
+    return !m_abandoned.load(std::memory_order_relaxed);
+}
+
+void TokenRing::close() {
+    m_closed.store(true, std::memory_order_release);
+}
+
+size_t TokenRing::pop(Token* out, size_t max) {
+    size_t tail = m_tail.load(std::memory_order_relaxed);
+    while (true) {
+        size_t head = m_head.load(std::memory_order_acquire);
+        size_t avail = head - tail;
+        if (avail == 0) {
+            if (m_closed.load(std::memory_order_acquire)) {
+                // the producer may have pushed its last batch right before closing
+                if (m_head.load(std::memory_order_acquire) == tail) {
+                    return 0;
+                }
+                continue;
+            }
+            std::this_thread::yield();
+            continue;
+        }
+
+        size_t n = std::min(avail, max);
+        for (size_t i = 0; i < n; i++) {
+            out[i] = m_buf[(tail + i) & m_mask];
+        }
+        m_tail.store(tail + n, std::memory_order_release);
+        return n;
+    }
+}
+
+void TokenRing::abandon() {
+    m_abandoned.store(true, std::memory_order_relaxed);
+}
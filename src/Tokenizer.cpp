@@ -1,266 +1,621 @@
 #include "Tokenizer.h"
 
-Tokenizer::Tokenizer(const std::string& src) : m_src(src) {
+#include <algorithm>
+#include <array>
+#include <thread>
+
+#include "TokenRing.h"
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define TOKENIZER_X86_SIMD 1
+#endif
+
+// Character classes. Identifiers start with a letter and continue with letters, digits or '_'.
+// Whitespace matches isspace() in the "C" locale, independent of whatever locale is active.
+enum : uint8_t {
+    CC_ALPHA = 1 << 0,
+    CC_DIGIT = 1 << 1,
+    CC_IDENT = 1 << 2,
+    CC_SPACE = 1 << 3,
+};
+
+static constexpr std::array<uint8_t, 256> build_char_classes() {
+    std::array<uint8_t, 256> t{};
+    for (int c = 'a'; c <= 'z'; c++) t[c] = CC_ALPHA | CC_IDENT;
+    for (int c = 'A'; c <= 'Z'; c++) t[c] = CC_ALPHA | CC_IDENT;
+    for (int c = '0'; c <= '9'; c++) t[c] = CC_DIGIT | CC_IDENT;
+    t['_'] = CC_IDENT;
+    for (int c : {' ', '\t', '\n', '\v', '\f', '\r'}) t[c] = CC_SPACE;
+    return t;
+}
+
+static constexpr std::array<uint8_t, 256> kCharClass = build_char_classes();
+
+// Keywords are looked up through a perfect hash on (first char, last char, length). The table
+// is built at compile time and the static_assert rejects any keyword set that collides.
+struct Keyword {
+    std::string_view text;
+    TokenType type;
+};
+
+static constexpr Keyword kKeywords[] = {
+    {"auto", TokenType::auto_},     {"extern", TokenType::extern_}, {"return", TokenType::_return},
+    {"if", TokenType::if_},         {"else", TokenType::else_},     {"while", TokenType::while_},
+    {"switch", TokenType::switch_}, {"case", TokenType::case_},     {"goto", TokenType::goto_},
+    {"break", TokenType::break_},   {"default", TokenType::default_},
+};
+
+static constexpr size_t KEYWORD_SLOTS = 32;
+
+static constexpr size_t keyword_hash(std::string_view s) {
+    return (static_cast<unsigned char>(s.front()) * 2 + static_cast<unsigned char>(s.back()) * 5 +
+            s.size()) &
+           (KEYWORD_SLOTS - 1);
+}
+
+struct KeywordTable {
+    Keyword slots[KEYWORD_SLOTS]{};
+    bool perfect = true;
+};
+
+static constexpr KeywordTable build_keyword_table() {
+    KeywordTable t{};
+    for (const Keyword& kw : kKeywords) {
+        Keyword& slot = t.slots[keyword_hash(kw.text)];
+        if (!slot.text.empty()) {
+            t.perfect = false;
+        }
+        slot = kw;
+    }
+    return t;
+}
+
+static constexpr KeywordTable kKeywordTable = build_keyword_table();
+static_assert(kKeywordTable.perfect, "keyword hash collides, adjust keyword_hash()");
+
+static TokenType classify_word(std::string_view word) {
+    if (word.size() >= 2 && word.size() <= 7) {
+        const Keyword& slot = kKeywordTable.slots[keyword_hash(word)];
+        if (slot.text == word) {
+            return slot.type;
+        }
+    }
+    return TokenType::ident;
+}
+
+// Scanners return the index of the first byte at or after i that is not in the class.
+static size_t scan_ident_scalar(const char* s, size_t i, size_t n) {
+    while (i < n && (kCharClass[static_cast<unsigned char>(s[i])] & CC_IDENT)) i++;
+    return i;
+}
+
+static size_t scan_space_scalar(const char* s, size_t i, size_t n) {
+    while (i < n && (kCharClass[static_cast<unsigned char>(s[i])] & CC_SPACE)) i++;
+    return i;
+}
+
+static size_t scan_digits(const char* s, size_t i, size_t n) {
+    while (i < n && (kCharClass[static_cast<unsigned char>(s[i])] & CC_DIGIT)) i++;
+    return i;
+}
+
+#ifdef TOKENIZER_X86_SIMD
+// Bytes >= 0x80 compare as negative with the signed byte compares, so they never land in an
+// ASCII range and stop the scan just like the scalar table does.
+__attribute__((target("sse2"))) static inline __m128i in_range_sse2(__m128i v, char lo, char hi) {
+    return _mm_and_si128(_mm_cmpgt_epi8(v, _mm_set1_epi8(lo - 1)),
+                         _mm_cmplt_epi8(v, _mm_set1_epi8(hi + 1)));
+}
+
+__attribute__((target("sse2"))) static size_t scan_ident_sse2(const char* s, size_t i, size_t n) {
+    while (i + 16 <= n) {
+        __m128i v = _mm_loadu_si128(reinterpret_cast<const __m128i*>(s + i));
+        __m128i letters = _mm_or_si128(in_range_sse2(v, 'a', 'z'), in_range_sse2(v, 'A', 'Z'));
+        __m128i digits = in_range_sse2(v, '0', '9');
+        __m128i ok = _mm_or_si128(_mm_or_si128(letters, digits),
+                                  _mm_cmpeq_epi8(v, _mm_set1_epi8('_')));
+        unsigned stop = ~static_cast<unsigned>(_mm_movemask_epi8(ok)) & 0xFFFFu;
+        if (stop) return i + __builtin_ctz(stop);
+        i += 16;
+    }
+    return scan_ident_scalar(s, i, n);
+}
+
+__attribute__((target("sse2"))) static size_t scan_space_sse2(const char* s, size_t i, size_t n) {
+    while (i + 16 <= n) {
+        __m128i v = _mm_loadu_si128(reinterpret_cast<const __m128i*>(s + i));
+        __m128i ok =
+            _mm_or_si128(_mm_cmpeq_epi8(v, _mm_set1_epi8(' ')), in_range_sse2(v, '\t', '\r'));
+        unsigned stop = ~static_cast<unsigned>(_mm_movemask_epi8(ok)) & 0xFFFFu;
+        if (stop) return i + __builtin_ctz(stop);
+        i += 16;
+    }
+    return scan_space_scalar(s, i, n);
+}
+
+__attribute__((target("avx2"))) static inline __m256i in_range_avx2(__m256i v, char lo, char hi) {
+    return _mm256_and_si256(_mm256_cmpgt_epi8(v, _mm256_set1_epi8(lo - 1)),
+                            _mm256_cmpgt_epi8(_mm256_set1_epi8(hi + 1), v));
+}
+
+__attribute__((target("avx2"))) static size_t scan_ident_avx2(const char* s, size_t i, size_t n) {
+    while (i + 32 <= n) {
+        __m256i v = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(s + i));
+        __m256i letters = _mm256_or_si256(in_range_avx2(v, 'a', 'z'), in_range_avx2(v, 'A', 'Z'));
+        __m256i digits = in_range_avx2(v, '0', '9');
+        __m256i ok = _mm256_or_si256(_mm256_or_si256(letters, digits),
+                                     _mm256_cmpeq_epi8(v, _mm256_set1_epi8('_')));
+        uint32_t stop = ~static_cast<uint32_t>(_mm256_movemask_epi8(ok));
+        if (stop) return i + __builtin_ctz(stop);
+        i += 32;
+    }
+    return scan_ident_sse2(s, i, n);
+}
+
+__attribute__((target("avx2"))) static size_t scan_space_avx2(const char* s, size_t i, size_t n) {
+    while (i + 32 <= n) {
+        __m256i v = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(s + i));
+        __m256i ok = _mm256_or_si256(_mm256_cmpeq_epi8(v, _mm256_set1_epi8(' ')),
+                                     in_range_avx2(v, '\t', '\r'));
+        uint32_t stop = ~static_cast<uint32_t>(_mm256_movemask_epi8(ok));
+        if (stop) return i + __builtin_ctz(stop);
+        i += 32;
+    }
+    return scan_space_sse2(s, i, n);
+}
+#endif
+
+LexEngine Tokenizer::best_engine() {
+#ifdef TOKENIZER_X86_SIMD
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("avx2")) return LexEngine::AVX2;
+    if (__builtin_cpu_supports("sse2")) return LexEngine::SSE2;
+#endif
+    return LexEngine::Scalar;
+}
+
+const char* lex_engine_name(LexEngine engine) {
+    switch (engine) {
+        case LexEngine::Auto:
+            return "auto";
+        case LexEngine::Scalar:
+            return "scalar";
+        case LexEngine::SSE2:
+            return "sse2";
+        case LexEngine::AVX2:
+            return "avx2";
+    }
+    return "unknown";
+}
+
+Tokenizer::Tokenizer(std::string_view src, LexEngine engine)
+    : Tokenizer(src, engine, SymbolTable::instance()) {
 }
 
+Tokenizer::Tokenizer(std::string_view src, LexEngine engine, SymbolTable& symbols)
+    : m_src(src), m_symbols(symbols) {
+    // Never hand out an engine the CPU can't run; asking for too much degrades to the best one
+    const LexEngine best = best_engine();
+    if (engine == LexEngine::Auto || static_cast<int>(engine) > static_cast<int>(best)) {
+        engine = best;
+    }
+    m_engine = engine;
+    m_scan_ident = scan_ident_scalar;
+    m_scan_space = scan_space_scalar;
+#ifdef TOKENIZER_X86_SIMD
+    if (engine == LexEngine::SSE2) {
+        m_scan_ident = scan_ident_sse2;
+        m_scan_space = scan_space_sse2;
+    } else if (engine == LexEngine::AVX2) {
+        m_scan_ident = scan_ident_avx2;
+        m_scan_space = scan_space_avx2;
+    }
+#endif
+}
+
+// Token sinks for lex(): the whole program in a vector, or fixed-size batches into a TokenRing.
+struct VectorSink {
+    std::vector<Token>& tokens;
+
+    void push_back(const Token& tok) { tokens.push_back(tok); }
+    bool ok() const { return true; }
+};
+
+struct RingSink {
+    static constexpr size_t BATCH = 512;
+
+    TokenRing& ring;
+    Token batch[BATCH]{};
+    size_t count = 0;
+    bool open = true;
+
+    void push_back(const Token& tok) {
+        batch[count++] = tok;
+        if (count == BATCH) flush();
+    }
+    void flush() {
+        if (open && count > 0) open = ring.push(batch, count);
+        count = 0;
+    }
+    bool ok() const { return open; }
+};
+
 std::vector<Token> Tokenizer::tokenize() {
     std::vector<Token> tokens;
-    std::string buf;
-    while (peek().has_value()) {
-        char current = peek().value();
-        if (std::isalpha(current)) {
-            buf.push_back(consume());
-            while (peek().has_value() && (std::isalnum(peek().value()) || peek().value() == '_')) {
-                buf.push_back(consume());
-            }
+    // Rough guess of one token per four source bytes, avoids most regrowth on big inputs
+    tokens.reserve(m_src.size() / 4 + 16);
+    VectorSink sink{tokens};
+    lex(sink);
+    return tokens;
+}
 
-            if (buf == "auto") {
-                tokens.push_back({.type = TokenType::auto_});
-            } else if (buf == "extern") {
-                tokens.push_back({.type = TokenType::extern_});
-            } else if (buf == "return") {
-                tokens.push_back({.type = TokenType::_return});
-            } else if (buf == "if") {
-                tokens.push_back({.type = TokenType::if_});
-            } else if (buf == "else") {
-                tokens.push_back({.type = TokenType::else_});
-            } else if (buf == "while") {
-                tokens.push_back({.type = TokenType::while_});
-            } else if (buf == "switch") {
-                tokens.push_back({.type = TokenType::switch_});
-            } else if (buf == "case") {
-                tokens.push_back({.type = TokenType::case_});
-            } else if (buf == "goto") {
-                tokens.push_back({.type = TokenType::goto_});
-            } else {
-                tokens.push_back({.type = TokenType::ident, .value = buf});
-            }
-            buf.clear();
-        } else if (std::isdigit(current)) {
-            buf.push_back(consume());
-            while (peek().has_value() && std::isdigit(peek().value())) {
-                buf.push_back(consume());
+void Tokenizer::tokenize_into(TokenRing& ring) {
+    RingSink sink{ring};
+    lex(sink);
+    sink.flush();
+    ring.close();
+}
+
+template <typename Sink>
+void Tokenizer::lex(Sink& tokens) {
+    const char* data = m_src.data();
+    const size_t size = m_src.size();
+    while (m_index < size && tokens.ok()) {
+        const char current = data[m_index];
+        const uint8_t cls = kCharClass[static_cast<unsigned char>(current)];
+        const size_t start = m_index;
+        if (cls & CC_ALPHA) {
+            m_index = m_scan_ident(data, m_index + 1, size);
+            const std::string_view word = m_src.substr(start, m_index - start);
+            Token tok = make_token(classify_word(word), start);
+            if (tok.type == TokenType::ident) {
+                tok.sym = m_symbols.intern(word);
             }
-            tokens.push_back({.type = TokenType::int_literal, .value = buf});
-            buf.clear();
-        } else if (std::isspace(current)) {
-            consume();
+            tokens.push_back(tok);
+        } else if (cls & CC_DIGIT) {
+            m_index = scan_digits(data, m_index + 1, size);
+            tokens.push_back(make_token(TokenType::int_literal, start));
+        } else if (cls & CC_SPACE) {
+            m_index = m_scan_space(data, m_index + 1, size);
         } else {
             switch (current) {
                 case '(':
                     consume();
-                    tokens.push_back({.type = TokenType::open_paren});
+                    tokens.push_back(make_token(TokenType::open_paren, start));
                     break;
                 case ')':
                     consume();
-                    tokens.push_back({.type = TokenType::close_paren});
+                    tokens.push_back(make_token(TokenType::close_paren, start));
                     break;
                 case '{':
                     consume();
-                    tokens.push_back({.type = TokenType::open_curly});
+                    tokens.push_back(make_token(TokenType::open_curly, start));
                     break;
                 case '}':
                     consume();
-                    tokens.push_back({.type = TokenType::close_curly});
+                    tokens.push_back(make_token(TokenType::close_curly, start));
                     break;
                 case '[':
                     consume();
-                    tokens.push_back({.type = TokenType::open_bracket});
+                    tokens.push_back(make_token(TokenType::open_bracket, start));
                     break;
                 case ']':
                     consume();
-                    tokens.push_back({.type = TokenType::close_bracket});
+                    tokens.push_back(make_token(TokenType::close_bracket, start));
                     break;
                 case ';':
                     consume();
-                    tokens.push_back({.type = TokenType::semi});
+                    tokens.push_back(make_token(TokenType::semi, start));
                     break;
                 case '?':
                     consume();
-                    tokens.push_back({.type = TokenType::question});
+                    tokens.push_back(make_token(TokenType::question, start));
                     break;
                 case ':':
                     consume();
-                    tokens.push_back({.type = TokenType::colon});
+                    tokens.push_back(make_token(TokenType::colon, start));
                     break;
                 case ',':
                     consume();
-                    tokens.push_back({.type = TokenType::comma});
+                    tokens.push_back(make_token(TokenType::comma, start));
                     break;
                 case '=':
                     if (peek(1).has_value() && peek(1).value() == '=') {
                         consume();
                         consume();
-                        tokens.push_back({.type = TokenType::equal_equal});
+                        tokens.push_back(make_token(TokenType::equal_equal, start));
                     } else {
                         consume();
-                        tokens.push_back({.type = TokenType::equal});
+                        tokens.push_back(make_token(TokenType::equal, start));
                     }
                     break;
                 case '!':
                     if (peek(1).has_value() && peek(1).value() == '=') {
                         consume();
                         consume();
-                        tokens.push_back({.type = TokenType::not_equal});
+                        tokens.push_back(make_token(TokenType::not_equal, start));
                     } else {
                         consume();
-                        tokens.push_back({.type = TokenType::not_});
+                        tokens.push_back(make_token(TokenType::not_, start));
                     }
                     break;
                 case '<':
                     if (peek(1).has_value() && peek(1).value() == '=') {
                         consume();
                         consume();
-                        tokens.push_back({.type = TokenType::less_equal});
+                        tokens.push_back(make_token(TokenType::less_equal, start));
                     } else if (peek(1).has_value() && peek(1).value() == '<') {
                         consume();
                         consume();
                         if (peek().has_value() && peek().value() == '=') {
                             consume();
-                            tokens.push_back({.type = TokenType::shl_equal});
+                            tokens.push_back(make_token(TokenType::shl_equal, start));
                         } else {
-                            tokens.push_back({.type = TokenType::shl});
+                            tokens.push_back(make_token(TokenType::shl, start));
                         }
                     } else {
                         consume();
-                        tokens.push_back({.type = TokenType::less});
+                        tokens.push_back(make_token(TokenType::less, start));
                     }
                     break;
                 case '>':
                     if (peek(1).has_value() && peek(1).value() == '=') {
                         consume();
                         consume();
-                        tokens.push_back({.type = TokenType::greater_equal});
+                        tokens.push_back(make_token(TokenType::greater_equal, start));
                     } else if (peek(1).has_value() && peek(1).value() == '>') {
                         consume();
                         consume();
                         if (peek().has_value() && peek().value() == '=') {
                             consume();
-                            tokens.push_back({.type = TokenType::shr_equal});
+                            tokens.push_back(make_token(TokenType::shr_equal, start));
                         } else {
-                            tokens.push_back({.type = TokenType::shr});
+                            tokens.push_back(make_token(TokenType::shr, start));
                         }
                     } else {
                         consume();
-                        tokens.push_back({.type = TokenType::greater});
+                        tokens.push_back(make_token(TokenType::greater, start));
                     }
                     break;
                 case '+':
                     if (peek(1).has_value() && peek(1).value() == '+') {
                         consume();
                         consume();
-                        tokens.push_back({.type = TokenType::plus_plus});
+                        tokens.push_back(make_token(TokenType::plus_plus, start));
                     } else if (peek(1).has_value() && peek(1).value() == '=') {
                         consume();
                         consume();
-                        tokens.push_back({.type = TokenType::plus_equal});
+                        tokens.push_back(make_token(TokenType::plus_equal, start));
                     } else {
                         consume();
-                        tokens.push_back({.type = TokenType::plus});
+                        tokens.push_back(make_token(TokenType::plus, start));
                     }
                     break;
                 case '-':
                     if (peek(1).has_value() && peek(1).value() == '-') {
                         consume();
                         consume();
-                        tokens.push_back({.type = TokenType::minus_minus});
+                        tokens.push_back(make_token(TokenType::minus_minus, start));
                     } else if (peek(1).has_value() && peek(1).value() == '=') {
                         consume();
                         consume();
-                        tokens.push_back({.type = TokenType::minus_equal});
+                        tokens.push_back(make_token(TokenType::minus_equal, start));
                     } else {
                         consume();
-                        tokens.push_back({.type = TokenType::minus});
+                        tokens.push_back(make_token(TokenType::minus, start));
                     }
                     break;
                 case '*':
                     if (peek(1).has_value() && peek(1).value() == '=') {
                         consume();
                         consume();
-                        tokens.push_back({.type = TokenType::mul_equal});
+                        tokens.push_back(make_token(TokenType::mul_equal, start));
                     } else {
                         consume();
-                        tokens.push_back({.type = TokenType::multi});
+                        tokens.push_back(make_token(TokenType::multi, start));
                     }
                     break;
                 case '/':
                     if (peek(1).has_value() && peek(1).value() == '*') {
-                        consume();
-                        consume();
-                        while (peek().has_value()) {
-                            if (peek().value() == '*' && peek(1).has_value() &&
-                                peek(1).value() == '/') {
-                                consume();
-                                consume();
-                                break;
-                            }
-                            consume();
+                        // An unterminated comment runs to the end of the input
+                        size_t close = m_src.find("*/", m_index + 2);
+                        if (close == std::string_view::npos) {
+                            m_open_comment = start;
+                            m_index = size;
+                        } else {
+                            m_index = close + 2;
                         }
                     } else if (peek(1).has_value() && peek(1).value() == '=') {
                         consume();
                         consume();
-                        tokens.push_back({.type = TokenType::div_equal});
+                        tokens.push_back(make_token(TokenType::div_equal, start));
                     } else {
                         consume();
-                        tokens.push_back({.type = TokenType::div});
+                        tokens.push_back(make_token(TokenType::div, start));
                     }
                     break;
                 case '%':
                     if (peek(1).has_value() && peek(1).value() == '=') {
                         consume();
                         consume();
-                        tokens.push_back({.type = TokenType::mod_equal});
+                        tokens.push_back(make_token(TokenType::mod_equal, start));
                     } else {
                         consume();
-                        tokens.push_back({.type = TokenType::mod});
+                        tokens.push_back(make_token(TokenType::mod, start));
                     }
                     break;
                 case '&':
                     if (peek(1).has_value() && peek(1).value() == '&') {
                         consume();
                         consume();
-                        tokens.push_back({.type = TokenType::and_});
+                        tokens.push_back(make_token(TokenType::and_, start));
                     } else if (peek(1).has_value() && peek(1).value() == '=') {
                         consume();
                         consume();
-                        tokens.push_back({.type = TokenType::and_equal});
+                        tokens.push_back(make_token(TokenType::and_equal, start));
                     } else {
                         consume();
-                        tokens.push_back({.type = TokenType::and_});
+                        tokens.push_back(make_token(TokenType::and_, start));
                     }
                     break;
                 case '|':
                     if (peek(1).has_value() && peek(1).value() == '|') {
                         consume();
                         consume();
-                        tokens.push_back({.type = TokenType::or_});
+                        tokens.push_back(make_token(TokenType::or_, start));
                     } else if (peek(1).has_value() && peek(1).value() == '=') {
                         consume();
                         consume();
-                        tokens.push_back({.type = TokenType::or_equal});
+                        tokens.push_back(make_token(TokenType::or_equal, start));
                     } else {
                         consume();
-                        tokens.push_back({.type = TokenType::or_});
+                        tokens.push_back(make_token(TokenType::or_, start));
                     }
                     break;
                 default:
+                    if (m_defer_errors) {
+                        m_error_at = start;
+                        return;
+                    }
                     std::cerr << "Invalid character encountered: " << current << std::endl;
                     exit(1);
             }
         }
     }
     m_index = 0;
+}
+
+// Parallel mode. The source is cut into one chunk per worker at whitespace bytes, and every
+// chunk is lexed on its own thread into a private SymbolTable, stopping at its cut. A cut is
+// only a real token boundary if the chunk before it did not end inside a block comment; the
+// first chunk that breaks that rule, and everything after it, is re-lexed serially. Local
+// symbol ids are then remapped onto the global table and the chunks are copied into place,
+// so the result is exactly what tokenize() produces.
+std::vector<Token> Tokenizer::tokenize_parallel(unsigned workers) {
+    static constexpr size_t MIN_CHUNK = 256 * 1024;
+
+    const size_t size = m_src.size();
+    if (workers == 0) {
+        workers = std::max(1u, std::thread::hardware_concurrency());
+    }
+    workers = static_cast<unsigned>(std::min<size_t>(workers, size / MIN_CHUNK));
+    if (workers <= 1) {
+        return tokenize();
+    }
+
+    std::vector<size_t> cuts{0};
+    for (unsigned i = 1; i < workers; i++) {
+        size_t cut = std::max(cuts.back(), size * i / workers);
+        while (cut < size && !(kCharClass[static_cast<unsigned char>(m_src[cut])] & CC_SPACE)) {
+            cut++;
+        }
+        if (cut > cuts.back() && cut < size) {
+            cuts.push_back(cut);
+        }
+    }
+    cuts.push_back(size);
+    const size_t chunk_count = cuts.size() - 1;
+
+    struct Chunk {
+        SymbolTable symbols;
+        std::vector<Token> tokens;
+        size_t open_comment = NO_POS;
+        size_t error_at = NO_POS;
+        size_t out_offset = 0;
+        std::vector<SymbolId> remap;
+    };
+    std::vector<Chunk> chunks(chunk_count);
+
+    std::vector<std::thread> threads;
+    for (size_t i = 0; i < chunk_count; i++) {
+        threads.emplace_back([this, &chunks, &cuts, i] {
+            Chunk& chunk = chunks[i];
+            // The view ends at the cut so no scan can run past it
+            Tokenizer lexer(m_src.substr(0, cuts[i + 1]), m_engine, chunk.symbols);
+            lexer.m_index = cuts[i];
+            lexer.m_defer_errors = true;
+            chunk.tokens.reserve((cuts[i + 1] - cuts[i]) / 4 + 16);
+            VectorSink sink{chunk.tokens};
+            lexer.lex(sink);
+            chunk.open_comment = lexer.m_open_comment;
+            chunk.error_at = lexer.m_error_at;
+        });
+    }
+    for (std::thread& t : threads) {
+        t.join();
+    }
+
+    // Stitch in order: fail on the first error, and stop at the first chunk whose successor
+    // started inside a comment, handing the rest of the source to the serial lexer.
+    size_t valid = 0;
+    size_t total = 0;
+    size_t resume = NO_POS;
+    for (; valid < chunk_count; valid++) {
+        Chunk& chunk = chunks[valid];
+        if (chunk.error_at != NO_POS) {
+            std::cerr << "Invalid character encountered: " << m_src[chunk.error_at] << std::endl;
+            exit(1);
+        }
+        chunk.out_offset = total;
+        total += chunk.tokens.size();
+        chunk.remap.resize(chunk.symbols.size());
+        for (SymbolId id = 0; id < chunk.symbols.size(); id++) {
+            chunk.remap[id] = m_symbols.intern(chunk.symbols.name(id));
+        }
+        if (chunk.open_comment != NO_POS && valid + 1 < chunk_count) {
+            // this chunk's tokens all precede the comment; lex on serially from its start
+            resume = chunk.open_comment;
+            valid++;
+            break;
+        }
+    }
+
+    std::vector<Token> tail;
+    if (resume != NO_POS) {
+        m_index = resume;
+        VectorSink sink{tail};
+        lex(sink);
+    }
+
+    std::vector<Token> tokens(total + tail.size());
+    threads.clear();
+    for (size_t i = 0; i < valid; i++) {
+        threads.emplace_back([&chunks, &tokens, i] {
+            const Chunk& chunk = chunks[i];
+            Token* out = tokens.data() + chunk.out_offset;
+            for (const Token& tok : chunk.tokens) {
+                *out = tok;
+                if (tok.type == TokenType::ident) {
+                    out->sym = chunk.remap[tok.sym];
+                }
+                ++out;
+            }
+        });
+    }
+    for (std::thread& t : threads) {
+        t.join();
+    }
+    std::copy(tail.begin(), tail.end(), tokens.begin() + total);
     return tokens;
 }
 
+Token Tokenizer::make_token(TokenType type, size_t start) const {
+    Token tok;
+    tok.type = type;
+    tok.offset = static_cast<uint32_t>(start);
+    tok.length = static_cast<uint32_t>(m_index - start);
+    return tok;
+}
+
 std::optional<char> Tokenizer::peek(int ahead) const {
     if (m_index + ahead >= m_src.length()) {
         return std::nullopt;
     } else {
-        return m_src.at(m_index + ahead);
+        return m_src[m_index + ahead];
     }
 }
 
 char Tokenizer::consume() {
-    return m_src.at(m_index++);
+    return m_src[m_index++];
 }
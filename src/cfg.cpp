@@ -0,0 +1,325 @@
+#include "cfg.h"
+
+#include <algorithm>
+#include <utility>
+
+using namespace std;
+
+vector<size_t> function_starts(const IrProgram& prog) {
+    vector<size_t> starts;
+    for (size_t i = 0; i < prog.code.size(); i++) {
+        if (prog.code[i].kind == Opkind::function) {
+            starts.push_back(i);
+        }
+    }
+    return starts;
+}
+
+void Cfg::build(const IrProgram& prog, size_t start) {
+    m_start = start;
+    m_end = start + 1;
+    while (m_end < prog.code.size() && prog.code[m_end].kind != Opkind::function) {
+        m_end++;
+    }
+
+    partition(prog);
+    connect(prog);
+    order();
+    dominators();
+    find_loops();
+    m_valid = true;
+}
+
+static bool ends_block(Opkind kind) {
+    return kind == Opkind::jump || kind == Opkind::jumpiffalse || kind == Opkind::jumptable ||
+           kind == Opkind::ret;
+}
+
+// A block starts at every label and after every branch or return. The entry block must not
+// be a jump target, so a body that opens with a label (a loop, say) gets an empty one in front.
+void Cfg::partition(const IrProgram& prog) {
+    const vector<inst>& code = prog.code;
+    if (m_label_block.size() < prog.labels.size()) {
+        m_label_block.resize(prog.labels.size(), -1);
+    }
+
+    m_blocks.clear();
+    if (m_start + 1 < m_end && code[m_start + 1].kind == Opkind::label) {
+        m_blocks.emplace_back();
+        m_blocks.back().first = m_start + 1;
+    }
+    bool leader = true;
+    for (size_t i = m_start + 1; i < m_end; i++) {
+        if (leader || code[i].kind == Opkind::label) {
+            if (!m_blocks.empty()) {
+                m_blocks.back().end = i;
+            }
+            m_blocks.emplace_back();
+            m_blocks.back().first = i;
+        }
+        if (code[i].kind == Opkind::label) {
+            m_label_block[code[i].label.label] = (int)m_blocks.size() - 1;
+        }
+        leader = ends_block(code[i].kind);
+    }
+    if (!m_blocks.empty()) {
+        m_blocks.back().end = m_end;
+    }
+}
+
+void Cfg::connect(const IrProgram& prog) {
+    const int count = (int)m_blocks.size();
+    for (int b = 0; b < count; b++) {
+        vector<int>& succs = m_blocks[b].succs;
+        auto edge = [&](int to) {
+            if (find(succs.begin(), succs.end(), to) == succs.end()) {
+                succs.push_back(to);
+            }
+        };
+
+        // an empty entry block sees the funcOp here and falls through
+        const inst& last = prog.code[m_blocks[b].end - 1];
+        switch (last.kind) {
+            case Opkind::jump:
+                edge(m_label_block[last.jump.label]);
+                break;
+            case Opkind::jumpiffalse:
+                if (b + 1 < count) {
+                    edge(b + 1);
+                }
+                edge(m_label_block[last.jumpiffalse.label]);
+                break;
+            case Opkind::jumptable: {
+                const JumpTable& table = prog.jump_tables[last.jumptable.table];
+                for (LabelId target : table.targets) {
+                    edge(m_label_block[target]);
+                }
+                edge(m_label_block[table.default_label]);
+                break;
+            }
+            case Opkind::ret:
+                break;
+            default:
+                if (b + 1 < count) {
+                    edge(b + 1);
+                }
+                break;
+        }
+    }
+
+    for (int b = 0; b < count; b++) {
+        for (int s : m_blocks[b].succs) {
+            m_blocks[s].preds.push_back(b);
+        }
+    }
+}
+
+// Reverse postorder of the blocks reachable from the entry.
+void Cfg::order() {
+    const int count = (int)m_blocks.size();
+    m_rpo.clear();
+    m_rpo_index.assign(count, -1);
+    if (count == 0) {
+        return;
+    }
+
+    vector<bool> seen(count, false);
+    vector<pair<int, size_t>> stack;  // block, next successor to visit
+    stack.push_back({0, 0});
+    seen[0] = true;
+    while (!stack.empty()) {
+        const int b = stack.back().first;
+        const size_t next = stack.back().second;
+        if (next < m_blocks[b].succs.size()) {
+            stack.back().second++;
+            const int s = m_blocks[b].succs[next];
+            if (!seen[s]) {
+                seen[s] = true;
+                stack.push_back({s, 0});
+            }
+        } else {
+            m_rpo.push_back(b);
+            stack.pop_back();
+        }
+    }
+    reverse(m_rpo.begin(), m_rpo.end());
+    for (size_t k = 0; k < m_rpo.size(); k++) {
+        m_rpo_index[m_rpo[k]] = (int)k;
+    }
+}
+
+// Cooper, Harvey and Kennedy, "A Simple, Fast Dominance Algorithm": iterate idom over the
+// reverse postorder until nothing changes, meeting predecessors by walking up the tree.
+void Cfg::dominators() {
+    const int count = (int)m_blocks.size();
+    m_dom_children.assign(count, {});
+    m_frontier.assign(count, {});
+    m_dom_pre.assign(count, -1);
+    m_dom_post.assign(count, -1);
+    if (count == 0) {
+        return;
+    }
+
+    vector<int> idom(count, -1);
+    idom[0] = 0;
+    auto intersect = [&](int a, int b) {
+        while (a != b) {
+            while (m_rpo_index[a] > m_rpo_index[b]) {
+                a = idom[a];
+            }
+            while (m_rpo_index[b] > m_rpo_index[a]) {
+                b = idom[b];
+            }
+        }
+        return a;
+    };
+
+    bool changed = true;
+    while (changed) {
+        changed = false;
+        for (size_t k = 1; k < m_rpo.size(); k++) {
+            const int b = m_rpo[k];
+            int new_idom = -1;
+            for (int p : m_blocks[b].preds) {
+                if (idom[p] != -1) {
+                    new_idom = new_idom == -1 ? p : intersect(p, new_idom);
+                }
+            }
+            if (idom[b] != new_idom) {
+                idom[b] = new_idom;
+                changed = true;
+            }
+        }
+    }
+
+    for (int b = 1; b < count; b++) {
+        m_blocks[b].idom = idom[b];
+        if (idom[b] != -1) {
+            m_dom_children[idom[b]].push_back(b);
+        }
+    }
+
+    // A join is in the frontier of every block on the way up from each predecessor to its
+    // immediate dominator (same paper, figure 5).
+    for (int b : m_rpo) {
+        if (m_blocks[b].preds.size() < 2) {
+            continue;
+        }
+        for (int p : m_blocks[b].preds) {
+            for (int runner = p; reachable(runner) && runner != idom[b]; runner = idom[runner]) {
+                vector<int>& frontier = m_frontier[runner];
+                if (frontier.empty() || frontier.back() != b) {
+                    frontier.push_back(b);
+                }
+            }
+        }
+    }
+
+    // number the tree so dominates() is two comparisons
+    int clock = 0;
+    vector<pair<int, size_t>> stack;
+    stack.push_back({0, 0});
+    m_dom_pre[0] = clock++;
+    while (!stack.empty()) {
+        const int b = stack.back().first;
+        const size_t next = stack.back().second;
+        if (next < m_dom_children[b].size()) {
+            stack.back().second++;
+            const int child = m_dom_children[b][next];
+            m_dom_pre[child] = clock++;
+            stack.push_back({child, 0});
+        } else {
+            m_dom_post[b] = clock++;
+            stack.pop_back();
+        }
+    }
+}
+
+// A back edge is one into a block that dominates its source; the loop is the header plus
+// everything that reaches a latch without passing through the header. Back edges sharing a
+// header make one loop.
+void Cfg::find_loops() {
+    const int count = (int)m_blocks.size();
+    m_loops.clear();
+
+    vector<int> header_loop(count, -1);
+    for (int b : m_rpo) {
+        for (int s : m_blocks[b].succs) {
+            if (dominates(s, b)) {
+                if (header_loop[s] == -1) {
+                    header_loop[s] = (int)m_loops.size();
+                    m_loops.emplace_back();
+                    m_loops.back().header = s;
+                }
+                m_loops[header_loop[s]].latches.push_back(b);
+            }
+        }
+    }
+
+    vector<int> mark(count, -1);
+    vector<int> work;
+    for (int l = 0; l < (int)m_loops.size(); l++) {
+        NaturalLoop& loop = m_loops[l];
+        loop.blocks.push_back(loop.header);
+        mark[loop.header] = l;
+        work = loop.latches;
+        while (!work.empty()) {
+            const int b = work.back();
+            work.pop_back();
+            if (mark[b] == l) {
+                continue;
+            }
+            mark[b] = l;
+            loop.blocks.push_back(b);
+            for (int p : m_blocks[b].preds) {
+                if (mark[p] != l && reachable(p)) {
+                    work.push_back(p);
+                }
+            }
+        }
+    }
+
+    // Outer loops first: an enclosing loop always has more blocks than the ones inside it, so
+    // by the time a loop is placed its header already carries the loop around it.
+    stable_sort(m_loops.begin(), m_loops.end(), [](const NaturalLoop& a, const NaturalLoop& b) {
+        return a.blocks.size() > b.blocks.size();
+    });
+    for (int l = 0; l < (int)m_loops.size(); l++) {
+        NaturalLoop& loop = m_loops[l];
+        loop.parent = m_blocks[loop.header].loop;
+        loop.depth = loop.parent == -1 ? 1 : m_loops[loop.parent].depth + 1;
+        for (int b : loop.blocks) {
+            m_blocks[b].loop = l;
+        }
+    }
+}
+
+int Cfg::block_of(size_t index) const {
+    auto it = upper_bound(m_blocks.begin(), m_blocks.end(), index,
+                          [](size_t i, const BasicBlock& block) { return i < block.first; });
+    if (it == m_blocks.begin() || index >= m_end) {
+        return -1;
+    }
+    return (int)(it - m_blocks.begin()) - 1;
+}
+
+bool Cfg::dominates(int a, int b) const {
+    if (!reachable(a) || !reachable(b)) {
+        return false;
+    }
+    return m_dom_pre[a] <= m_dom_pre[b] && m_dom_post[b] <= m_dom_post[a];
+}
+
+bool Cfg::in_loop(int block, int loop) const {
+    for (int l = m_blocks[block].loop; l != -1; l = m_loops[l].parent) {
+        if (l == loop) {
+            return true;
+        }
+    }
+    return false;
+}
+
+bool Cfg::fallthrough_only(int block) const {
+    const vector<int>& preds = m_blocks[block].preds;
+    return block > 0 && preds.size() == 1 && preds[0] == block - 1;
+}
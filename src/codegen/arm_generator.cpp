@@ -5,15 +5,14 @@
 
 using namespace std;
 
-string ArmGen::gcode(const vector<inst>& ir) {
+string ArmGen::gcode(const IrProgram& ir) {
     m_output.str("");
     m_output.clear();
+    m_ir = &ir;
 
-    metadata(ir);
+    metadata(ir.code);
     ghdr();
-    gprolog();
-    ginstrs(ir);
-    gepilog();
+    ginstrs(ir.code);
 
     return m_output.str();
 }
@@ -26,33 +25,58 @@ string ArmGen::ld_cmd(const string& obj_file, const string& exe_file) const {
     return "gcc " + obj_file + " -o " + exe_file;
 }
 
+// Program-wide facts: globals, externs and which names are functions of this program.
 void ArmGen::metadata(const vector<inst>& ir) {
-    m_var_offsets.clear();
     m_externs.clear();
-    m_stack_size = 0;
+    m_functions.clear();
     m_global_count = 0;
     m_label_count = 0;
+    m_in_function = false;
 
-    int var_count = 0;
     for (const auto& instr : ir) {
         if (instr.kind == Opkind::globalvar) {
             m_global_count = instr.globalvar.count;
         } else if (instr.kind == Opkind::externvar) {
             m_externs.insert(instr.externvar.name);
-        } else if (instr.kind == Opkind::autovar) {
-            const int current_var = var_count;
-            m_stack_size += 8 * instr.autovar.count;
-            for (int i = 0; i < instr.autovar.count; i++) {
-                m_var_offsets[current_var + i] = (current_var + i + 1) * 8;
+        } else if (instr.kind == Opkind::function) {
+            m_functions.insert(instr.func.name);
+        } else if (instr.kind == Opkind::ret) {
+            m_externs.insert(SymbolTable::instance().intern("exit"));
+        }
+    }
+}
+
+// Stack slots of the function starting at ir[start]: declared locals (parameters first) in
+// order, then every temporary on first write.
+void ArmGen::frame(const vector<inst>& ir, size_t start) {
+    m_var_offsets.clear();
+    m_stack_size = 0;
+
+    auto slot = [&](int index) {
+        if (m_var_offsets.find(index) == m_var_offsets.end()) {
+            m_stack_size += 8;
+            m_var_offsets[index] = m_stack_size;
+        }
+    };
+
+    int var_count = 0;
+    for (size_t i = start + 1; i < ir.size() && ir[i].kind != Opkind::function; i++) {
+        const inst& instr = ir[i];
+        if (instr.kind == Opkind::autovar) {
+            for (int k = 0; k < instr.autovar.count; k++) {
+                slot(var_count++);
             }
-            var_count += instr.autovar.count;
         } else if (instr.kind == Opkind::binop) {
-            if (m_var_offsets.find(instr.binop.dest) == m_var_offsets.end()) {
-                m_stack_size += 8;
-                m_var_offsets[instr.binop.dest] = m_stack_size;
-            }
-        } else if (instr.kind == Opkind::ret) {
-            m_externs.insert("exit");
+            slot(instr.binop.dest);
+        } else if (instr.kind == Opkind::unaryop) {
+            slot(instr.unary.dest);
+        } else if (instr.kind == Opkind::select) {
+            slot(instr.select.dest);
+        } else if (instr.kind == Opkind::autoassign) {
+            // temporaries assigned directly (folded expressions, branched ternaries)
+            slot(instr.autoassign.index);
+        } else if (instr.kind == Opkind::call && instr.call.dest >= 0) {
+            slot(instr.call.dest);
         }
     }
 
@@ -62,11 +86,22 @@ void ArmGen::metadata(const vector<inst>& ir) {
     }
 }
 
+// main stays the entry point; every other function gets a prefix so it can't clash with an
+// extern or a register name.
+string ArmGen::func_label(SymbolId name) const {
+    const string_view text = SymbolTable::instance().name(name);
+    if (text == "main") {
+        return "_start";
+    }
+    return "fn_" + string(text);
+}
+
 void ArmGen::ghdr() {
     m_output << ".section .text\n";
     m_output << ".global _start\n";
 
-    for (const string& external : m_externs) {
+    for (SymbolId external_sym : m_externs.items()) {
+        const string_view external = SymbolTable::instance().name(external_sym);
         if (external == "exit") {
             m_output << ".extern exit\n";
         } else {
@@ -76,30 +111,61 @@ void ArmGen::ghdr() {
     m_output << "\n";
 }
 
-void ArmGen::gprolog() {
-    m_output << "_start:\n";
+// AAPCS64: the first eight arguments arrive in x0-x7, the rest on the caller's stack right
+// above the saved frame record. All of them are spilled to their local slots.
+void ArmGen::gprolog(const funcOp& func) {
+    m_output << func_label(func.name) << ":\n";
     m_output << "    stp x29, x30, [sp, #-16]!\n";  // fp lp
     m_output << "    mov x29, sp\n";                // Set up frame pointer
 
     if (m_stack_size > 0) {
         m_output << "    sub sp, sp, #" << m_stack_size << "\n";
     }
+
+    for (int i = 0; i < func.params; i++) {
+        if (i < 8) {
+            m_output << "    str x" << i << ", [x29, #-" << m_var_offsets[i] << "]\n";
+        } else {
+            m_output << "    ldr x9, [x29, #" << 16 + 8 * (i - 8) << "]\n";
+            m_output << "    str x9, [x29, #-" << m_var_offsets[i] << "]\n";
+        }
+    }
 }
 
+// Falling off the end: main exits with status 0, other functions return 0.
 void ArmGen::gepilog() {
     m_output << "\n";
-    if (m_stack_size > 0) {
-        m_output << "    add sp, sp, #" << m_stack_size << "\n";
+    if (m_in_main) {
+        if (m_stack_size > 0) {
+            m_output << "    add sp, sp, #" << m_stack_size << "\n";
+        }
+        m_output << "    mov x0, #0\n";
+        m_output << "    bl exit\n";
+    } else {
+        m_output << "    mov x0, #0\n";
+        m_output << "    mov sp, x29\n";
     }
-    m_output << "    mov x0, #0\n";
-    m_output << "    bl exit\n";
     m_output << "    ldp x29, x30, [sp], #16\n";  // restore fp and lr
     m_output << "    ret\n";
+    m_output << "\n";
 }
 
 void ArmGen::ginstrs(const vector<inst>& ir) {
-    for (const auto& instr : ir) {
-        ginstr(instr);
+    for (size_t i = 0; i < ir.size(); i++) {
+        if (ir[i].kind == Opkind::function) {
+            if (m_in_function) {
+                gepilog();
+            }
+            frame(ir, i);
+            m_in_function = true;
+            m_in_main = SymbolTable::instance().name(ir[i].func.name) == "main";
+            gprolog(ir[i].func);
+            continue;
+        }
+        ginstr(ir[i]);
+    }
+    if (m_in_function) {
+        gepilog();
     }
 }
 
@@ -118,11 +184,8 @@ void ArmGen::ginstr(const inst& instr) {
             break;
         }
 
-        case Opkind::funcall: {
-            if (instr.funcall.arg.has_value()) {
-                larg(instr.funcall.arg.value(), "x0");  /// parameter1 in x0
-            }
-            m_output << "    bl " << instr.funcall.name << "\n";
+        case Opkind::call: {
+            gcall(instr);
             break;
         }
 
@@ -177,31 +240,49 @@ void ArmGen::ginstr(const inst& instr) {
             break;
         }
 
+        case Opkind::unaryop: {
+            if (instr.unary.op == UnaryOp::Not) {
+                gnot(instr);
+            } else if (instr.unary.op == UnaryOp::Negate) {
+                gneg(instr);
+            }
+            break;
+        }
+
+        case Opkind::update: {
+            gupdate(instr);
+            break;
+        }
+
+        case Opkind::select: {
+            gselect(instr);
+            break;
+        }
+
         case Opkind::label: {
-            m_output << instr.label.name << ":\n";
+            m_output << m_ir->label_name(instr.label.label) << ":\n";
             break;
         }
 
         case Opkind::jump: {
-            m_output << "    b " << instr.jump.label << "\n";
+            m_output << "    b " << m_ir->label_name(instr.jump.label) << "\n";
             break;
         }
 
         case Opkind::jumpiffalse: {
             larg(instr.jumpiffalse.condition, "x0");
             m_output << "    cmp x0, #0\n";
-            m_output << "    beq " << instr.jumpiffalse.label << "\n";
+            m_output << "    beq " << m_ir->label_name(instr.jumpiffalse.label) << "\n";
+            break;
+        }
+
+        case Opkind::jumptable: {
+            gjumptable(instr);
             break;
         }
 
         case Opkind::ret: {
-            if (instr.ret.value.has_value()) {
-                larg(instr.ret.value.value(), "x0");
-                m_output << "    bl exit\n";
-            } else {
-                m_output << "    mov x0, #0\n";
-                m_output << "    bl exit\n";
-            }
+            gret(instr);
             break;
         }
 
@@ -360,6 +441,151 @@ void ArmGen::gshr(const inst& instr) {
     m_output << "    str x0, [x29, #-" << m_var_offsets[instr.binop.dest] << "]\n";
 }
 
+void ArmGen::gnot(const inst& instr) {
+    larg(instr.unary.operand, "x0");
+    m_output << "    cmp x0, #0\n";
+    m_output << "    cset x0, eq\n";
+    m_output << "    str x0, [x29, #-" << m_var_offsets[instr.unary.dest] << "]\n";
+}
+
+void ArmGen::gneg(const inst& instr) {
+    larg(instr.unary.operand, "x0");
+    m_output << "    neg x0, x0\n";
+    m_output << "    str x0, [x29, #-" << m_var_offsets[instr.unary.dest] << "]\n";
+}
+
+// No memory-operand ALU ops on AArch64: load, apply (immediate form when it encodes), store.
+void ArmGen::gupdate(const inst& instr) {
+    const Arg& dest = instr.update.dest;
+    const Arg& value = instr.update.value;
+
+    string mem;
+    if (dest.type == ArgType::Global) {
+        m_output << "    adrp x2, global_" << dest.value << "\n";
+        m_output << "    add x2, x2, :lo12:global_" << dest.value << "\n";
+        mem = "[x2]";
+    } else {
+        mem = "[x29, #-" + to_string(m_var_offsets[dest.value]) + "]";
+    }
+
+    string mnemonic;
+    switch (instr.update.op) {
+        case BinOp::Add:
+            mnemonic = "add";
+            break;
+        case BinOp::Sub:
+            mnemonic = "sub";
+            break;
+        case BinOp::Shl:
+            mnemonic = "lsl";
+            break;
+        case BinOp::Shr:
+            mnemonic = "lsr";
+            break;
+        default:
+            return;
+    }
+
+    m_output << "    ldr x0, " << mem << "\n";
+    const bool is_shift = instr.update.op == BinOp::Shl || instr.update.op == BinOp::Shr;
+    if (value.type == ArgType::Literal && value.value >= 0 &&
+        value.value <= (is_shift ? 63 : 4095)) {
+        m_output << "    " << mnemonic << " x0, x0, #" << value.value << "\n";
+    } else {
+        larg(value, "x1");
+        m_output << "    " << mnemonic << " x0, x0, x1\n";
+    }
+    m_output << "    str x0, " << mem << "\n";
+}
+
+void ArmGen::gselect(const inst& instr) {
+    larg(instr.select.condition, "x0");
+    larg(instr.select.if_true, "x1");
+    larg(instr.select.if_false, "x2");
+    m_output << "    cmp x0, #0\n";
+    m_output << "    csel x0, x1, x2, ne\n";
+    m_output << "    str x0, [x29, #-" << m_var_offsets[instr.select.dest] << "]\n";
+}
+
+// Same shape as GCC's switch tables: a bounds check with one unsigned compare, then a table of
+// 32-bit offsets relative to the table itself, so the code stays position independent.
+void ArmGen::gjumptable(const inst& instr) {
+    const jumpTableOp& op = instr.jumptable;
+    const JumpTable& table = m_ir->jump_tables[op.table];
+    const int label = m_label_count++;
+
+    larg(op.value, "x0");
+    if (op.low > 0 && op.low <= 4095) {
+        m_output << "    sub x0, x0, #" << op.low << "\n";
+    } else if (op.low < 0 && op.low >= -4095) {
+        m_output << "    add x0, x0, #" << -op.low << "\n";
+    } else if (op.low != 0) {
+        m_output << "    mov x1, #" << op.low << "\n";
+        m_output << "    sub x0, x0, x1\n";
+    }
+    m_output << "    cmp x0, #" << table.targets.size() - 1 << "\n";
+    m_output << "    b.hi " << m_ir->label_name(table.default_label) << "\n";
+    m_output << "    adr x1, jump_table_" << label << "\n";
+    m_output << "    ldrsw x2, [x1, x0, lsl #2]\n";
+    m_output << "    add x1, x1, x2\n";
+    m_output << "    br x1\n";
+    m_output << "jump_table_" << label << ":\n";
+    for (LabelId target : table.targets) {
+        m_output << "    .word " << m_ir->label_name(target) << " - jump_table_" << label
+                 << "\n";
+    }
+}
+
+// Arguments past the eighth go to a 16-byte aligned outgoing area at sp, in order.
+void ArmGen::gcall(const inst& instr) {
+    const callOp& call = instr.call;
+    const Arg* args = m_ir->args(call);
+    const int count = call.arg_count;
+    const int stack_args = count > 8 ? count - 8 : 0;
+    const int stack_bytes = (8 * stack_args + 15) & ~15;
+
+    if (stack_bytes > 0) {
+        m_output << "    sub sp, sp, #" << stack_bytes << "\n";
+        for (int i = 8; i < count; i++) {
+            larg(args[i], "x9");
+            m_output << "    str x9, [sp, #" << 8 * (i - 8) << "]\n";
+        }
+    }
+    for (int i = 0; i < count && i < 8; i++) {
+        larg(args[i], "x" + to_string(i));
+    }
+
+    if (m_functions.contains(call.function)) {
+        m_output << "    bl " << func_label(call.function) << "\n";
+    } else {
+        m_output << "    bl " << SymbolTable::instance().name(call.function) << "\n";
+    }
+
+    if (stack_bytes > 0) {
+        m_output << "    add sp, sp, #" << stack_bytes << "\n";
+    }
+    if (call.dest >= 0) {
+        m_output << "    str x0, [x29, #-" << m_var_offsets[call.dest] << "]\n";
+    }
+}
+
+// return in main ends the program with the value as exit status
+void ArmGen::gret(const inst& instr) {
+    if (instr.ret.has_value) {
+        larg(instr.ret.value, "x0");
+    } else {
+        m_output << "    mov x0, #0\n";
+    }
+
+    if (m_in_main) {
+        m_output << "    bl exit\n";
+        return;
+    }
+    m_output << "    mov sp, x29\n";
+    m_output << "    ldp x29, x30, [sp], #16\n";
+    m_output << "    ret\n";
+}
+
 bool ArmGen::avail() const {
     return true;
 }
@@ -9,7 +9,7 @@
 
 class ArmGen : public TargetAPI {
    public:
-    string gcode(const vector<inst>& ir) override;
+    string gcode(const IrProgram& ir) override;
     string asm_ext() const override {
         return ".s";
     }
@@ -22,8 +22,10 @@ class ArmGen : public TargetAPI {
 
    private:
     void metadata(const vector<inst>& ir);
+    void frame(const vector<inst>& ir, size_t start);
+    string func_label(SymbolId name) const;
     void ghdr();
-    void gprolog();
+    void gprolog(const funcOp& func);
     void gepilog();
     void ginstrs(const vector<inst>& ir);
     void ginstr(const inst& instr);
@@ -45,10 +47,21 @@ class ArmGen : public TargetAPI {
     void gor(const inst& instr);
     void gshl(const inst& instr);
     void gshr(const inst& instr);
+    void gnot(const inst& instr);
+    void gneg(const inst& instr);
+    void gupdate(const inst& instr);
+    void gselect(const inst& instr);
+    void gjumptable(const inst& instr);
+    void gcall(const inst& instr);
+    void gret(const inst& instr);
 
+    const IrProgram* m_ir = nullptr;  // program being generated, for its side tables
     stringstream m_output;
     unordered_map<int, int> m_var_offsets;
-    unordered_set<string> m_externs;
+    SymbolSet m_externs;
+    SymbolSet m_functions;
+    bool m_in_function = false;
+    bool m_in_main = false;
     int m_stack_size = 0;
     int m_global_count = 0;
     int m_label_count = 0;
@@ -1,21 +1,24 @@
 #include "wasm_generator.h"
+#include <algorithm>
 #include <iostream>
 #include <fstream>
 
 using namespace std;
 
-string WasmGen::gcode(const vector<inst>& ir)
+string WasmGen::gcode(const IrProgram& ir)
 {
     m_output.str("");
     m_output.clear();
+    m_ir = &ir;
     m_loop_stack.clear();
-    m_loop_fin.clear();
+    m_label_pos.clear();
+    m_block_stack.clear();
+    m_block_opens.clear();
     
-    metadata(ir);
+    metadata(ir.code);
     ghdr();
-    gprolog();
-    ginstrs(ir);
-    gepilog();
+    ginstrs(ir.code);
+    m_output << ")\n";
     
     return m_output.str();
 }
@@ -32,17 +35,30 @@ string WasmGen::ld_cmd(const string& obj_file, const string& exe_file) const
     return "cp " + obj_file + " " + exe_file + ".wasm";
 }
 
+// Program-wide facts: globals, externs with the signature their calls need, and which names
+// are functions of this program.
 void WasmGen::metadata(const vector<inst>& ir)
 {
-    m_var_offsets.clear();
     m_externs.clear();
-    m_extern_arg.clear();
-    m_stack_size = 0;
+    m_functions.clear();
+    m_extern_params.clear();
+    m_extern_result.clear();
     m_global_count = 0;
     m_label_count = 0;
-    m_local_count = 0;
+    m_exit_sym = SymbolTable::instance().intern("exit");
+    m_exit_import = false;
+    m_in_function = false;
     
-    // Count variables and analyze IR
+    for (const auto& instr : ir)
+    {
+        if (instr.kind == Opkind::function)
+        {
+            m_functions.insert(instr.func.name);
+        }
+    }
+    
+    const SymbolId main_sym = SymbolTable::instance().intern("main");
+    SymbolId current = main_sym;
     for (const auto& instr : ir)
     {
         if (instr.kind == Opkind::globalvar)
@@ -52,65 +68,128 @@ void WasmGen::metadata(const vector<inst>& ir)
         else if (instr.kind == Opkind::externvar)
         {
             m_externs.insert(instr.externvar.name);
-            if (m_extern_arg.find(instr.externvar.name) == m_extern_arg.end()) {
-                m_extern_arg[instr.externvar.name] = false;
-            }
         }
-        else if (instr.kind == Opkind::autovar)
+        else if (instr.kind == Opkind::function)
         {
-            for (int i = 0; i < instr.autovar.count; i++)
+            current = instr.func.name;
+        }
+        else if (instr.kind == Opkind::call && !m_functions.contains(instr.call.function))
+        {
+            if (instr.call.function == m_exit_sym)
+            {
+                m_exit_import |= current != main_sym;
+                continue;
+            }
+            m_extern_params.emplace(instr.call.function, (int)instr.call.arg_count);
+            if (instr.call.dest >= 0)
             {
-                m_var_offsets[m_local_count + i] = m_local_count + i;
+                m_extern_result.insert(instr.call.function);
             }
-            m_local_count += instr.autovar.count;
         }
-        else if (instr.kind == Opkind::binop)
+    }
+}
+
+// Locals of the function starting at ir[start]: parameters and declared locals in order, then
+// every temporary on first write.
+void WasmGen::frame(const vector<inst>& ir, size_t start)
+{
+    m_var_offsets.clear();
+    m_local_count = 0;
+    m_switch_local = -1;
+    
+    auto slot = [&](int index)
+    {
+        if (m_var_offsets.find(index) == m_var_offsets.end())
         {
-            if (m_var_offsets.find(instr.binop.dest) == m_var_offsets.end())
+            m_var_offsets[index] = m_local_count++;
+        }
+    };
+    
+    int var_count = 0;
+    for (size_t i = start + 1; i < ir.size() && ir[i].kind != Opkind::function; i++)
+    {
+        const inst& instr = ir[i];
+        if (instr.kind == Opkind::autovar)
+        {
+            for (int k = 0; k < instr.autovar.count; k++)
             {
-                m_var_offsets[instr.binop.dest] = m_local_count++;
+                slot(var_count++);
             }
         }
-        else if (instr.kind == Opkind::ret)
+        else if (instr.kind == Opkind::binop)
+        {
+            slot(instr.binop.dest);
+        }
+        else if (instr.kind == Opkind::unaryop)
+        {
+            slot(instr.unary.dest);
+        }
+        else if (instr.kind == Opkind::select)
         {
-            // builtin ecit already presented by wasm, no need for extra implementaition.
+            slot(instr.select.dest);
         }
-        else if (instr.kind == Opkind::funcall)
+        else if (instr.kind == Opkind::autoassign)
         {
-            if (instr.funcall.arg.has_value()) {
-                m_extern_arg[instr.funcall.name] = true;
-            } else if (m_extern_arg.find(instr.funcall.name) == m_extern_arg.end()) {
-                m_extern_arg[instr.funcall.name] = false;
+            // temporaries assigned directly (folded expressions, branched ternaries)
+            slot(instr.autoassign.index);
+        }
+        else if (instr.kind == Opkind::call && instr.call.dest >= 0)
+        {
+            slot(instr.call.dest);
+        }
+        else if (instr.kind == Opkind::jumptable)
+        {
+            if (m_switch_local == -1)
+            {
+                m_switch_local = m_local_count++;
             }
         }
     }
 }
 
+// Prefixed so functions of the program can't clash with the imported externs.
+string WasmGen::func_label(SymbolId name) const
+{
+    const string_view text = SymbolTable::instance().name(name);
+    if (text == "main")
+    {
+        return "main";
+    }
+    return "fn_" + string(text);
+}
+
 void WasmGen::ghdr()
 {
     m_output << "(module\n";
     
-    // Import external functions if needed
-    for (const string& external : m_externs)
+    // Import external functions with the signature their calls use
+    for (SymbolId external_sym : m_externs.items())
     {
-        if (external == "exit")
+        const string_view external = SymbolTable::instance().name(external_sym);
+        auto params = m_extern_params.find(external_sym);
+        if (external_sym == m_exit_sym || params == m_extern_params.end())
         {
-            // Exit logic handled if needed
+            continue;
         }
-        else if (external == "printf")
+        m_output << "  (import \"env\" \"" << external << "\" (func $" << external;
+        if (params->second > 0)
         {
-            
-            m_output << "  (import \"env\" \"printf\" (func $printf (param i64)))\n";
+            m_output << " (param";
+            for (int i = 0; i < params->second; i++)
+            {
+                m_output << " i64";
+            }
+            m_output << ")";
         }
-        else
+        if (m_extern_result.contains(external_sym))
         {
-            const bool has_arg = m_extern_arg.count(external) && m_extern_arg[external];
-            if (has_arg) {
-                m_output << "  (import \"env\" \"" << external << "\" (func $" << external << " (param i64)))\n";
-            } else {
-                m_output << "  (import \"env\" \"" << external << "\" (func $" << external << "))\n";
-            }
+            m_output << " (result i64)";
         }
+        m_output << "))\n";
+    }
+    if (m_exit_import)
+    {
+        m_output << "  (import \"env\" \"exit\" (func $exit (param i64)))\n";
     }
     
     // Memory declaration (1 page = 64KB)
@@ -118,15 +197,34 @@ void WasmGen::ghdr()
     m_output << "  (export \"memory\" (memory 0))\n";
 }
 
-void WasmGen::gprolog()
+// main is the exported entry point returning the exit status; every other function takes and
+// returns i64 values, its parameters being locals 0..params-1.
+void WasmGen::gprolog(const funcOp& func)
 {
-    m_output << "  (func $main (export \"_start\") (result i32)\n";
+    if (m_in_main)
+    {
+        m_output << "  (func $main (export \"_start\") (result i32)\n";
+    }
+    else
+    {
+        m_output << "  (func $" << func_label(func.name);
+        if (func.params > 0)
+        {
+            m_output << " (param";
+            for (int i = 0; i < func.params; i++)
+            {
+                m_output << " i64";
+            }
+            m_output << ")";
+        }
+        m_output << " (result i64)\n";
+    }
     
     // Declare local variables
-    if (m_local_count > 0)
+    if (m_local_count > func.params)
     {
         m_output << "    (local";
-        for (int i = 0; i < m_local_count; i++)
+        for (int i = func.params; i < m_local_count; i++)
         {
             m_output << " i64";
         }
@@ -138,44 +236,118 @@ void WasmGen::gepilog()
 {
     // Default return value of 0
     m_output << "    i64.const 0\n";
-    m_output << "    i32.wrap_i64\n";  // Convert to i32 for return
+    if (m_in_main)
+    {
+        m_output << "    i32.wrap_i64\n";  // Convert to i32 for return
+    }
     m_output << "  )\n";
-    m_output << ")\n";
 }
 
 void WasmGen::ginstrs(const vector<inst>& ir)
 {
-    std::vector<string> start_stack;
-    for (const auto& instr : ir) {
-        if (instr.kind == Opkind::label) {
-            if (instr.label.name.rfind("while_start_", 0) == 0) {
-                start_stack.push_back(instr.label.name);
-            } else if (instr.label.name.rfind("while_end_", 0) == 0) {
-                if (!start_stack.empty() && m_loop_fin[start_stack.back()] == instr.label.name) {
-                    start_stack.pop_back();
-                }
+    for (size_t i = 0; i < ir.size(); i++) {
+        if (ir[i].kind == Opkind::label) {
+            m_label_pos[ir[i].label.label] = i;
+        }
+    }
+
+    // Labels a br_table reaches get their blocks from gjumptable.
+    unordered_set<LabelId> table_labels;
+    for (const inst& instr : ir) {
+        if (instr.kind == Opkind::jumptable) {
+            const JumpTable& table = m_ir->jump_tables[instr.jumptable.table];
+            table_labels.insert(table.targets.begin(), table.targets.end());
+            table_labels.insert(table.default_label);
+            table_labels.insert(table.end_label);
+        }
+    }
+
+    // Everything else outside loops is only ever jumped to forwards: if/else arms, switch
+    // compare trees, ternary arms and short-circuit conditions. Each label gets a block running
+    // from its first jump to the label; `a || b` or an if/else produces two overlapping ranges,
+    // so a block that would cross an inner one is widened to start where that one starts.
+    struct Span {
+        size_t start;
+        size_t end;
+        LabelId label;
+    };
+    vector<Span> spans;
+    unordered_map<LabelId, size_t> first_jump;
+    for (size_t i = 0; i < ir.size(); i++) {
+        const LabelId target = ir[i].kind == Opkind::jump          ? ir[i].jump.label
+                               : ir[i].kind == Opkind::jumpiffalse ? ir[i].jumpiffalse.label
+                                                                   : -1;
+        if (target < 0 || table_labels.count(target)) {
+            continue;
+        }
+        const LabelKind kind = m_ir->label_info(target).kind;
+        if (kind != LabelKind::LoopHead && kind != LabelKind::LoopExit &&
+            first_jump.emplace(target, i).second && m_label_pos.count(target) &&
+            m_label_pos[target] > i) {
+            spans.push_back({i, m_label_pos[target], target});
+        }
+    }
+    sort(spans.begin(), spans.end(), [](const Span& a, const Span& b) { return a.end < b.end; });
+    for (size_t k = 0; k < spans.size(); k++) {
+        for (size_t j = k; j-- > 0 && spans[j].end > spans[k].start;) {
+            if (spans[j].start < spans[k].start) {
+                spans[k].start = spans[j].start;
             }
-        } else if (instr.kind == Opkind::jumpiffalse) {
-            if (instr.jumpiffalse.label.rfind("while_end_", 0) == 0) {
-                if (!start_stack.empty() && m_loop_fin.find(start_stack.back()) == m_loop_fin.end()) {
-                    m_loop_fin[start_stack.back()] = instr.jumpiffalse.label;
-                }
+        }
+    }
+    sort(spans.begin(), spans.end(), [](const Span& a, const Span& b) {
+        return a.start != b.start ? a.start < b.start : a.end > b.end;
+    });
+    for (const auto& span : spans) {
+        m_block_opens[span.start].push_back(span.label);
+    }
+
+    for (size_t i = 0; i < ir.size(); i++)
+    {
+        if (ir[i].kind == Opkind::function)
+        {
+            if (m_in_function)
+            {
+                gepilog();
+            }
+            frame(ir, i);
+            m_in_function = true;
+            m_in_main = SymbolTable::instance().name(ir[i].func.name) == "main";
+            gprolog(ir[i].func);
+            continue;
+        }
+        auto opens = m_block_opens.find(i);
+        if (opens != m_block_opens.end())
+        {
+            for (LabelId label : opens->second)
+            {
+                m_output << "    (block $" << m_ir->label_name(label) << "\n";
+                m_block_stack.push_back(label);
             }
         }
+        ginstr(ir[i]);
     }
+    if (m_in_function)
+    {
+        gepilog();
+    }
+}
 
-    for (const auto& instr : ir)
+// True if `label` ends a block or loop we are currently inside, so br can reach it.
+bool WasmGen::open_block(LabelId label) const
+{
+    for (const auto& loop : m_loop_stack)
     {
-        ginstr(instr);
+        if (loop.end == label)
+        {
+            return true;
+        }
     }
+    return find(m_block_stack.begin(), m_block_stack.end(), label) != m_block_stack.end();
 }
 
 void WasmGen::ginstr(const inst& instr)
 {
-    auto is_prefix = [](const string& value, const string& prefix) {
-        return value.rfind(prefix, 0) == 0;
-    };
-
     switch (instr.kind)
     {
         case Opkind::autoassign:
@@ -186,38 +358,9 @@ void WasmGen::ginstr(const inst& instr)
             break;
         }
         
-        case Opkind::funcall:
+        case Opkind::call:
         {
-            if (instr.funcall.arg.has_value())
-            {
-                larg(instr.funcall.arg.value());
-                if (instr.funcall.name == "exit")
-                {
-                    // For exit, just return the value
-                    m_output << "    i32.wrap_i64\n";  // Convert to i32
-                    m_output << "    return\n";
-                }
-                else if (instr.funcall.name == "printf")
-                {
-                    m_output << "    call $printf\n";
-                }
-                else
-                {
-                    m_output << "    call $" << instr.funcall.name << "\n";
-                }
-            }
-            else
-            {
-                if (instr.funcall.name == "exit")
-                {
-                    m_output << "    i32.const 0\n";
-                    m_output << "    return\n";
-                }
-                else
-                {
-                    m_output << "    call $" << instr.funcall.name << "\n";
-                }
-            }
+            gcall(instr);
             break;
         }
         
@@ -274,68 +417,93 @@ void WasmGen::ginstr(const inst& instr)
             break;
         }
         
+        case Opkind::unaryop:
+        {
+            if (instr.unary.op == UnaryOp::Not)
+            {
+                gnot(instr);
+            }
+            else if (instr.unary.op == UnaryOp::Negate)
+            {
+                gneg(instr);
+            }
+            break;
+        }
+        
+        case Opkind::update:
+        {
+            gupdate(instr);
+            break;
+        }
+        
+        case Opkind::select:
+        {
+            gselect(instr);
+            break;
+        }
+        
         case Opkind::label:
         {
-            const string& label = instr.label.name;
-            if (is_prefix(label, "while_start_")) {
-                auto it = m_loop_fin.find(label);
-                if (it != m_loop_fin.end()) {
-                    const string& end_label = it->second;
-                    m_output << "    (block $" << end_label << "\n";
-                    m_output << "    (loop $" << label << "\n";
-                    m_loop_stack.push_back({label, end_label});
-                } else {
-                    m_output << "    ;; label: " << label << "\n";
-                }
-            } else if (is_prefix(label, "while_end_")) {
+            const LabelId label = instr.label.label;
+            const LabelInfo& info = m_ir->label_info(label);
+            const string& name = info.name;
+            if (!m_block_stack.empty() && m_block_stack.back() == label) {
+                m_output << "    )\n";
+                m_block_stack.pop_back();
+            } else if (info.kind == LabelKind::LoopHead) {
+                m_output << "    (block $" << m_ir->label_name(info.pair) << "\n";
+                m_output << "    (loop $" << name << "\n";
+                m_loop_stack.push_back({label, info.pair});
+            } else if (info.kind == LabelKind::LoopExit) {
                 if (!m_loop_stack.empty() && m_loop_stack.back().end == label) {
                     m_output << "    )\n";
                     m_output << "    )\n";
                     m_loop_stack.pop_back();
                 } else {
-                    m_output << "    ;; label: " << label << "\n";
+                    m_output << "    ;; label: " << name << "\n";
                 }
             } else {
-                m_output << "    ;; label: " << label << "\n";
+                m_output << "    ;; label: " << name << "\n";
             }
             break;
         }
         
         case Opkind::jump:
         {
+            const string& name = m_ir->label_name(instr.jump.label);
             if (!m_loop_stack.empty() && instr.jump.label == m_loop_stack.back().start) {
-                m_output << "    br $" << instr.jump.label << "\n";
+                m_output << "    br $" << name << "\n";
+            } else if (open_block(instr.jump.label)) {
+                // break out of a loop, switch or condition
+                m_output << "    br $" << name << "\n";
             } else {
-                m_output << "    ;; jump to " << instr.jump.label << "\n";
+                m_output << "    ;; jump to " << name << "\n";
             }
             break;
         }
         
         case Opkind::jumpiffalse:
         {
-            if (!m_loop_stack.empty() && instr.jumpiffalse.label == m_loop_stack.back().end) {
+            const string& name = m_ir->label_name(instr.jumpiffalse.label);
+            if (open_block(instr.jumpiffalse.label)) {
                 larg(instr.jumpiffalse.condition);
                 m_output << "    i64.eqz\n";
-                m_output << "    br_if $" << instr.jumpiffalse.label << "\n";
+                m_output << "    br_if $" << name << "\n";
             } else {
-                m_output << "    ;; jumpiffalse to " << instr.jumpiffalse.label << "\n";
+                m_output << "    ;; jumpiffalse to " << name << "\n";
             }
             break;
         }
         
+        case Opkind::jumptable:
+        {
+            gjumptable(instr);
+            break;
+        }
+        
         case Opkind::ret:
         {
-            if (instr.ret.value.has_value())
-            {
-                larg(instr.ret.value.value());
-                m_output << "    i32.wrap_i64\n";  // Convert to i32
-                m_output << "    return\n";
-            }
-            else
-            {
-                m_output << "    i32.const 0\n";
-                m_output << "    return\n";
-            }
+            gret(instr);
             break;
         }
         
@@ -501,6 +669,181 @@ void WasmGen::gshr(const inst& instr)
     m_output << "    local.set " << m_var_offsets[instr.binop.dest] << "\n";
 }
 
+void WasmGen::gnot(const inst& instr)
+{
+    larg(instr.unary.operand);
+    m_output << "    i64.eqz\n";
+    m_output << "    i64.extend_i32_u\n";
+    m_output << "    local.set " << m_var_offsets[instr.unary.dest] << "\n";
+}
+
+void WasmGen::gneg(const inst& instr)
+{
+    m_output << "    i64.const 0\n";
+    larg(instr.unary.operand);
+    m_output << "    i64.sub\n";
+    m_output << "    local.set " << m_var_offsets[instr.unary.dest] << "\n";
+}
+
+void WasmGen::gupdate(const inst& instr)
+{
+    const Arg& dest = instr.update.dest;
+    larg(dest);
+    larg(instr.update.value);
+    switch (instr.update.op)
+    {
+        case BinOp::Add:
+            m_output << "    i64.add\n";
+            break;
+        case BinOp::Sub:
+            m_output << "    i64.sub\n";
+            break;
+        case BinOp::Shl:
+            m_output << "    i64.shl\n";
+            break;
+        case BinOp::Shr:
+            m_output << "    i64.shr_s\n";
+            break;
+        default:
+            break;
+    }
+    if (dest.type == ArgType::Global)
+    {
+        m_output << "    global.set " << dest.value << "\n";
+    }
+    else
+    {
+        m_output << "    local.set " << m_var_offsets[dest.value] << "\n";
+    }
+}
+
+// select keeps the first operand when the i32 condition is non-zero.
+void WasmGen::gselect(const inst& instr)
+{
+    larg(instr.select.if_true);
+    larg(instr.select.if_false);
+    larg(instr.select.condition);
+    m_output << "    i64.eqz\n";
+    m_output << "    i32.eqz\n";
+    m_output << "    select\n";
+    m_output << "    local.set " << m_var_offsets[instr.select.dest] << "\n";
+}
+
+// br_table can only target enclosing blocks, so every case label gets a block that ends right
+// at it: the earliest case is innermost and the whole switch sits inside a block for its end
+// label, which `break` branches to. The blocks are closed as the labels come up.
+void WasmGen::gjumptable(const inst& instr)
+{
+    const jumpTableOp& op = instr.jumptable;
+    const JumpTable& table = m_ir->jump_tables[op.table];
+
+    vector<LabelId> blocks = table.targets;
+    blocks.push_back(table.default_label);
+    sort(blocks.begin(), blocks.end());
+    blocks.erase(unique(blocks.begin(), blocks.end()), blocks.end());
+    blocks.erase(remove(blocks.begin(), blocks.end(), table.end_label), blocks.end());
+    sort(blocks.begin(), blocks.end(), [&](LabelId a, LabelId b) {
+        return m_label_pos[a] > m_label_pos[b];
+    });
+
+    m_output << "    (block $" << m_ir->label_name(table.end_label) << "\n";
+    m_block_stack.push_back(table.end_label);
+    for (LabelId label : blocks)
+    {
+        m_output << "    (block $" << m_ir->label_name(label) << "\n";
+        m_block_stack.push_back(label);
+    }
+
+    larg(op.value);
+    if (op.low != 0)
+    {
+        m_output << "    i64.const " << op.low << "\n";
+        m_output << "    i64.sub\n";
+    }
+    m_output << "    local.tee " << m_switch_local << "\n";
+    m_output << "    i64.const " << table.targets.size() << "\n";
+    m_output << "    i64.ge_u\n";
+    m_output << "    br_if $" << m_ir->label_name(table.default_label) << "\n";
+    m_output << "    local.get " << m_switch_local << "\n";
+    m_output << "    i32.wrap_i64\n";
+    m_output << "    br_table";
+    for (LabelId target : table.targets)
+    {
+        m_output << " $" << m_ir->label_name(target);
+    }
+    m_output << " $" << m_ir->label_name(table.default_label) << "\n";
+}
+
+// exit in main is a return of the status; anywhere else it goes to the host.
+void WasmGen::gcall(const inst& instr)
+{
+    const callOp& call = instr.call;
+    const Arg* args = m_ir->args(call);
+    if (call.function == m_exit_sym && !m_functions.contains(call.function))
+    {
+        if (call.arg_count == 0)
+        {
+            m_output << "    i64.const 0\n";
+        }
+        else
+        {
+            larg(args[0]);
+        }
+        if (m_in_main)
+        {
+            m_output << "    i32.wrap_i64\n";
+            m_output << "    return\n";
+        }
+        else
+        {
+            m_output << "    call $exit\n";
+            m_output << "    unreachable\n";
+        }
+        return;
+    }
+    
+    for (uint32_t i = 0; i < call.arg_count; i++)
+    {
+        larg(args[i]);
+    }
+    
+    const bool internal = m_functions.contains(call.function);
+    if (internal)
+    {
+        m_output << "    call $" << func_label(call.function) << "\n";
+    }
+    else
+    {
+        m_output << "    call $" << SymbolTable::instance().name(call.function) << "\n";
+    }
+    
+    if (call.dest >= 0)
+    {
+        m_output << "    local.set " << m_var_offsets[call.dest] << "\n";
+    }
+    else if (internal || m_extern_result.contains(call.function))
+    {
+        m_output << "    drop\n";
+    }
+}
+
+void WasmGen::gret(const inst& instr)
+{
+    if (instr.ret.has_value)
+    {
+        larg(instr.ret.value);
+    }
+    else
+    {
+        m_output << "    i64.const 0\n";
+    }
+    if (m_in_main)
+    {
+        m_output << "    i32.wrap_i64\n";  // Convert to i32
+    }
+    m_output << "    return\n";
+}
+
 bool WasmGen::avail() const
 {
     return true;
@@ -9,21 +9,25 @@
 class WasmGen : public TargetAPI
 {
 public:
-    string gcode(const vector<inst>& ir) override;
+    string gcode(const IrProgram& ir) override;
     string asm_ext() const override { return ".wat"; }
     string asm_cmd(const string& asm_file, const string& obj_file) const override;
     string ld_cmd(const string& obj_file, const string& exe_file) const override;
     string name() const override { return "WebAssembly Text Format"; }
     bool avail() const override;
+    // code size is download size here
+    size_t unroll_budget() const override { return 32; }
 
 private:
     struct LF {
-        string start;
-        string end;
+        LabelId start;
+        LabelId end;
     };
     void metadata(const vector<inst>& ir);
+    void frame(const vector<inst>& ir, size_t start);
+    string func_label(SymbolId name) const;
     void ghdr();
-    void gprolog();
+    void gprolog(const funcOp& func);
     void gepilog();
     void ginstrs(const vector<inst>& ir);
     void ginstr(const inst& instr);
@@ -44,15 +48,33 @@ private:
     void gor(const inst& instr);
     void gshl(const inst& instr);
     void gshr(const inst& instr);
+    void gnot(const inst& instr);
+    void gneg(const inst& instr);
+    void gupdate(const inst& instr);
+    void gselect(const inst& instr);
+    bool open_block(LabelId label) const;
+    void gjumptable(const inst& instr);
+    void gcall(const inst& instr);
+    void gret(const inst& instr);
 
+    const IrProgram* m_ir = nullptr;  // program being generated, for its side tables
     stringstream m_output;
     unordered_map<int, int> m_var_offsets;
-    unordered_set<string> m_externs;
-    unordered_map<string, bool> m_extern_arg;
+    SymbolSet m_externs;
+    SymbolSet m_functions;
+    unordered_map<SymbolId, int> m_extern_params;  // argument count of each called extern
+    SymbolSet m_extern_result;  // externs whose return value is used
+    SymbolId m_exit_sym = 0;
+    bool m_exit_import = false;  // exit called outside main, where it can't just return
+    bool m_in_function = false;
+    bool m_in_main = false;
     int m_stack_size = 0;
     int m_global_count = 0;
     int m_label_count = 0;
-    int m_local_count = 0;
+    int m_local_count = 0;  // parameters included
+    int m_switch_local = -1;  // scratch local for jump table indices
     vector<LF> m_loop_stack;
-    unordered_map<string, string> m_loop_fin;
+    unordered_map<LabelId, size_t> m_label_pos;  // label -> index in the IR
+    vector<LabelId> m_block_stack;  // open switch/condition blocks, each closed at its label
+    unordered_map<size_t, vector<LabelId>> m_block_opens;  // IR index -> blocks opened there
 };
\ No newline at end of file
@@ -9,7 +9,7 @@ using std::endl;
 using std::string;
 
 // Wasm edge  generator using the C  API for AOT compilation
-string WEGen::gcode(const vector<inst>& ir)
+string WEGen::gcode(const IrProgram& ir)
 {
     if (std::getenv("DEBUG_WASMEDGE") != nullptr) {
         cout << "WasmEdge Target: Generating WebAssembly via wasm_generator" << endl;
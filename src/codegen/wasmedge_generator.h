@@ -6,12 +6,14 @@
 class WEGen : public TargetAPI
 {
 public:
-    string gcode(const vector<inst>& ir) override;
+    string gcode(const IrProgram& ir) override;
     string asm_ext() const override { return ".wat"; }
     string asm_cmd(const string& asm_file, const string& obj_file) const override;
     string ld_cmd(const string& obj_file, const string& exe_file) const override;
     string name() const override { return "WasmEdge (AOT optimized)"; }
     bool avail() const override;
+    // code size is download size here
+    size_t unroll_budget() const override { return 32; }
 
 private:
     WasmGen m_wasm_generator;
@@ -4,16 +4,15 @@
 
 using namespace std;
 
-string x86Gen::gcode(const vector<inst>& ir)
+string x86Gen::gcode(const IrProgram& ir)
 {
     m_output.str("");
     m_output.clear();
+    m_ir = &ir;
     
-    metadata(ir);
+    metadata(ir.code);
     ghdr();
-    gprolog();
-    ginstrs(ir);
-    gepilog();
+    ginstrs(ir.code);
     
     return m_output.str();
 }
@@ -28,17 +27,17 @@ string x86Gen::ld_cmd(const string& obj_file, const string& exe_file) const
     return "gcc -no-pie " + obj_file + " -o " + exe_file;
 }
 
+// Program-wide facts: globals, externs and which names are functions of this program.
 void x86Gen::metadata(const vector<inst>& ir)
 {
-    m_var_offsets.clear();
     m_externs.clear();
-    m_stack_size = 0;
+    m_functions.clear();
     m_global_count = 0;
     m_label_count = 0;
+    m_in_function = false;
     
-    m_externs.insert("exit");
+    m_externs.insert(SymbolTable::instance().intern("exit"));
     
-    int var_count = 0;
     for (const auto& instr : ir)
     {
         if (instr.kind == Opkind::globalvar)
@@ -49,29 +48,76 @@ void x86Gen::metadata(const vector<inst>& ir)
         {
             m_externs.insert(instr.externvar.name);
         }
-        else if (instr.kind == Opkind::autovar)
+        else if (instr.kind == Opkind::function)
+        {
+            m_functions.insert(instr.func.name);
+        }
+    }
+}
+
+// Stack slots of the function starting at ir[start]: declared locals (parameters first) in
+// order, then every temporary on first write. The frame is rounded up to 16 bytes so rsp stays
+// aligned for calls.
+void x86Gen::frame(const vector<inst>& ir, size_t start)
+{
+    m_var_offsets.clear();
+    m_stack_size = 0;
+    
+    auto slot = [&](int index)
+    {
+        if (m_var_offsets.find(index) == m_var_offsets.end())
+        {
+            m_stack_size += 8;
+            m_var_offsets[index] = m_stack_size;
+        }
+    };
+    
+    int var_count = 0;
+    for (size_t i = start + 1; i < ir.size() && ir[i].kind != Opkind::function; i++)
+    {
+        const inst& instr = ir[i];
+        if (instr.kind == Opkind::autovar)
         {
-            const int current_var = var_count;
-            m_stack_size += 8 * instr.autovar.count;
-            for (int i = 0; i < instr.autovar.count; i++)
+            for (int k = 0; k < instr.autovar.count; k++)
             {
-                m_var_offsets[current_var + i] = (current_var + i + 1) * 8;
+                slot(var_count++);
             }
-            var_count += instr.autovar.count;
         }
         else if (instr.kind == Opkind::binop)
         {
-            if (m_var_offsets.find(instr.binop.dest) == m_var_offsets.end())
-            {
-                m_stack_size += 8;
-                m_var_offsets[instr.binop.dest] = m_stack_size;
-            }
+            slot(instr.binop.dest);
         }
-        else if (instr.kind == Opkind::ret)
+        else if (instr.kind == Opkind::unaryop)
         {
-            m_externs.insert("exit");
+            slot(instr.unary.dest);
         }
+        else if (instr.kind == Opkind::select)
+        {
+            slot(instr.select.dest);
+        }
+        else if (instr.kind == Opkind::autoassign)
+        {
+            // temporaries assigned directly (folded expressions, branched ternaries)
+            slot(instr.autoassign.index);
+        }
+        else if (instr.kind == Opkind::call && instr.call.dest >= 0)
+        {
+            slot(instr.call.dest);
+        }
+    }
+    m_stack_size = (m_stack_size + 15) & ~15;
+}
+
+// main keeps its name for the C runtime; every other function gets a prefix so it can't clash
+// with an extern or an assembler keyword.
+string x86Gen::func_label(SymbolId name) const
+{
+    const string_view text = SymbolTable::instance().name(name);
+    if (text == "main")
+    {
+        return "main";
     }
+    return "fn_" + string(text);
 }
 
 void x86Gen::ghdr()
@@ -79,17 +125,21 @@ void x86Gen::ghdr()
     m_output << "format ELF64\n";
     m_output << "section '.text' executable\n";
     
-    for (const string& external : m_externs)
+    for (SymbolId external : m_externs.items())
     {
-        m_output << "extrn " << external << "\n";
+        m_output << "extrn " << SymbolTable::instance().name(external) << "\n";
     }
     
     m_output << "public main\n";
 }
 
-void x86Gen::gprolog()
+// SysV: the first six arguments arrive in rdi, rsi, rdx, rcx, r8, r9 and the rest on the stack
+// above the return address. All of them are spilled to their local slots.
+void x86Gen::gprolog(const funcOp& func)
 {
-    m_output << "main:\n";
+    static const char* const arg_regs[] = {"rdi", "rsi", "rdx", "rcx", "r8", "r9"};
+    
+    m_output << "\n" << func_label(func.name) << ":\n";
     m_output << "    push rbp\n";
     m_output << "    mov rbp, rsp\n";
     
@@ -97,25 +147,65 @@ void x86Gen::gprolog()
     {
         m_output << "    sub rsp, " << m_stack_size << "\n";
     }
+    
+    for (int i = 0; i < func.params; i++)
+    {
+        const string dest = "qword [rbp - " + to_string(m_var_offsets[i]) + "]";
+        if (i < 6)
+        {
+            m_output << "    mov " << dest << ", " << arg_regs[i] << "\n";
+        }
+        else
+        {
+            m_output << "    mov rax, qword [rbp + " << 16 + 8 * (i - 6) << "]\n";
+            m_output << "    mov " << dest << ", rax\n";
+        }
+    }
 }
 
+// Falling off the end: main exits with status 0, other functions return 0.
 void x86Gen::gepilog()
 {
     m_output << "\n";
-    if (m_stack_size > 0)
+    if (m_in_main)
     {
-        m_output << "    add rsp, " << m_stack_size << "\n";
+        if (m_stack_size > 0)
+        {
+            m_output << "    add rsp, " << m_stack_size << "\n";
+        }
+        m_output << "    pop rbp\n";
+        m_output << "    mov rdi, 0\n";
+        m_output << "    call exit\n";
+    }
+    else
+    {
+        m_output << "    xor eax, eax\n";
+        m_output << "    leave\n";
+        m_output << "    ret\n";
     }
-    m_output << "    pop rbp\n";
-    m_output << "    mov rdi, 0\n";
-    m_output << "    call exit\n";
 }
 
 void x86Gen::ginstrs(const vector<inst>& ir)
 {
-    for (const auto& instr : ir)
+    for (size_t i = 0; i < ir.size(); i++)
+    {
+        if (ir[i].kind == Opkind::function)
+        {
+            if (m_in_function)
+            {
+                gepilog();
+            }
+            frame(ir, i);
+            m_in_function = true;
+            m_in_main = SymbolTable::instance().name(ir[i].func.name) == "main";
+            gprolog(ir[i].func);
+            continue;
+        }
+        ginstr(ir[i]);
+    }
+    if (m_in_function)
     {
-        ginstr(instr);
+        gepilog();
     }
 }
 
@@ -139,13 +229,9 @@ void x86Gen::ginstr(const inst& instr)
             break;
         }
         
-        case Opkind::funcall:
+        case Opkind::call:
         {
-            if (instr.funcall.arg.has_value())
-            {
-                larg(instr.funcall.arg.value(), "rdi");
-            }
-            m_output << "    call " << instr.funcall.name << "\n";
+            gcall(instr);
             break;
         }
         
@@ -202,15 +288,40 @@ void x86Gen::ginstr(const inst& instr)
             break;
         }
         
+        case Opkind::unaryop:
+        {
+            if (instr.unary.op == UnaryOp::Not)
+            {
+                gnot(instr);
+            }
+            else if (instr.unary.op == UnaryOp::Negate)
+            {
+                gneg(instr);
+            }
+            break;
+        }
+        
+        case Opkind::update:
+        {
+            gupdate(instr);
+            break;
+        }
+        
+        case Opkind::select:
+        {
+            gselect(instr);
+            break;
+        }
+        
         case Opkind::label:
         {
-            m_output << instr.label.name << ":\n";
+            m_output << m_ir->label_name(instr.label.label) << ":\n";
             break;
         }
         
         case Opkind::jump:
         {
-            m_output << "    jmp " << instr.jump.label << "\n";
+            m_output << "    jmp " << m_ir->label_name(instr.jump.label) << "\n";
             break;
         }
         
@@ -218,22 +329,19 @@ void x86Gen::ginstr(const inst& instr)
         {
             larg(instr.jumpiffalse.condition, "rax");
             m_output << "    cmp rax, 0\n";
-            m_output << "    je " << instr.jumpiffalse.label << "\n";
+            m_output << "    je " << m_ir->label_name(instr.jumpiffalse.label) << "\n";
+            break;
+        }
+        
+        case Opkind::jumptable:
+        {
+            gjumptable(instr);
             break;
         }
         
         case Opkind::ret:
         {
-            if (instr.ret.value.has_value())
-            {
-                larg(instr.ret.value.value(), "rdi");
-                m_output << "    call exit\n";
-            }
-            else
-            {
-                m_output << "    mov rdi, 0\n";
-                m_output << "    call exit\n";
-            }
+            gret(instr);
             break;
         }
         
@@ -431,6 +539,190 @@ void x86Gen::gshr(const inst& instr)
     m_output << "    mov " << dest << ", rax\n";
 }
 
+void x86Gen::gnot(const inst& instr)
+{
+    larg(instr.unary.operand, "rax");
+    m_output << "    cmp rax, 0\n";
+    m_output << "    sete al\n";
+    m_output << "    movzx rax, al\n";
+    const string dest = "qword [rbp - " + to_string(m_var_offsets[instr.unary.dest]) + "]";
+    m_output << "    mov " << dest << ", rax\n";
+}
+
+void x86Gen::gneg(const inst& instr)
+{
+    larg(instr.unary.operand, "rax");
+    m_output << "    neg rax\n";
+    const string dest = "qword [rbp - " + to_string(m_var_offsets[instr.unary.dest]) + "]";
+    m_output << "    mov " << dest << ", rax\n";
+}
+
+// Read-modify-write straight on the variable's memory slot: inc/dec for +-1, an immediate
+// operand for other constants, otherwise the value goes through rax (rcx for shift counts).
+void x86Gen::gupdate(const inst& instr)
+{
+    const Arg& dest = instr.update.dest;
+    const Arg& value = instr.update.value;
+    const string mem = dest.type == ArgType::Global
+                           ? "qword [global_" + to_string(dest.value) + "]"
+                           : "qword [rbp - " + to_string(m_var_offsets[dest.value]) + "]";
+
+    string mnemonic;
+    switch (instr.update.op)
+    {
+        case BinOp::Add:
+            mnemonic = "add";
+            break;
+        case BinOp::Sub:
+            mnemonic = "sub";
+            break;
+        case BinOp::Shl:
+            mnemonic = "shl";
+            break;
+        case BinOp::Shr:
+            mnemonic = "shr";
+            break;
+        default:
+            return;
+    }
+
+    if (value.type == ArgType::Literal)
+    {
+        if (value.value == 1 && instr.update.op == BinOp::Add)
+        {
+            m_output << "    inc " << mem << "\n";
+        }
+        else if (value.value == 1 && instr.update.op == BinOp::Sub)
+        {
+            m_output << "    dec " << mem << "\n";
+        }
+        else
+        {
+            m_output << "    " << mnemonic << " " << mem << ", " << value.value << "\n";
+        }
+    }
+    else if (instr.update.op == BinOp::Shl || instr.update.op == BinOp::Shr)
+    {
+        larg(value, "rcx");
+        m_output << "    " << mnemonic << " " << mem << ", cl\n";
+    }
+    else
+    {
+        larg(value, "rax");
+        m_output << "    " << mnemonic << " " << mem << ", rax\n";
+    }
+}
+
+// Both values are loaded up front and cmov picks one, so there is no branch to mispredict.
+void x86Gen::gselect(const inst& instr)
+{
+    larg(instr.select.if_false, "rax");
+    larg(instr.select.if_true, "rbx");
+    larg(instr.select.condition, "rcx");
+    m_output << "    test rcx, rcx\n";
+    m_output << "    cmovne rax, rbx\n";
+    const string dest = "qword [rbp - " + to_string(m_var_offsets[instr.select.dest]) + "]";
+    m_output << "    mov " << dest << ", rax\n";
+}
+
+// Rebase the value to the first case, one unsigned compare catches both ends of the range,
+// then jump through a table of absolute addresses emitted right after the jmp.
+void x86Gen::gjumptable(const inst& instr)
+{
+    const jumpTableOp& op = instr.jumptable;
+    const JumpTable& table = m_ir->jump_tables[op.table];
+    const int label = m_label_count++;
+
+    larg(op.value, "rax");
+    if (op.low != 0)
+    {
+        m_output << "    sub rax, " << op.low << "\n";
+    }
+    m_output << "    cmp rax, " << table.targets.size() - 1 << "\n";
+    m_output << "    ja " << m_ir->label_name(table.default_label) << "\n";
+    m_output << "    jmp qword [jump_table_" << label << " + rax*8]\n";
+    m_output << "jump_table_" << label << ":\n";
+    for (LabelId target : table.targets)
+    {
+        m_output << "    dq " << m_ir->label_name(target) << "\n";
+    }
+}
+
+// Arguments past the sixth are pushed right to left, with a pad slot first when their count is
+// odd so rsp is 16-byte aligned at the call. al = 0 tells a variadic extern (printf) that no
+// vector registers are used.
+void x86Gen::gcall(const inst& instr)
+{
+    static const char* const arg_regs[] = {"rdi", "rsi", "rdx", "rcx", "r8", "r9"};
+    const callOp& call = instr.call;
+    const Arg* args = m_ir->args(call);
+    const int count = call.arg_count;
+    const int stack_args = count > 6 ? count - 6 : 0;
+    const int stack_bytes = 8 * (stack_args + stack_args % 2);
+    
+    if (stack_args % 2)
+    {
+        m_output << "    sub rsp, 8\n";
+    }
+    for (int i = count - 1; i >= 6; i--)
+    {
+        larg(args[i], "rax");
+        m_output << "    push rax\n";
+    }
+    for (int i = 0; i < count && i < 6; i++)
+    {
+        larg(args[i], arg_regs[i]);
+    }
+    
+    if (m_functions.contains(call.function))
+    {
+        m_output << "    call " << func_label(call.function) << "\n";
+    }
+    else
+    {
+        m_output << "    xor eax, eax\n";
+        m_output << "    call " << SymbolTable::instance().name(call.function) << "\n";
+    }
+    
+    if (stack_bytes > 0)
+    {
+        m_output << "    add rsp, " << stack_bytes << "\n";
+    }
+    if (call.dest >= 0)
+    {
+        m_output << "    mov qword [rbp - " << m_var_offsets[call.dest] << "], rax\n";
+    }
+}
+
+// return in main ends the program with the value as exit status
+void x86Gen::gret(const inst& instr)
+{
+    if (m_in_main)
+    {
+        if (instr.ret.has_value)
+        {
+            larg(instr.ret.value, "rdi");
+        }
+        else
+        {
+            m_output << "    mov rdi, 0\n";
+        }
+        m_output << "    call exit\n";
+        return;
+    }
+    
+    if (instr.ret.has_value)
+    {
+        larg(instr.ret.value, "rax");
+    }
+    else
+    {
+        m_output << "    xor eax, eax\n";
+    }
+    m_output << "    leave\n";
+    m_output << "    ret\n";
+}
+
 bool x86Gen::avail() const
 {
     return true;
@@ -0,0 +1,203 @@
+#include "dataflow.h"
+
+#include <algorithm>
+#include <deque>
+
+using namespace std;
+
+void BitSet::fill(bool value) {
+    std::fill(m_words.begin(), m_words.end(), value ? ~uint64_t(0) : 0);
+    if (value && m_bits % 64 != 0) {
+        // keep the bits past the end clear so equal sets compare equal
+        m_words.back() &= (uint64_t(1) << (m_bits % 64)) - 1;
+    }
+}
+
+bool BitSet::unite(const BitSet& other) {
+    bool changed = false;
+    for (size_t w = 0; w < m_words.size(); w++) {
+        const uint64_t merged = m_words[w] | other.m_words[w];
+        changed |= merged != m_words[w];
+        m_words[w] = merged;
+    }
+    return changed;
+}
+
+bool BitSet::intersect(const BitSet& other) {
+    bool changed = false;
+    for (size_t w = 0; w < m_words.size(); w++) {
+        const uint64_t merged = m_words[w] & other.m_words[w];
+        changed |= merged != m_words[w];
+        m_words[w] = merged;
+    }
+    return changed;
+}
+
+bool BitSet::subtract(const BitSet& other) {
+    bool changed = false;
+    for (size_t w = 0; w < m_words.size(); w++) {
+        const uint64_t merged = m_words[w] & ~other.m_words[w];
+        changed |= merged != m_words[w];
+        m_words[w] = merged;
+    }
+    return changed;
+}
+
+void VarNumbering::build(const IrProgram& prog, const Cfg& cfg) {
+    int largest = -1;
+    auto scan = [&](auto&& note) {
+        for (size_t i = cfg.func_start() + 1; i < cfg.func_end(); i++) {
+            const inst& instr = prog.code[i];
+            const int dest = written_var(instr);
+            if (dest >= 0) {
+                note(dest);
+            }
+            for_each_operand(prog, instr, [&](const Arg& arg) {
+                if (arg.type == ArgType::Var) {
+                    note(arg.value);
+                }
+            });
+        }
+    };
+
+    scan([&](int var) { largest = max(largest, var); });
+
+    // read before any write in some block, going forward through each with the block number
+    // that last wrote every variable
+    vector<bool> exposed(largest + 1, false);
+    vector<int> written(largest + 1, -1);
+    const vector<BasicBlock>& blocks = cfg.blocks();
+    for (size_t b = 0; b < blocks.size(); b++) {
+        for (size_t i = blocks[b].first; i < blocks[b].end; i++) {
+            const inst& instr = prog.code[i];
+            for_each_operand(prog, instr, [&](const Arg& arg) {
+                if (arg.type == ArgType::Var && written[arg.value] != (int)b) {
+                    exposed[arg.value] = true;
+                }
+            });
+            const int dest = written_var(instr);
+            if (dest >= 0) {
+                written[dest] = (int)b;
+            }
+        }
+    }
+
+    m_index.assign(largest + 1, -1);
+    m_vars.clear();
+    auto number = [&](int var) {
+        if (m_index[var] == -1) {
+            m_index[var] = (int)m_vars.size();
+            m_vars.push_back(var);
+        }
+    };
+    scan([&](int var) {
+        if (exposed[var]) {
+            number(var);
+        }
+    });
+    m_across = m_vars.size();
+    scan(number);
+}
+
+BitSolution solve(const Cfg& cfg, const BitProblem& problem) {
+    const vector<BasicBlock>& blocks = cfg.blocks();
+    const int count = (int)blocks.size();
+
+    BitSolution solution;
+    solution.in.assign(count, BitSet(problem.bits));
+    solution.out.assign(count, BitSet(problem.bits));
+    if (problem.must) {
+        // everything until a path says otherwise; the boundary is set as blocks are visited
+        for (int b : cfg.rpo()) {
+            (problem.forward ? solution.out : solution.in)[b].fill(true);
+        }
+    }
+
+    deque<int> work;
+    vector<bool> queued(count, false);
+    auto push = [&](int b) {
+        if (!queued[b] && cfg.reachable(b)) {
+            queued[b] = true;
+            work.push_back(b);
+        }
+    };
+    if (problem.forward) {
+        for_each(cfg.rpo().begin(), cfg.rpo().end(), push);
+    } else {
+        for_each(cfg.rpo().rbegin(), cfg.rpo().rend(), push);
+    }
+
+    BitSet meet(problem.bits);
+    BitSet result(problem.bits);
+    while (!work.empty()) {
+        const int b = work.front();
+        work.pop_front();
+        queued[b] = false;
+
+        // edges coming in against the direction of the problem
+        const vector<int>& sources = problem.forward ? blocks[b].preds : blocks[b].succs;
+        vector<BitSet>& before = problem.forward ? solution.in : solution.out;
+        vector<BitSet>& after = problem.forward ? solution.out : solution.in;
+
+        bool first = true;
+        for (int s : sources) {
+            if (!cfg.reachable(s)) {
+                continue;
+            }
+            if (first) {
+                meet = after[s];
+                first = false;
+            } else if (problem.must) {
+                meet.intersect(after[s]);
+            } else {
+                meet.unite(after[s]);
+            }
+        }
+        if (first) {
+            meet = problem.boundary;
+        }
+        before[b] = meet;
+
+        result = meet;
+        result.subtract(problem.kill[b]);
+        result.unite(problem.gen[b]);
+        if (!(result == after[b])) {
+            after[b] = result;
+            for (int d : problem.forward ? blocks[b].succs : blocks[b].preds) {
+                push(d);
+            }
+        }
+    }
+    return solution;
+}
+
+BitSolution liveness(const IrProgram& prog, const Cfg& cfg, const VarNumbering& vars) {
+    const vector<BasicBlock>& blocks = cfg.blocks();
+
+    const size_t across = vars.across();
+
+    BitProblem problem;
+    problem.forward = false;
+    problem.bits = across;
+    problem.gen.assign(blocks.size(), BitSet(across));
+    problem.kill.assign(blocks.size(), BitSet(across));
+    problem.boundary = BitSet(across);
+
+    // gen: read before any write in the block; kill: written in it
+    for (size_t b = 0; b < blocks.size(); b++) {
+        for (size_t i = blocks[b].end; i-- > blocks[b].first;) {
+            const inst& instr = prog.code[i];
+            const int dest = written_var(instr);
+            if (dest >= 0 && vars.index(dest) < (int)across) {
+                problem.gen[b].reset(vars.index(dest));
+                problem.kill[b].set(vars.index(dest));
+            }
+            for_each_operand(prog, instr, [&](const Arg& arg) {
+                if (arg.type == ArgType::Var && vars.index(arg.value) < (int)across) {
+                    problem.gen[b].set(vars.index(arg.value));
+                }
+            });
+        }
+    }
+    return solve(cfg, problem);
+}
@@ -0,0 +1,140 @@
+#include <vector>
+
+#include "dataflow.h"
+#include "passes.h"
+
+using namespace std;
+
+// Instructions whose only effect is the local they write.
+static bool pure_def(const inst& instr) {
+    switch (instr.kind) {
+        case Opkind::autoassign:
+        case Opkind::binop:
+        case Opkind::unaryop:
+        case Opkind::select:
+            return true;
+        case Opkind::update:
+            return instr.update.dest.type == ArgType::Var;
+        default:
+            return false;
+    }
+}
+
+// One backward walk over every block with the locals live out of it. Returns whether anything
+// was deleted; what that frees up in other blocks needs liveness recomputed first.
+static bool sweep(IrProgram& prog, const Cfg& cfg, const VarNumbering& vars,
+                  const BitSolution& live, vector<int>& global_stamp, int& stamp) {
+    bool changed = false;
+    const int across = (int)vars.across();
+    BitSet alive;
+    // variables that stay inside one block have no bit in `alive`; they are live while marked
+    // with the block being walked
+    vector<int> local(vars.size() - across, -1);
+    for (int b : cfg.rpo()) {
+        const BasicBlock& block = cfg.blocks()[b];
+        alive = live.out[b];
+        auto is_alive = [&](int v) { return v < across ? alive.test(v) : local[v - across] == b; };
+        auto mark = [&](int v, bool value) {
+            if (v >= across) {
+                local[v - across] = value ? b : -1;
+            } else if (value) {
+                alive.set(v);
+            } else {
+                alive.reset(v);
+            }
+        };
+        // globals stored to further down this block with nothing in between that could read them
+        stamp++;
+        auto overwritten = [&](int global) {
+            return global < (int)global_stamp.size() && global_stamp[global] == stamp;
+        };
+
+        for (size_t i = block.end; i-- > block.first;) {
+            inst& instr = prog.code[i];
+            const int dest = written_var(instr);
+            if (pure_def(instr) &&
+                (!is_alive(vars.index(dest)) ||
+                 (instr.kind == Opkind::autoassign && instr.autoassign.arg.type == ArgType::Var &&
+                  instr.autoassign.arg.value == dest))) {
+                instr.kind = Opkind::nop;
+                changed = true;
+                continue;
+            }
+            if (instr.kind == Opkind::globalassign && overwritten(instr.gAssign.index)) {
+                instr.kind = Opkind::nop;
+                changed = true;
+                continue;
+            }
+            if (instr.kind == Opkind::call && dest >= 0 && !is_alive(vars.index(dest))) {
+                instr.call.dest = -1;
+                changed = true;
+            }
+
+            if (dest >= 0) {
+                mark(vars.index(dest), false);
+            }
+            if (instr.kind == Opkind::call || instr.kind == Opkind::ret) {
+                stamp++;  // the callee or caller may read any global
+            } else if (instr.kind == Opkind::globalassign) {
+                if (instr.gAssign.index >= (int)global_stamp.size()) {
+                    global_stamp.resize(instr.gAssign.index + 1, 0);
+                }
+                global_stamp[instr.gAssign.index] = stamp;
+            }
+            for_each_operand(prog, instr, [&](const Arg& arg) {
+                if (arg.type == ArgType::Var) {
+                    mark(vars.index(arg.value), true);
+                } else if (arg.type == ArgType::Global && overwritten(arg.value)) {
+                    global_stamp[arg.value] = 0;
+                }
+            });
+        }
+    }
+    return changed;
+}
+
+// Deletes branches to where control would fall anyway, with only labels and deleted code
+// between. Going backwards, a branch that only skipped one of these goes too.
+static bool drop_branches(IrProgram& prog, const Cfg& cfg) {
+    bool changed = false;
+    for (size_t i = cfg.func_end(); i-- > cfg.func_start() + 1;) {
+        inst& instr = prog.code[i];
+        LabelId target;
+        if (instr.kind == Opkind::jump) {
+            target = instr.jump.label;
+        } else if (instr.kind == Opkind::jumpiffalse) {
+            target = instr.jumpiffalse.label;
+        } else {
+            continue;
+        }
+        for (size_t j = i + 1; j < cfg.func_end(); j++) {
+            const inst& next = prog.code[j];
+            if (next.kind == Opkind::label && next.label.label == target) {
+                instr.kind = Opkind::nop;
+                changed = true;
+                break;
+            }
+            if (next.kind != Opkind::label && next.kind != Opkind::nop) {
+                break;
+            }
+        }
+    }
+    return changed;
+}
+
+// Deleting stores can leave a branch with nothing to skip, and deleting a conditional branch
+// can kill its condition, so the two take turns. The Cfg keeps the edges of the dropped
+// branches, which only makes liveness more cautious.
+bool remove_dead_code(IrProgram& prog, const Cfg& cfg, const VarNumbering& vars) {
+    vector<int> global_stamp;
+    int stamp = 0;
+    bool branches = false;
+    for (;;) {
+        while (sweep(prog, cfg, vars, liveness(prog, cfg, vars), global_stamp, stamp)) {
+        }
+        if (!drop_branches(prog, cfg)) {
+            return branches;
+        }
+        branches = true;
+    }
+}
@@ -0,0 +1,209 @@
+#include <cstdint>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+#include "passes.h"
+
+using namespace std;
+
+namespace {
+
+// What an operand is known to be: a literal, or a value number (the SSA value that first
+// computed it). Globals get no number; anything reading one is left alone.
+struct Num {
+    ArgType type;
+    int id;
+    bool operator==(const Num& other) const { return type == other.type && id == other.id; }
+    bool operator<(const Num& other) const {
+        return type != other.type ? type < other.type : id < other.id;
+    }
+};
+
+struct Expr {
+    Opkind kind;
+    uint8_t op;
+    Num a, b, c;
+    bool operator==(const Expr& other) const {
+        return kind == other.kind && op == other.op && a == other.a && b == other.b &&
+               c == other.c;
+    }
+};
+
+struct ExprHash {
+    size_t operator()(const Expr& e) const {
+        size_t h = (size_t)e.kind * 31 + e.op;
+        for (const Num& n : {e.a, e.b, e.c}) {
+            h = h * 1000003 ^ ((size_t)n.type << 32 | (uint32_t)n.id);
+        }
+        return h;
+    }
+};
+
+bool commutative(BinOp op) {
+    switch (op) {
+        case BinOp::Add:
+        case BinOp::Mul:
+        case BinOp::EqualEqual:
+        case BinOp::NotEqual:
+        case BinOp::And:
+        case BinOp::Or:
+            return true;
+        default:
+            return false;
+    }
+}
+
+}  // namespace
+
+// Walks the dominator tree keeping the expressions computed on the way down, so a block sees
+// exactly those of the blocks that dominate it. A recomputation becomes a copy of the earlier
+// result, as long as the variable that result went to has not been written since.
+void number_values(IrProgram& prog, const Cfg& cfg, const VarNumbering& vars,
+                   const SsaForm& ssa) {
+    const vector<BasicBlock>& blocks = cfg.blocks();
+    const vector<SsaValue>& values = ssa.values();
+    if (blocks.empty()) {
+        return;
+    }
+
+    vector<Num> number(values.size());
+    for (size_t v = 0; v < values.size(); v++) {
+        number[v] = {ArgType::Var, (int)v};
+    }
+    // value each variable holds at the current point of the walk, as in SSA renaming
+    vector<int> current(vars.size());
+    for (size_t v = 0; v < vars.size(); v++) {
+        current[v] = (int)v;
+    }
+
+    unordered_map<Expr, int, ExprHash> available;
+    vector<pair<int, int>> undo_current;  // variable, value it held before
+    vector<Expr> undo_available;
+
+    auto set_current = [&](int value) {
+        const int var = values[value].var;
+        undo_current.push_back({var, current[var]});
+        current[var] = value;
+    };
+
+    auto operand = [&](size_t index, int slot, const Arg& arg, Num& num) {
+        if (arg.type == ArgType::Literal) {
+            num = {ArgType::Literal, arg.value};
+            return true;
+        }
+        const int value = arg.type == ArgType::Var ? ssa.use(index, slot) : -1;
+        if (value < 0) {
+            return false;
+        }
+        num = number[value];
+        return true;
+    };
+
+    auto visit = [&](size_t index) {
+        inst& instr = prog.code[index];
+        const int def = ssa.def(index);
+        if (def < 0) {
+            return;
+        }
+
+        const Num none{ArgType::Global, 0};
+        Expr expr{instr.kind, 0, none, none, none};
+        bool known = false;
+        switch (instr.kind) {
+            case Opkind::autoassign:
+                if (operand(index, 0, instr.autoassign.arg, expr.a)) {
+                    number[def] = expr.a;  // a copy is whatever it copies
+                }
+                break;
+            case Opkind::binop:
+                expr.op = (uint8_t)instr.binop.op;
+                known = operand(index, 0, instr.binop.left, expr.a) &&
+                        operand(index, 1, instr.binop.right, expr.b);
+                if (known && commutative(instr.binop.op) && expr.b < expr.a) {
+                    swap(expr.a, expr.b);
+                }
+                break;
+            case Opkind::unaryop:
+                expr.op = (uint8_t)instr.unary.op;
+                known = (instr.unary.op == UnaryOp::Not || instr.unary.op == UnaryOp::Negate) &&
+                        operand(index, 0, instr.unary.operand, expr.a);
+                break;
+            case Opkind::select:
+                known = operand(index, 0, instr.select.condition, expr.a) &&
+                        operand(index, 1, instr.select.if_true, expr.b) &&
+                        operand(index, 2, instr.select.if_false, expr.c);
+                break;
+            default:
+                break;
+        }
+
+        if (known) {
+            auto found = available.find(expr);
+            if (found == available.end()) {
+                available.emplace(expr, def);
+                undo_available.push_back(expr);
+            } else {
+                const int leader = found->second;
+                number[def] = number[leader];
+                if (current[values[leader].var] == leader) {
+                    const Arg copy{ArgType::Var, written_var(prog.code[values[leader].def])};
+                    instr = cAutoAssignOp(written_var(instr), copy);
+                }
+            }
+        }
+        set_current(def);
+    };
+
+    auto enter = [&](int b) {
+        for (int phi : ssa.block_phis(b)) {
+            const Phi& p = ssa.phis()[phi];
+            // a phi whose incoming values are all the same number is that number
+            bool same = true;
+            int first = -1;
+            for (int arg : p.args) {
+                if (arg >= 0 && first == -1) {
+                    first = arg;
+                } else if (arg >= 0 && !(number[arg] == number[first])) {
+                    same = false;
+                }
+            }
+            if (same && first >= 0) {
+                number[p.value] = number[first];
+            }
+            set_current(p.value);
+        }
+        for (size_t i = blocks[b].first; i < blocks[b].end; i++) {
+            visit(i);
+        }
+    };
+
+    struct Frame {
+        int block;
+        size_t next_child;
+        size_t current_mark;
+        size_t available_mark;
+    };
+    vector<Frame> stack;
+    stack.push_back({0, 0, 0, 0});
+    enter(0);
+    while (!stack.empty()) {
+        Frame& top = stack.back();
+        const vector<int>& children = cfg.dom_children(top.block);
+        if (top.next_child < children.size()) {
+            const int child = children[top.next_child++];
+            stack.push_back({child, 0, undo_current.size(), undo_available.size()});
+            enter(child);
+        } else {
+            while (undo_current.size() > top.current_mark) {
+                current[undo_current.back().first] = undo_current.back().second;
+                undo_current.pop_back();
+            }
+            while (undo_available.size() > top.available_mark) {
+                available.erase(undo_available.back());
+                undo_available.pop_back();
+            }
+            stack.pop_back();
+        }
+    }
+}
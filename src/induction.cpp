@@ -0,0 +1,412 @@
+#include <climits>
+#include <cstdint>
+#include <map>
+#include <tuple>
+#include <utility>
+#include <vector>
+
+#include "passes.h"
+
+using namespace std;
+
+namespace {
+
+// A local that each iteration steps by a constant: its phi at the header, and the instructions
+// that take it from there to the value the latches send back, the last of them first.
+struct BasicIv {
+    int phi;    // index in SsaForm::phis()
+    int value;  // of the phi
+    int var;    // as numbered in the IR
+    int64_t step;
+    bool known_start;  // the loop is entered with a literal in it
+    int64_t start;
+    vector<size_t> steps;
+};
+
+// A value known to be scale * iv + offset, for the header value of basic variable `iv`.
+struct Linear {
+    int iv = -1;
+    int64_t scale = 0;
+    int64_t offset = 0;
+};
+
+bool fits(int64_t value) {
+    return value >= INT_MIN && value <= INT_MAX;
+}
+
+Arg var_arg(int var) {
+    return {ArgType::Var, var};
+}
+
+}  // namespace
+
+// Follows the value a loop's latches send back to the phi of its header, through copies and
+// additions of constants, until it arrives at the phi itself.
+static bool basic_iv(const IrProgram& prog, const Cfg& cfg, const SsaForm& ssa, int index,
+                     int l, BasicIv& iv) {
+    const Phi& phi = ssa.phis()[index];
+    const vector<int>& preds = cfg.blocks()[phi.block].preds;
+    int latch = -1;
+    iv.known_start = false;
+    for (size_t p = 0; p < preds.size(); p++) {
+        if (!cfg.in_loop(preds[p], l)) {
+            const int value = phi.args[p];
+            if (value >= 0 && ssa.values()[value].kind == ValueKind::Inst) {
+                const inst& def = prog.code[ssa.values()[value].def];
+                iv.known_start = def.kind == Opkind::autoassign &&
+                                 def.autoassign.arg.type == ArgType::Literal;
+                iv.start = def.autoassign.arg.value;
+            }
+            continue;
+        }
+        if (phi.args[p] < 0 || (latch >= 0 && phi.args[p] != latch)) {
+            return false;
+        }
+        latch = phi.args[p];
+    }
+
+    iv.phi = index;
+    iv.value = phi.value;
+    iv.step = 0;
+    iv.steps.clear();
+    for (int value = latch; value != phi.value;) {
+        if (value < 0 || ssa.values()[value].kind != ValueKind::Inst) {
+            return false;
+        }
+        const SsaValue& def = ssa.values()[value];
+        const inst& instr = prog.code[def.def];
+        int64_t step = 0;
+        int from = -1;
+        if (instr.kind == Opkind::autoassign && instr.autoassign.arg.type == ArgType::Var) {
+            from = ssa.use(def.def, 0);
+        } else if (instr.kind == Opkind::binop && (instr.binop.op == BinOp::Add ||
+                                                   instr.binop.op == BinOp::Sub)) {
+            const Arg& left = instr.binop.left;
+            const Arg& right = instr.binop.right;
+            if (left.type == ArgType::Var && right.type == ArgType::Literal) {
+                from = ssa.use(def.def, 0);
+                step = instr.binop.op == BinOp::Add ? right.value : -(int64_t)right.value;
+            } else if (instr.binop.op == BinOp::Add && left.type == ArgType::Literal &&
+                       right.type == ArgType::Var) {
+                from = ssa.use(def.def, 1);
+                step = left.value;
+            }
+        } else if (instr.kind == Opkind::update && instr.update.dest.type == ArgType::Var &&
+                   instr.update.value.type == ArgType::Literal &&
+                   (instr.update.op == BinOp::Add || instr.update.op == BinOp::Sub)) {
+            from = ssa.use(def.def, 0);
+            step = instr.update.op == BinOp::Add ? instr.update.value.value
+                                                 : -(int64_t)instr.update.value.value;
+        }
+        if (from < 0 || !fits(iv.step + step)) {
+            return false;
+        }
+        iv.step += step;
+        iv.steps.push_back(def.def);
+        value = from;
+    }
+    iv.var = written_var(prog.code[iv.steps.empty() ? 0 : iv.steps.front()]);
+    return !iv.steps.empty() && iv.step != 0;
+}
+
+// Whether the comparison at `index` decides, in the header of loop `l`, if the loop ends.
+static bool exit_test(const IrProgram& prog, const Cfg& cfg, const SsaForm& ssa, size_t index,
+                      int l) {
+    const int header = cfg.loops()[l].header;
+    if (cfg.block_of(index) != header) {
+        return false;
+    }
+    const SsaUsers users = ssa.users(ssa.def(index));
+    if (users.end() - users.begin() != 1 || *users.begin() < 0) {
+        return false;
+    }
+    const size_t branch = cfg.func_start() + *users.begin();
+    const inst& instr = prog.code[branch];
+    return instr.kind == Opkind::jumpiffalse && cfg.block_of(branch) == header &&
+           !cfg.in_loop(cfg.label_block(instr.jumpiffalse.label), l);
+}
+
+// Each reduced expression gets its own variable, which holds scale * iv + offset from the top
+// of every iteration until the step of iv, where it is stepped as well. So an instruction can
+// only read it if it runs before that step: the step's block dominates everything in the loop
+// that comes after it, as nothing else leads back around without passing the header.
+bool reduce_induction_variables(IrProgram& prog, const Cfg& cfg, const VarNumbering& vars,
+                                const SsaForm& ssa) {
+    const vector<BasicBlock>& blocks = cfg.blocks();
+    const vector<NaturalLoop>& loops = cfg.loops();
+    const vector<SsaValue>& values = ssa.values();
+    const size_t start = cfg.func_start();
+
+    int next_var = first_free_var(prog, cfg, vars);
+
+    vector<pair<size_t, inst>> inserts;
+    vector<bool> rewritten(cfg.func_end() - start, false);
+    vector<Linear> linear(values.size());
+    for (size_t l = 0; l < loops.size(); l++) {
+        const size_t entry = loop_preheader(prog, cfg, (int)l);
+        if (entry == 0) {
+            continue;
+        }
+        vector<BasicIv> ivs;
+        BasicIv iv;
+        for (int phi : ssa.block_phis(loops[l].header)) {
+            if (basic_iv(prog, cfg, ssa, phi, (int)l, iv)) {
+                linear[iv.value] = {(int)ivs.size(), 1, 0};
+                ivs.push_back(iv);
+            }
+        }
+        if (ivs.empty()) {
+            continue;
+        }
+        auto before_step = [&](size_t index, const BasicIv& iv) {
+            const int b = cfg.block_of(index);
+            const int step_block = cfg.block_of(iv.steps.front());
+            return b == step_block ? index < iv.steps.front() : !cfg.dominates(step_block, b);
+        };
+
+        // Linear values in the loop, in an order that has definitions ahead of their uses.
+        // Candidates are the multiplications and what is computed from them before the step.
+        vector<size_t> candidates;
+        vector<int> touched;
+        for (int b : cfg.rpo()) {
+            if (!cfg.in_loop(b, (int)l)) {
+                continue;
+            }
+            for (size_t i = blocks[b].first; i < blocks[b].end; i++) {
+                const inst& instr = prog.code[i];
+                const int def = ssa.def(i);
+                if (def < 0 || rewritten[i - start]) {
+                    continue;
+                }
+                Linear result;
+                auto operand = [&](int slot, const Arg& arg, Linear& lin, int64_t& constant) {
+                    if (arg.type == ArgType::Literal) {
+                        constant = arg.value;
+                        return false;
+                    }
+                    const int value = arg.type == ArgType::Var ? ssa.use(i, slot) : -1;
+                    if (value >= 0) {
+                        lin = linear[value];
+                    }
+                    return true;
+                };
+                if (instr.kind == Opkind::autoassign) {
+                    int64_t constant = 0;
+                    operand(0, instr.autoassign.arg, result, constant);
+                } else if (instr.kind == Opkind::binop) {
+                    Linear lin;
+                    int64_t constant = 0;
+                    const bool left = operand(0, instr.binop.left, lin, constant);
+                    const bool right = operand(1, instr.binop.right, lin, constant);
+                    if (left == right || lin.iv < 0) {
+                        continue;
+                    }
+                    int64_t scale = 1, offset = 0;
+                    switch (instr.binop.op) {
+                        case BinOp::Mul:
+                            scale = constant;
+                            break;
+                        case BinOp::Shl:
+                            if (!left || constant < 0 || constant > 30) {
+                                continue;
+                            }
+                            scale = (int64_t)1 << constant;
+                            break;
+                        case BinOp::Add:
+                            offset = constant;
+                            break;
+                        case BinOp::Sub:
+                            if (!left) {
+                                continue;
+                            }
+                            offset = -constant;
+                            break;
+                        default:
+                            continue;
+                    }
+                    result = {lin.iv, lin.scale * scale, lin.offset * scale + offset};
+                    if (!fits(result.scale) || !fits(result.offset) || result.scale == 0) {
+                        continue;
+                    }
+                    if (result.scale != 1 && before_step(i, ivs[lin.iv])) {
+                        candidates.push_back(i);
+                    }
+                }
+                if (result.iv >= 0) {
+                    linear[def] = result;
+                    touched.push_back(def);
+                }
+            }
+        }
+
+        // A candidate whose value only goes into other candidates dies once they are reduced,
+        // so only those that are read by something else get a variable of their own
+        vector<bool> candidate(cfg.func_end() - start, false);
+        for (size_t i : candidates) {
+            candidate[i - start] = true;
+        }
+        auto escapes = [&](int value) {
+            vector<int> work{value};
+            while (!work.empty()) {
+                const int v = work.back();
+                work.pop_back();
+                for (int user : ssa.users(v)) {
+                    if (user < 0) {
+                        return true;
+                    }
+                    const inst& instr = prog.code[start + user];
+                    if (instr.kind == Opkind::autoassign) {
+                        work.push_back(ssa.def(start + user));
+                    } else if (!candidate[user]) {
+                        return true;
+                    }
+                }
+            }
+            return false;
+        };
+
+        map<tuple<int, int64_t, int64_t>, int> reduced;
+        vector<int> counter(ivs.size(), -1);  // a reduced variable with a positive scale
+        for (size_t i : candidates) {
+            const Linear& lin = linear[ssa.def(i)];
+            const BasicIv& base = ivs[lin.iv];
+            if (!fits(lin.scale * base.step) || !escapes(ssa.def(i))) {
+                continue;
+            }
+            auto key = make_tuple(lin.iv, lin.scale, lin.offset);
+            auto found = reduced.find(key);
+            if (found == reduced.end()) {
+                found = reduced.emplace(key, next_var++).first;
+                const Arg var{ArgType::Var, found->second};
+                const int64_t first = base.start * lin.scale + lin.offset;
+                if (base.known_start && fits(first)) {
+                    inserts.push_back(
+                        {entry, cAutoAssignOp(var.value, {ArgType::Literal, (int)first})});
+                } else {
+                    inserts.push_back({entry, cBinopOp(var.value, {ArgType::Var, base.var},
+                                                       {ArgType::Literal, (int)lin.scale},
+                                                       BinOp::Mul)});
+                    if (lin.offset != 0) {
+                        inserts.push_back({entry, cUpdateOp(var, {ArgType::Literal,
+                                                                  (int)lin.offset},
+                                                            BinOp::Add)});
+                    }
+                }
+                inserts.push_back(
+                    {base.steps.front() + 1,
+                     cUpdateOp(var, {ArgType::Literal, (int)(lin.scale * base.step)}, BinOp::Add)});
+                if (lin.scale > 0 && counter[lin.iv] == -1) {
+                    counter[lin.iv] = found->second;
+                }
+            }
+            prog.code[i] = cAutoAssignOp(written_var(prog.code[i]), var_arg(found->second));
+            rewritten[i - start] = true;
+        }
+
+        // Candidates left as they were that only feed rewritten ones, through copies, are dead
+        // now. Users come later in the order candidates were found, so they are settled first.
+        vector<bool> dead(cfg.func_end() - start, false);
+        for (size_t c = candidates.size(); c-- > 0;) {
+            const size_t i = candidates[c];
+            if (rewritten[i - start]) {
+                continue;
+            }
+            bool feeds_only_dead = true;
+            vector<int> work{ssa.def(i)};
+            while (!work.empty() && feeds_only_dead) {
+                const int v = work.back();
+                work.pop_back();
+                for (int user : ssa.users(v)) {
+                    if (user >= 0 && prog.code[start + user].kind == Opkind::autoassign &&
+                        !rewritten[user]) {
+                        work.push_back(ssa.def(start + user));
+                    } else if (user < 0 || !(rewritten[user] || dead[user])) {
+                        feeds_only_dead = false;
+                    }
+                }
+            }
+            dead[i - start] = feeds_only_dead;
+        }
+
+        // Linear function test replacement. When the header tests i against a literal bound on
+        // the way out, i starts from a literal and steps up, then i stays well inside 32 bits, so
+        // scale * i + offset cannot wrap. Any i < n in the loop with a literal n then holds
+        // exactly when scale * i + offset < scale * n + offset does.
+        for (size_t k = 0; k < ivs.size(); k++) {
+            const BasicIv& base = ivs[k];
+            if (counter[k] == -1 || !base.known_start || base.step <= 0) {
+                continue;
+            }
+            int64_t scale = 0, offset = 0;
+            for (const auto& [key, var] : reduced) {
+                if (var == counter[k]) {
+                    scale = get<1>(key);
+                    offset = get<2>(key);
+                }
+            }
+            vector<bool> step(cfg.func_end() - start, false);
+            for (size_t i : base.steps) {
+                step[i - start] = true;
+            }
+
+            bool alone = true;
+            bool bounded = false;
+            vector<size_t> tests;
+            for (int user : ssa.users(base.value)) {
+                if (user < 0) {
+                    alone = false;
+                    break;
+                }
+                const size_t i = start + user;
+                const inst& instr = prog.code[i];
+                if (step[user] || rewritten[user] || dead[user]) {
+                    continue;
+                }
+                const bool test = instr.kind == Opkind::binop &&
+                                  (instr.binop.op == BinOp::Less ||
+                                   instr.binop.op == BinOp::LessEqual) &&
+                                  instr.binop.left.type == ArgType::Var &&
+                                  ssa.use(i, 0) == base.value &&
+                                  instr.binop.right.type == ArgType::Literal &&
+                                  cfg.in_loop(cfg.block_of(i), (int)l);
+                const int64_t bound = test ? instr.binop.right.value : 0;
+                if (!test || !fits(bound + base.step) || !fits(bound * scale + offset)) {
+                    alone = false;
+                    break;
+                }
+                tests.push_back(i);
+                bounded |= exit_test(prog, cfg, ssa, i, (int)l);
+            }
+            // the values along the step go nowhere but the next step and back to the phi
+            for (size_t i : base.steps) {
+                for (int user : ssa.users(ssa.def(i))) {
+                    alone &= user == ~base.phi || (user >= 0 && step[user]);
+                }
+            }
+            if (!alone || !bounded) {
+                continue;
+            }
+            for (size_t i : tests) {
+                inst& instr = prog.code[i];
+                instr.binop.left = var_arg(counter[k]);
+                instr.binop.right.value = (int)(instr.binop.right.value * scale + offset);
+            }
+            for (size_t i : base.steps) {
+                prog.code[i].kind = Opkind::nop;
+            }
+        }
+
+        for (int value : touched) {
+            linear[value] = Linear();
+        }
+        for (const BasicIv& base : ivs) {
+            linear[base.value] = Linear();
+        }
+    }
+
+    if (inserts.empty()) {
+        return false;
+    }
+    insert_code(prog, std::move(inserts));
+    return true;
+}
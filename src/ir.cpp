@@ -1,5 +1,7 @@
 #include "ir.h"
 
+#include <algorithm>
+#include <charconv>
 #include <fstream>
 #include <iostream>
 #include <sstream>
@@ -8,13 +10,58 @@
 #include <vector>
 
 #include "Parser.h"
+#include "cfg.h"
+#include "dataflow.h"
+#include "passes.h"
+#include "ssa.h"
 
 using namespace std;
 
-// Forward declaration for recursive statement processing
-void stmt_to_ir(const NodeStmt* stmt, vector<inst>& ir, unordered_map<string, int>& var_map,
-                unordered_map<string, int>& global_var_map,
-                unordered_map<string, bool>& is_external_map, int& next_temp_var);
+// Integer bindings per identifier (local slot, global slot, extern flag), indexed by SymbolId.
+// clear() only resets the slots that were bound, so one table is reused across functions.
+// The slots grow from the ids alone: with -stream-tokens the lexer thread is still interning
+// while statements are lowered, so the symbol table's size must not be read here.
+struct SymbolSlots {
+    vector<int> slots;
+    vector<SymbolId> bound;
+
+    int get(SymbolId id, int unbound = -1) const {
+        return id < slots.size() && slots[id] != -1 ? slots[id] : unbound;
+    }
+    bool has(SymbolId id) const {
+        return get(id) != -1;
+    }
+    void set(SymbolId id, int value) {
+        if (id >= slots.size()) {
+            slots.resize(max<size_t>(id + 1, slots.size() * 2), -1);
+        }
+        if (slots[id] == -1) {
+            bound.push_back(id);
+        }
+        slots[id] = value;
+    }
+    void clear() {
+        for (SymbolId id : bound) {
+            slots[id] = -1;
+        }
+        bound.clear();
+    }
+};
+
+// Forward declarations for recursive statement and expression processing
+void stmt_to_ir(const NodeStmt* stmt, string_view src, IrProgram& ir, SymbolSlots& var_map,
+                SymbolSlots& global_var_map, SymbolSlots& is_external_map,
+                vector<LabelId>& break_labels, int& next_temp_var);
+Arg expr_to_arg(const NodeExpr* expr, string_view src, IrProgram& ir, SymbolSlots& var_map,
+                SymbolSlots& global_var_map, int& next_temp_var);
+
+inst cFuncOp(SymbolId name, int params) {
+    inst istr;
+    istr.kind = Opkind::function;
+    istr.func.name = name;
+    istr.func.params = params;
+    return istr;
+}
 
 inst cAutoVar(int count) {
     inst istr;
@@ -31,15 +78,7 @@ inst cAutoAssignOp(int index, const Arg& arg) {
     return istr;
 }
 
-inst cFunCallOp(const string& name, const optional<Arg>& arg) {
-    inst istr;
-    istr.kind = Opkind::funcall;
-    istr.funcall.name = name;
-    istr.funcall.arg = arg;
-    return istr;
-}
-
-inst cExternVarOp(const string& name) {
+inst cExternVarOp(SymbolId name) {
     inst istr;
     istr.kind = Opkind::externvar;
     istr.externvar.name = name;
@@ -80,21 +119,40 @@ inst cUnaryOp(int dest, const Arg& operand, UnaryOp op) {
     return istr;
 }
 
-inst cLabelOp(const string& name) {
+inst cUpdateOp(const Arg& dest, const Arg& value, BinOp op) {
+    inst istr;
+    istr.kind = Opkind::update;
+    istr.update.dest = dest;
+    istr.update.value = value;
+    istr.update.op = op;
+    return istr;
+}
+
+inst cSelectOp(int dest, const Arg& condition, const Arg& if_true, const Arg& if_false) {
+    inst istr;
+    istr.kind = Opkind::select;
+    istr.select.dest = dest;
+    istr.select.condition = condition;
+    istr.select.if_true = if_true;
+    istr.select.if_false = if_false;
+    return istr;
+}
+
+inst cLabelOp(LabelId label) {
     inst istr;
     istr.kind = Opkind::label;
-    istr.label.name = name;
+    istr.label.label = label;
     return istr;
 }
 
-inst cJumpOp(const string& label) {
+inst cJumpOp(LabelId label) {
     inst istr;
     istr.kind = Opkind::jump;
     istr.jump.label = label;
     return istr;
 }
 
-inst cJumpIfFalseOp(const string& label, const Arg& condition) {
+inst cJumpIfFalseOp(LabelId label, const Arg& condition) {
     inst istr;
     istr.kind = Opkind::jumpiffalse;
     istr.jumpiffalse.label = label;
@@ -102,25 +160,41 @@ inst cJumpIfFalseOp(const string& label, const Arg& condition) {
     return istr;
 }
 
-inst cCallOp(const string& function, const vector<Arg>& args, int dest) {
+inst cJumpTableOp(const Arg& value, int low, int table) {
+    inst istr;
+    istr.kind = Opkind::jumptable;
+    istr.jumptable.value = value;
+    istr.jumptable.low = low;
+    istr.jumptable.table = table;
+    return istr;
+}
+
+inst cCallOp(SymbolId function, uint32_t first_arg, uint32_t arg_count, int dest) {
     inst istr;
     istr.kind = Opkind::call;
     istr.call.function = function;
-    istr.call.args = args;
     istr.call.dest = dest;
+    istr.call.first_arg = first_arg;
+    istr.call.arg_count = arg_count;
     return istr;
 }
 
 inst cRetOp(const optional<Arg>& value) {
     inst istr;
     istr.kind = Opkind::ret;
-    istr.ret.value = value;
+    istr.ret.has_value = value.has_value();
+    istr.ret.value = value.value_or(Arg{ArgType::Literal, 0});
     return istr;
 }
 
-void Pir(const vector<inst>& inst) {
-    for (const auto& instr : inst) {
+void Pir(const IrProgram& ir) {
+    const SymbolTable& symbols = SymbolTable::instance();
+    for (const auto& instr : ir.code) {
         switch (instr.kind) {
+            case Opkind::function:
+                cout << "Function :  " << symbols.name(instr.func.name) << " "
+                     << instr.func.params << endl;
+                break;
             case Opkind::autovar:
                 cout << "Autovar :  " << instr.autovar.count << endl;
                 break;
@@ -135,22 +209,8 @@ void Pir(const vector<inst>& inst) {
                 }
                 cout << endl;
                 break;
-            case Opkind::funcall:
-                cout << "Funcall :  " << instr.funcall.name;
-                if (instr.funcall.arg.has_value()) {
-                    cout << " ";
-                    if (instr.funcall.arg.value().type == ArgType::Var) {
-                        cout << "v(" << instr.funcall.arg.value().value << ")";
-                    } else if (instr.funcall.arg.value().type == ArgType::Global) {
-                        cout << "g(" << instr.funcall.arg.value().value << ")";
-                    } else {
-                        cout << instr.funcall.arg.value().value;
-                    }
-                }
-                cout << endl;
-                break;
             case Opkind::externvar:
-                cout << "Externvar :  " << instr.externvar.name << endl;
+                cout << "Externvar :  " << symbols.name(instr.externvar.name) << endl;
                 break;
             case Opkind::binop: {
                 cout << "Binop :  " << instr.binop.dest << " ";
@@ -266,14 +326,62 @@ void Pir(const vector<inst>& inst) {
                 }
                 cout << endl;
                 break;
+            case Opkind::update:
+                cout << "Update :  ";
+                if (instr.update.dest.type == ArgType::Global) {
+                    cout << "g(" << instr.update.dest.value << ")";
+                } else {
+                    cout << "v(" << instr.update.dest.value << ")";
+                }
+                cout << " ";
+                if (instr.update.value.type == ArgType::Var) {
+                    cout << "v(" << instr.update.value.value << ")";
+                } else if (instr.update.value.type == ArgType::Global) {
+                    cout << "g(" << instr.update.value.value << ")";
+                } else {
+                    cout << instr.update.value.value;
+                }
+                switch (instr.update.op) {
+                    case BinOp::Add:
+                        cout << " add()";
+                        break;
+                    case BinOp::Sub:
+                        cout << " sub()";
+                        break;
+                    case BinOp::Shl:
+                        cout << " shl()";
+                        break;
+                    case BinOp::Shr:
+                        cout << " shr()";
+                        break;
+                    default:
+                        break;
+                }
+                cout << endl;
+                break;
+            case Opkind::select:
+                cout << "Select :  " << instr.select.dest;
+                for (const Arg* arg :
+                     {&instr.select.condition, &instr.select.if_true, &instr.select.if_false}) {
+                    cout << " ";
+                    if (arg->type == ArgType::Var) {
+                        cout << "v(" << arg->value << ")";
+                    } else if (arg->type == ArgType::Global) {
+                        cout << "g(" << arg->value << ")";
+                    } else {
+                        cout << arg->value;
+                    }
+                }
+                cout << endl;
+                break;
             case Opkind::label:
-                cout << "Label :  " << instr.label.name << endl;
+                cout << "Label :  " << ir.label_name(instr.label.label) << endl;
                 break;
             case Opkind::jump:
-                cout << "Jump :  " << instr.jump.label << endl;
+                cout << "Jump :  " << ir.label_name(instr.jump.label) << endl;
                 break;
             case Opkind::jumpiffalse:
-                cout << "JumpIfFalse :  " << instr.jumpiffalse.label << " ";
+                cout << "JumpIfFalse :  " << ir.label_name(instr.jumpiffalse.label) << " ";
                 if (instr.jumpiffalse.condition.type == ArgType::Var) {
                     cout << "v(" << instr.jumpiffalse.condition.value << ")";
                 } else if (instr.jumpiffalse.condition.type == ArgType::Global) {
@@ -283,9 +391,28 @@ void Pir(const vector<inst>& inst) {
                 }
                 cout << endl;
                 break;
+            case Opkind::jumptable: {
+                const JumpTable& table = ir.jump_tables[instr.jumptable.table];
+                cout << "JumpTable :  ";
+                if (instr.jumptable.value.type == ArgType::Var) {
+                    cout << "v(" << instr.jumptable.value.value << ")";
+                } else if (instr.jumptable.value.type == ArgType::Global) {
+                    cout << "g(" << instr.jumptable.value.value << ")";
+                } else {
+                    cout << instr.jumptable.value.value;
+                }
+                cout << " " << instr.jumptable.low << " [";
+                for (size_t t = 0; t < table.targets.size(); t++) {
+                    cout << (t ? " " : "") << ir.label_name(table.targets[t]);
+                }
+                cout << "] " << ir.label_name(table.default_label) << endl;
+                break;
+            }
             case Opkind::call:
-                cout << "Call :  " << instr.call.function << " -> " << instr.call.dest;
-                for (const auto& arg : instr.call.args) {
+                cout << "Call :  " << symbols.name(instr.call.function) << " -> "
+                     << instr.call.dest;
+                for (uint32_t a = 0; a < instr.call.arg_count; a++) {
+                    const Arg& arg = ir.args(instr.call)[a];
                     cout << " ";
                     if (arg.type == ArgType::Var) {
                         cout << "v(" << arg.value << ")";
@@ -299,101 +426,297 @@ void Pir(const vector<inst>& inst) {
                 break;
             case Opkind::ret:
                 cout << "Return";
-                if (instr.ret.value.has_value()) {
+                if (instr.ret.has_value) {
                     cout << " ";
-                    if (instr.ret.value.value().type == ArgType::Var) {
-                        cout << "v(" << instr.ret.value.value().value << ")";
-                    } else if (instr.ret.value.value().type == ArgType::Global) {
-                        cout << "g(" << instr.ret.value.value().value << ")";
+                    if (instr.ret.value.type == ArgType::Var) {
+                        cout << "v(" << instr.ret.value.value << ")";
+                    } else if (instr.ret.value.type == ArgType::Global) {
+                        cout << "g(" << instr.ret.value.value << ")";
                     } else {
-                        cout << instr.ret.value.value().value;
+                        cout << instr.ret.value.value;
                     }
                 }
                 cout << endl;
                 break;
+            case Opkind::nop:
+                cout << "Nop" << endl;
+                break;
+        }
+    }
+}
+
+// AST binary operator -> IR binary operator
+static BinOp lower_binop(BinOpType type) {
+    switch (type) {
+        case BinOpType::Add:
+            return BinOp::Add;
+        case BinOpType::Sub:
+            return BinOp::Sub;
+        case BinOpType::Mul:
+            return BinOp::Mul;
+        case BinOpType::Div:
+            return BinOp::Div;
+        case BinOpType::Mod:
+            return BinOp::Mod;
+        case BinOpType::EqualEqual:
+            return BinOp::EqualEqual;
+        case BinOpType::NotEqual:
+            return BinOp::NotEqual;
+        case BinOpType::Less:
+            return BinOp::Less;
+        case BinOpType::LessEqual:
+            return BinOp::LessEqual;
+        case BinOpType::Greater:
+            return BinOp::Greater;
+        case BinOpType::GreaterEqual:
+            return BinOp::GreaterEqual;
+        case BinOpType::And:
+            return BinOp::And;
+        case BinOpType::Or:
+            return BinOp::Or;
+        case BinOpType::Shl:
+            return BinOp::Shl;
+        case BinOpType::Shr:
+            return BinOp::Shr;
+    }
+    return BinOp::Add;
+}
+
+// True if evaluating expr can't trap, so it may run even when its value ends up unused. Only
+// calls and division or modulo by something other than a non-zero literal are unsafe.
+static bool can_speculate(const NodeExpr* expr, string_view src) {
+    switch (expr->type) {
+        case ExprType::IntLit:
+        case ExprType::Ident:
+            return true;
+        case ExprType::Call:
+            return false;  // may have side effects or not return at all
+        case ExprType::UnaryOp:
+            return can_speculate(expr->as<NodeUnaryExpr>()->operand, src);
+        case ExprType::Ternary: {
+            const NodeTernary* ternary = expr->as<NodeTernary>();
+            return can_speculate(ternary->condition, src) && can_speculate(ternary->if_true, src) &&
+                   can_speculate(ternary->if_false, src);
+        }
+        case ExprType::BinaryOp: {
+            const NodeBinExpr* bin = expr->as<NodeBinExpr>();
+            if (bin->op == BinOpType::Div || bin->op == BinOpType::Mod) {
+                if (bin->right->type != ExprType::IntLit) {
+                    return false;
+                }
+                const string_view text = token_text(src, bin->right->as<NodeTerm>()->token);
+                int divisor = 0;
+                from_chars(text.data(), text.data() + text.size(), divisor);
+                if (divisor == 0) {
+                    return false;
+                }
+            }
+            return can_speculate(bin->left, src) && can_speculate(bin->right, src);
         }
     }
+    return false;
+}
+
+// result = condition ? make_true() : make_false(). When both values are safe to compute up
+// front a select picks one of them; otherwise only the chosen one is computed, behind a branch.
+template <typename MakeTrue, typename MakeFalse>
+static Arg emit_choice(const Arg& condition, bool speculate, MakeTrue make_true,
+                       MakeFalse make_false, IrProgram& ir, int& next_temp_var) {
+    Arg result;
+    result.type = ArgType::Var;
+    if (speculate) {
+        Arg if_true = make_true();
+        Arg if_false = make_false();
+        result.value = next_temp_var++;
+        ir.emit(cSelectOp(result.value, condition, if_true, if_false));
+        return result;
+    }
+
+    const LabelId else_label = ir.new_label("ternary_else_", LabelKind::Merge);
+    const LabelId end_label = ir.new_label("ternary_end_", LabelKind::Merge);
+    result.value = next_temp_var++;
+    ir.emit(cJumpIfFalseOp(else_label, condition));
+    Arg if_true = make_true();
+    ir.emit(cAutoAssignOp(result.value, if_true));
+    ir.emit(cJumpOp(end_label));
+    ir.emit(cLabelOp(else_label));
+    Arg if_false = make_false();
+    ir.emit(cAutoAssignOp(result.value, if_false));
+    ir.emit(cLabelOp(end_label));
+    return result;
 }
 
-Arg expr_to_arg(const NodeExpr* expr, vector<inst>& ir, unordered_map<string, int>& var_map,
-                unordered_map<string, int>& global_var_map, int& next_temp_var) {
+// Comparisons, ! and the logical operators already yield 0 or 1.
+static bool yields_bool(const NodeExpr* expr) {
+    if (expr->type == ExprType::UnaryOp) {
+        return expr->as<NodeUnaryExpr>()->op == UnaryOpType::Not;
+    }
+    if (expr->type != ExprType::BinaryOp) {
+        return false;
+    }
+    switch (expr->as<NodeBinExpr>()->op) {
+        case BinOpType::EqualEqual:
+        case BinOpType::NotEqual:
+        case BinOpType::Less:
+        case BinOpType::LessEqual:
+        case BinOpType::Greater:
+        case BinOpType::GreaterEqual:
+        case BinOpType::And:
+        case BinOpType::Or:
+            return true;
+        default:
+            return false;
+    }
+}
+
+// expr normalised to 0/1
+static Arg bool_to_arg(const NodeExpr* expr, string_view src, IrProgram& ir,
+                       SymbolSlots& var_map, SymbolSlots& global_var_map, int& next_temp_var) {
+    Arg value = expr_to_arg(expr, src, ir, var_map, global_var_map, next_temp_var);
+    if (value.type == ArgType::Literal) {
+        value.value = value.value != 0;
+        return value;
+    }
+    if (yields_bool(expr)) {
+        return value;
+    }
+
+    Arg zero;
+    zero.type = ArgType::Literal;
+    zero.value = 0;
+    Arg result;
+    result.type = ArgType::Var;
+    result.value = next_temp_var++;
+    ir.emit(cBinopOp(result.value, value, zero, BinOp::NotEqual));
+    return result;
+}
+
+// `a && b` is `a ? (b != 0) : 0` and `a || b` is `a ? 1 : (b != 0)`, so the right operand only
+// runs when the left one doesn't already decide the result (or when it is safe to speculate).
+static Arg logic_to_arg(const NodeBinExpr* bin, string_view src, IrProgram& ir,
+                        SymbolSlots& var_map, SymbolSlots& global_var_map, int& next_temp_var) {
+    const bool is_and = bin->op == BinOpType::And;
+    Arg left = expr_to_arg(bin->left, src, ir, var_map, global_var_map, next_temp_var);
+
+    Arg decided;
+    decided.type = ArgType::Literal;
+    decided.value = is_and ? 0 : 1;
+    if (left.type == ArgType::Literal) {
+        if ((left.value != 0) != is_and) {
+            return decided;
+        }
+        return bool_to_arg(bin->right, src, ir, var_map, global_var_map, next_temp_var);
+    }
+
+    auto right = [&] {
+        return bool_to_arg(bin->right, src, ir, var_map, global_var_map, next_temp_var);
+    };
+    auto fixed = [&] { return decided; };
+    const bool speculate = can_speculate(bin->right, src);
+    if (is_and) {
+        return emit_choice(left, speculate, right, fixed, ir, next_temp_var);
+    }
+    return emit_choice(left, speculate, fixed, right, ir, next_temp_var);
+}
+
+// Evaluates call arguments left to right and emits the call; dest -1 drops the result.
+static void call_to_ir(SymbolId function, const ArenaSpan<NodeExpr*>& arg_exprs, int dest,
+                       string_view src, IrProgram& ir, SymbolSlots& var_map,
+                       SymbolSlots& global_var_map, int& next_temp_var) {
+    // nested calls append their own arguments while these are evaluated, so collect first
+    vector<Arg> args;
+    args.reserve(arg_exprs.size());
+    for (const NodeExpr* arg_expr : arg_exprs) {
+        args.push_back(expr_to_arg(arg_expr, src, ir, var_map, global_var_map, next_temp_var));
+    }
+    const uint32_t first_arg = ir.call_args.size();
+    ir.call_args.insert(ir.call_args.end(), args.begin(), args.end());
+    ir.emit(cCallOp(function, first_arg, args.size(), dest));
+}
+
+Arg expr_to_arg(const NodeExpr* expr, string_view src, IrProgram& ir, SymbolSlots& var_map,
+                SymbolSlots& global_var_map, int& next_temp_var) {
     if (expr->type == ExprType::IntLit) {
+        const string_view text = token_text(src, expr->as<NodeTerm>()->token);
         Arg arg;
         arg.type = ArgType::Literal;
-        arg.value = stoi(expr->token.value.value());
+        arg.value = 0;
+        // the parser has checked that it fits
+        from_chars(text.data(), text.data() + text.size(), arg.value);
         return arg;
     } else if (expr->type == ExprType::Ident) {
-        string ident_name = expr->token.value.value();
+        const SymbolId sym = expr->as<NodeTerm>()->token.sym;
         Arg arg;
 
-        if (global_var_map.find(ident_name) != global_var_map.end()) {
+        if (global_var_map.has(sym)) {
             arg.type = ArgType::Global;
-            arg.value = global_var_map[ident_name];
+            arg.value = global_var_map.get(sym);
         } else {
             arg.type = ArgType::Var;
-            arg.value = var_map[ident_name];
+            arg.value = var_map.get(sym, 0);
         }
         return arg;
     } else if (expr->type == ExprType::BinaryOp) {
-        Arg left = expr_to_arg(expr->left, ir, var_map, global_var_map, next_temp_var);
-        Arg right = expr_to_arg(expr->right, ir, var_map, global_var_map, next_temp_var);
+        const NodeBinExpr* bin = expr->as<NodeBinExpr>();
+        if (bin->op == BinOpType::And || bin->op == BinOpType::Or) {
+            return logic_to_arg(bin, src, ir, var_map, global_var_map, next_temp_var);
+        }
+        Arg left = expr_to_arg(bin->left, src, ir, var_map, global_var_map, next_temp_var);
+        Arg right = expr_to_arg(bin->right, src, ir, var_map, global_var_map, next_temp_var);
 
-        BinOp op;
-        switch (expr->bin_op) {
-            case BinOpType::Add:
-                op = BinOp::Add;
-                break;
-            case BinOpType::Sub:
-                op = BinOp::Sub;
-                break;
-            case BinOpType::Mul:
-                op = BinOp::Mul;
-                break;
-            case BinOpType::Div:
-                op = BinOp::Div;
-                break;
-            case BinOpType::Mod:
-                op = BinOp::Mod;
-                break;
-            case BinOpType::EqualEqual:
-                op = BinOp::EqualEqual;
-                break;
-            case BinOpType::NotEqual:
-                op = BinOp::NotEqual;
-                break;
-            case BinOpType::Less:
-                op = BinOp::Less;
-                break;
-            case BinOpType::LessEqual:
-                op = BinOp::LessEqual;
-                break;
-            case BinOpType::Greater:
-                op = BinOp::Greater;
-                break;
-            case BinOpType::GreaterEqual:
-                op = BinOp::GreaterEqual;
-                break;
-            case BinOpType::And:
-                op = BinOp::And;
-                break;
-            case BinOpType::Or:
-                op = BinOp::Or;
-                break;
-            case BinOpType::Shl:
-                op = BinOp::Shl;
-                break;
-            case BinOpType::Shr:
-                op = BinOp::Shr;
-                break;
+        int temp_var = next_temp_var++;
+        ir.emit(cBinopOp(temp_var, left, right, lower_binop(bin->op)));
+
+        Arg result;
+        result.type = ArgType::Var;
+        result.value = temp_var;
+        return result;
+    } else if (expr->type == ExprType::UnaryOp) {
+        const NodeUnaryExpr* unary = expr->as<NodeUnaryExpr>();
+        Arg operand = expr_to_arg(unary->operand, src, ir, var_map, global_var_map, next_temp_var);
+        UnaryOp op = unary->op == UnaryOpType::Not ? UnaryOp::Not : UnaryOp::Negate;
+
+        // -5 and !0 are plain literals, no need for a temporary
+        if (operand.type == ArgType::Literal) {
+            operand.value = op == UnaryOp::Not ? !operand.value : -operand.value;
+            return operand;
         }
 
         int temp_var = next_temp_var++;
-        ir.push_back(cBinopOp(temp_var, left, right, op));
+        ir.emit(cUnaryOp(temp_var, operand, op));
 
         Arg result;
         result.type = ArgType::Var;
         result.value = temp_var;
         return result;
+    } else if (expr->type == ExprType::Ternary) {
+        const NodeTernary* ternary = expr->as<NodeTernary>();
+        Arg condition =
+            expr_to_arg(ternary->condition, src, ir, var_map, global_var_map, next_temp_var);
+
+        // a constant condition picks its arm right here
+        if (condition.type == ArgType::Literal) {
+            return expr_to_arg(condition.value ? ternary->if_true : ternary->if_false, src, ir,
+                               var_map, global_var_map, next_temp_var);
+        }
+
+        auto if_true = [&] {
+            return expr_to_arg(ternary->if_true, src, ir, var_map, global_var_map, next_temp_var);
+        };
+        auto if_false = [&] {
+            return expr_to_arg(ternary->if_false, src, ir, var_map, global_var_map, next_temp_var);
+        };
+        const bool speculate =
+            can_speculate(ternary->if_true, src) && can_speculate(ternary->if_false, src);
+        return emit_choice(condition, speculate, if_true, if_false, ir, next_temp_var);
+    } else if (expr->type == ExprType::Call) {
+        const NodeCallExpr* call = expr->as<NodeCallExpr>();
+        Arg result;
+        result.type = ArgType::Var;
+        result.value = next_temp_var++;
+        call_to_ir(call->ident.sym, call->args, result.value, src, ir, var_map, global_var_map,
+                   next_temp_var);
+        return result;
     }
 
     Arg arg;
@@ -402,418 +725,485 @@ Arg expr_to_arg(const NodeExpr* expr, vector<inst>& ir, unordered_map<string, in
     return arg;
 }
 
-vector<inst> astToIr(const NodeProg& prog) {
-    vector<inst> ir;
+// Jumps to false_label when `cond` is false and falls through when it is true. && and || become
+// chains of conditional jumps, so the right operand is only evaluated when it decides the outcome
+// and no 0/1 value is materialised.
+static void cond_to_ir(const NodeExpr* cond, LabelId false_label, string_view src,
+                       IrProgram& ir, SymbolSlots& var_map, SymbolSlots& global_var_map,
+                       int& next_temp_var) {
+    if (cond->type == ExprType::BinaryOp) {
+        const NodeBinExpr* bin = cond->as<NodeBinExpr>();
+        if (bin->op == BinOpType::And) {
+            cond_to_ir(bin->left, false_label, src, ir, var_map, global_var_map, next_temp_var);
+            cond_to_ir(bin->right, false_label, src, ir, var_map, global_var_map, next_temp_var);
+            return;
+        }
+        if (bin->op == BinOpType::Or) {
+            const LabelId rhs_label = ir.new_label("cond_rhs_", LabelKind::Cond);
+            const LabelId true_label = ir.new_label("cond_true_", LabelKind::Cond);
+            cond_to_ir(bin->left, rhs_label, src, ir, var_map, global_var_map, next_temp_var);
+            ir.emit(cJumpOp(true_label));
+            ir.emit(cLabelOp(rhs_label));
+            cond_to_ir(bin->right, false_label, src, ir, var_map, global_var_map, next_temp_var);
+            ir.emit(cLabelOp(true_label));
+            return;
+        }
+    }
+
+    Arg condition = expr_to_arg(cond, src, ir, var_map, global_var_map, next_temp_var);
+    ir.emit(cJumpIfFalseOp(false_label, condition));
+}
 
-    unordered_map<string, int> global_var_map;
+// Lowering state for a whole program: globals are numbered program-wide, locals, externs and
+// temporaries per function. astToIr walks a finished tree through it; parseToIr lets the parser
+// feed it one statement at a time.
+struct Lowering : StmtSink {
+    string_view src;
+    IrProgram ir;
+    SymbolSlots global_var_map;
+    SymbolSlots var_map;
+    SymbolSlots is_external_map;
+    vector<LabelId> break_labels;  // where `break` jumps, innermost switch or loop last
     int global_count = 0;
-    for (const auto& global_tok : prog.globals) {
-        string global_name = global_tok.value.value();
-        global_var_map[global_name] = global_count++;
+    int var_index = 0;
+    int next_temp_var = 1000;
+
+    explicit Lowering(string_view source) : src(source) {
     }
 
-    if (global_count > 0) {
-        ir.push_back(cGlobalVar(global_count));
+    void global(const Token& name) override {
+        global_var_map.set(name.sym, global_count++);
     }
 
-    for (const auto& func : prog.funcs) {
-        unordered_map<string, int> var_map;
-        unordered_map<string, bool> is_external_map;
-        int var_index = 0;
-        int next_temp_var = 1000;
+    void function(const NodeFunc& func) override {
+        var_map.clear();
+        is_external_map.clear();
+        var_index = 0;
+        next_temp_var = 1000;
+
+        // parameters take the first local slots, in order
+        ir.emit(cFuncOp(func.name.sym, func.params.size()));
+        for (const Token& param : func.params) {
+            var_map.set(param.sym, var_index++);
+            is_external_map.set(param.sym, 0);
+            ir.emit(cAutoVar(1));
+        }
+    }
 
-        for (const auto& stmt : func->body) {
-            if (stmt->type == StmtType::Auto) {
-                for (const auto& id_tok : stmt->idents) {
-                    string var_name = id_tok.value.value();
-                    var_map[var_name] = var_index++;
-                    is_external_map[var_name] = false;
-                    ir.push_back(cAutoVar(1));
-                }
-            } else if (stmt->type == StmtType::Extern) {
-                for (const auto& id_tok : stmt->idents) {
-                    string var_name = id_tok.value.value();
-                    is_external_map[var_name] = true;
-                    ir.push_back(cExternVarOp(var_name));
-                }
+    // auto and extern at the top level of a function body; anything else is ignored
+    void declare(const NodeStmt* stmt) {
+        if (stmt->type == StmtType::Auto) {
+            for (const auto& id_tok : stmt->as<NodeDecl>()->idents) {
+                var_map.set(id_tok.sym, var_index++);
+                is_external_map.set(id_tok.sym, 0);
+                ir.emit(cAutoVar(1));
+            }
+        } else if (stmt->type == StmtType::Extern) {
+            for (const auto& id_tok : stmt->as<NodeDecl>()->idents) {
+                is_external_map.set(id_tok.sym, 1);
+                ir.emit(cExternVarOp(id_tok.sym));
             }
         }
+    }
 
-        for (const auto& stmt : func->body) {
-            if (stmt->type == StmtType::Assign) {
-                string var_name = stmt->ident.value.value();
-
-                if (global_var_map.find(var_name) != global_var_map.end()) {
-                    int global_idx = global_var_map[var_name];
-                    Arg arg = expr_to_arg(stmt->expr, ir, var_map, global_var_map, next_temp_var);
-                    ir.push_back(cGAssignOp(global_idx, arg));
-                    continue;
-                }
+    void lower(const NodeStmt* stmt) {
+        stmt_to_ir(stmt, src, ir, var_map, global_var_map, is_external_map, break_labels,
+                   next_temp_var);
+    }
 
-                if (is_external_map.find(var_name) != is_external_map.end() &&
-                    is_external_map[var_name]) {
-                    cerr << "ERROR: Cannot asign to externel variable '" << var_name << "'" << endl;
-                    continue;
-                }
+    // In parse order, so a name has to be declared before the statements that use it.
+    void statement(const NodeStmt* stmt) override {
+        declare(stmt);
+        lower(stmt);
+    }
 
-                int var_idx = var_map[var_name];
-                Arg arg = expr_to_arg(stmt->expr, ir, var_map, global_var_map, next_temp_var);
-                ir.push_back(cAutoAssignOp(var_idx, arg));
-            } else if (stmt->type == StmtType::FuncCall) {
-                optional<Arg> arg;
-                if (!stmt->args.empty()) {
-                    NodeExpr* arg_expr = stmt->args[0];
-                    if (arg_expr->type == ExprType::Ident) {
-                        string arg_name = arg_expr->token.value.value();
-                        if (is_external_map.find(arg_name) != is_external_map.end() &&
-                            is_external_map[arg_name]) {
-                            cerr << "ERROR: Cannot pass externel variable as arguement: "
-                                 << arg_name << endl;
-                            continue;
-                        }
-                    }
+    IrProgram finish() {
+        if (global_count > 0) {
+            ir.code.insert(ir.code.begin(), cGlobalVar(global_count));
+        }
+        return std::move(ir);
+    }
+};
 
-                    arg = expr_to_arg(stmt->args[0], ir, var_map, global_var_map, next_temp_var);
-                }
-                ir.push_back(cFunCallOp(stmt->ident.value.value(), arg));
-            } else if (stmt->type == StmtType::If) {
-                // Handle if statements with labels and jumps
-                string end_label = "if_end_" + to_string(next_temp_var++);
-                string else_label = "if_else_" + to_string(next_temp_var++);
-
-                Arg condition =
-                    expr_to_arg(stmt->condition, ir, var_map, global_var_map, next_temp_var);
-
-                if (stmt->else_stmt) {
-                    ir.push_back(cJumpIfFalseOp(else_label, condition));
-                    // Process then statement
-                    stmt_to_ir(stmt->then_stmt, ir, var_map, global_var_map, is_external_map,
-                               next_temp_var);
-                    ir.push_back(cJumpOp(end_label));
-                    ir.push_back(cLabelOp(else_label));
-                    // Process else statement
-                    stmt_to_ir(stmt->else_stmt, ir, var_map, global_var_map, is_external_map,
-                               next_temp_var);
-                    ir.push_back(cLabelOp(end_label));
-                } else {
-                    ir.push_back(cJumpIfFalseOp(end_label, condition));
-                    // Process then statement
-                    stmt_to_ir(stmt->then_stmt, ir, var_map, global_var_map, is_external_map,
-                               next_temp_var);
-                    ir.push_back(cLabelOp(end_label));
-                }
-            } else if (stmt->type == StmtType::While) {
-                // Handle while loops with labels and jumps
-                string loop_start = "while_start_" + to_string(next_temp_var++);
-                string loop_end = "while_end_" + to_string(next_temp_var++);
-
-                ir.push_back(cLabelOp(loop_start));
-                Arg condition =
-                    expr_to_arg(stmt->condition, ir, var_map, global_var_map, next_temp_var);
-                ir.push_back(cJumpIfFalseOp(loop_end, condition));
-                // Process loop body
-                stmt_to_ir(stmt->then_stmt, ir, var_map, global_var_map, is_external_map,
-                           next_temp_var);
-                ir.push_back(cJumpOp(loop_start));
-                ir.push_back(cLabelOp(loop_end));
-            } else if (stmt->type == StmtType::Return) {
-                optional<Arg> value;
-                if (stmt->expr) {
-                    value = expr_to_arg(stmt->expr, ir, var_map, global_var_map, next_temp_var);
-                }
-                ir.push_back(cRetOp(value));
-            } else if (stmt->type == StmtType::Block) {
-                // Handle block statements recursively
-                for (const auto& sub_stmt : stmt->body) {
-                    stmt_to_ir(sub_stmt, ir, var_map, global_var_map, is_external_map,
-                               next_temp_var);
-                }
-            }
+IrProgram astToIr(const NodeProg& prog) {
+    Lowering lowering(prog.src);
+    for (const auto& global_tok : prog.globals) {
+        lowering.global(global_tok);
+    }
+
+    // declarations are hoisted: every auto and extern of a body is known before its first
+    // statement is lowered
+    for (const auto& func : prog.funcs) {
+        lowering.function(*func);
+        for (const auto& stmt : func->body) {
+            lowering.declare(stmt);
+        }
+        for (const auto& stmt : func->body) {
+            lowering.lower(stmt);
         }
     }
 
-    return ir;
+    return lowering.finish();
 }
 
-int CONST_VALS[5000];
-vector<bool> HAS_CONST(5000, false);
+optional<IrProgram> parseToIr(Parser& parser, string_view src) {
+    Lowering lowering(src);
+    if (!parser.parse_direct(lowering)) {
+        return {};
+    }
+    return lowering.finish();
+}
 
-vector<inst> optimisation(vector<inst> ir) {
-    // PASS 1: Identify loop ranges and modified variables
-    struct LoopInfo {
-        int start_index;
-        int end_index;
-        unordered_set<int> modified_vars;
-    };
-    vector<LoopInfo> loops;
-    vector<int> loop_stack;  // stores indices into 'loops' vector
-
-    for (size_t i = 0; i < ir.size(); i++) {
-        if (ir[i].kind == Opkind::label) {
-            string label = ir[i].label.name;
-            if (label.find("while_start") != string::npos) {
-                LoopInfo info;
-                info.start_index = i;
-                info.end_index = -1;  // Unknown yet
-                loops.push_back(info);
-                loop_stack.push_back(loops.size() - 1);
-            } else if (label.find("while_end") != string::npos) {
-                if (!loop_stack.empty()) {
-                    loops[loop_stack.back()].end_index = i;
-                    loop_stack.pop_back();
-                }
-            }
-        } else if (ir[i].kind == Opkind::autoassign) {
-            for (int loop_idx : loop_stack) {
-                loops[loop_idx].modified_vars.insert(ir[i].autoassign.index);
-            }
-        }
+int written_var(const inst& instr) {
+    switch (instr.kind) {
+        case Opkind::autoassign:
+            return instr.autoassign.index;
+        case Opkind::binop:
+            return instr.binop.dest;
+        case Opkind::unaryop:
+            return instr.unary.dest;
+        case Opkind::select:
+            return instr.select.dest;
+        case Opkind::call:
+            return instr.call.dest;
+        case Opkind::update:
+            return instr.update.dest.type == ArgType::Var ? instr.update.dest.value : -1;
+        default:
+            return -1;
     }
+}
 
-    // Optimization passes
-    for (int pass = 0; pass < 10; pass++) {
-        // Reset constants for each pass
-        fill(HAS_CONST.begin(), HAS_CONST.end(), false);
+void insert_code(IrProgram& prog, vector<pair<size_t, inst>> code) {
+    if (code.empty()) {
+        return;
+    }
+    stable_sort(code.begin(), code.end(),
+                [](const pair<size_t, inst>& a, const pair<size_t, inst>& b) {
+                    return a.first < b.first;
+                });
+    const size_t from = code.front().first;
+    vector<inst> tail(prog.code.begin() + from, prog.code.end());
+    prog.code.resize(from);
+    size_t next = 0;
+    for (size_t i = 0; i <= tail.size(); i++) {
+        while (next < code.size() && code[next].first == from + i) {
+            prog.code.push_back(code[next++].second);
+        }
+        if (i < tail.size()) {
+            prog.code.push_back(tail[i]);
+        }
+    }
+}
 
-        for (size_t i = 0; i < ir.size(); i++) {
-            inst* ins = &ir[i];
+int first_free_var(const IrProgram& prog, const Cfg& cfg, const VarNumbering& vars) {
+    int next = prog.code[cfg.func_start()].func.params;
+    for (size_t v = 0; v < vars.size(); v++) {
+        next = max(next, vars.var((int)v) + 1);
+    }
+    return next;
+}
 
-            // Helper to check if var is dirty at index i
-            auto is_dirty = [&](int var_idx) {
-                for (const auto& loop : loops) {
-                    if (i >= loop.start_index) {
-                        if (loop.modified_vars.count(var_idx)) return true;
-                    }
+IrProgram optimisation(IrProgram prog, const UnrollLimits& unroll) {
+    Cfg cfg;
+    VarNumbering vars;
+    SsaForm ssa;
+    BitSolution live;
+
+    // Functions are independent: locals are numbered per function and nothing carries over.
+    // Each is moved to the end of the program while it is optimised, so that code a pass inserts
+    // only shifts the rest of that function, and is compacted before the next one.
+    const vector<size_t> starts = function_starts(prog);
+    vector<inst> input = std::move(prog.code);
+    prog.code.clear();
+    prog.code.reserve(input.size());
+    prog.code.insert(prog.code.end(), input.begin(),
+                     input.begin() + (starts.empty() ? input.size() : starts[0]));
+    for (size_t f = 0; f < starts.size(); f++) {
+        const size_t start = prog.code.size();
+        const size_t end = f + 1 < starts.size() ? starts[f + 1] : input.size();
+        prog.code.insert(prog.code.end(), input.begin() + starts[f], input.begin() + end);
+
+        auto analyse = [&]() {
+            cfg.build(prog, start);
+            vars.build(prog, cfg);
+            live = liveness(prog, cfg, vars);
+            ssa.build(prog, cfg, vars, live);
+        };
+
+        analyse();
+        if (propagate_constants(prog, cfg, ssa)) {
+            cfg.invalidate();
+        }
+        // propagation only turns operands into literals, which leaves the SSA form usable
+        // as long as the branches are as they were
+        if (!cfg.valid()) {
+            analyse();
+        }
+        number_values(prog, cfg, vars, ssa);
+        // a recomputation turned into a copy can read a variable from another block now
+        vars.build(prog, cfg);
+        if (remove_dead_code(prog, cfg, vars)) {
+            cfg.invalidate();
+        }
+        if (!cfg.loops().empty()) {
+            analyse();
+            if (hoist_invariants(prog, cfg, vars, ssa, live)) {
+                analyse();
+            }
+            if (reduce_induction_variables(prog, cfg, vars, ssa)) {
+                // the multiplies replaced and the old variable's step are dead now
+                cfg.build(prog, start);
+                vars.build(prog, cfg);
+                if (remove_dead_code(prog, cfg, vars)) {
+                    cfg.build(prog, start);
                 }
-                return false;
-            };
-
-            switch (ins->kind) {
-                case Opkind::autoassign: {
-                    // First, try to propagate constants into the argument
-                    if (ins->autoassign.arg.type == ArgType::Var) {
-                        if (HAS_CONST[ins->autoassign.arg.value] == true &&
-                            !is_dirty(ins->autoassign.arg.value)) {
-                            ins->autoassign.arg.type = ArgType::Literal;
-                            ins->autoassign.arg.value = CONST_VALS[ins->autoassign.arg.value];
-                        }
-                    }
-
-                    // Then, track the constant value ONLY if the destination is not dirty
-                    if (!is_dirty(ins->autoassign.index)) {
-                        if (ins->autoassign.arg.type == ArgType::Literal) {
-                            HAS_CONST[ins->autoassign.index] = true;
-                            CONST_VALS[ins->autoassign.index] = ins->autoassign.arg.value;
-                        } else {
-                            // If assigning a non-constant, invalidate the destination
-                            HAS_CONST[ins->autoassign.index] = false;
-                        }
-                    }
-                    break;
+            }
+            if (unroll_loops(prog, cfg, vars, unroll)) {
+                // constants and repeated work can now be followed from one copy into the next
+                analyse();
+                if (propagate_constants(prog, cfg, ssa)) {
+                    analyse();
                 }
+                number_values(prog, cfg, vars, ssa);
+                vars.build(prog, cfg);
+                remove_dead_code(prog, cfg, vars);
+            }
+        }
 
-                case Opkind::binop: {
-                    if (ins->binop.left.type == ArgType::Var) {
-                        if (HAS_CONST[ins->binop.left.value] == true &&
-                            !is_dirty(ins->binop.left.value)) {
-                            ins->binop.left.type = ArgType::Literal;
-                            ins->binop.left.value = CONST_VALS[ins->binop.left.value];
-                        }
-                    }
-
-                    if (ins->binop.right.type == ArgType::Var) {
-                        if (HAS_CONST[ins->binop.right.value] == true &&
-                            !is_dirty(ins->binop.right.value)) {
-                            ins->binop.right.type = ArgType::Literal;
-                            ins->binop.right.value = CONST_VALS[ins->binop.right.value];
-                        }
-                    }
+        prog.code.erase(remove_if(prog.code.begin() + start, prog.code.end(),
+                                  [](const inst& instr) { return instr.kind == Opkind::nop; }),
+                        prog.code.end());
+    }
+    return prog;
+}
 
-                    if (ins->binop.left.type == ArgType::Literal &&
-                        ins->binop.right.type == ArgType::Literal) {
-                        int v1 = ins->binop.left.value;
-                        int v2 = ins->binop.right.value;
-                        int res = 0;
-
-                        switch (ins->binop.op) {
-                            case BinOp::Add:
-                                res = v1 + v2;
-                                break;
-                            case BinOp::Sub:
-                                res = v1 - v2;
-                                break;
-                            case BinOp::Mul:
-                                res = v1 * v2;
-                                break;
-                            case BinOp::Div:
-                                if (v2 != 0) res = v1 / v2;
-                                break;
-                            case BinOp::Mod:
-                                if (v2 != 0) res = v1 % v2;
-                                break;
-                            case BinOp::EqualEqual:
-                                res = (v1 == v2) ? 1 : 0;
-                                break;
-                            case BinOp::NotEqual:
-                                res = (v1 != v2) ? 1 : 0;
-                                break;
-                            case BinOp::Less:
-                                res = (v1 < v2) ? 1 : 0;
-                                break;
-                            case BinOp::LessEqual:
-                                res = (v1 <= v2) ? 1 : 0;
-                                break;
-                            case BinOp::Greater:
-                                res = (v1 > v2) ? 1 : 0;
-                                break;
-                            case BinOp::GreaterEqual:
-                                res = (v1 >= v2) ? 1 : 0;
-                                break;
-                            case BinOp::And:
-                                res = (v1 && v2) ? 1 : 0;
-                                break;
-                            case BinOp::Or:
-                                res = (v1 || v2) ? 1 : 0;
-                                break;
-                            case BinOp::Shl:
-                                res = v1 << v2;
-                                break;
-                            case BinOp::Shr:
-                                res = v1 >> v2;
-                                break;
-                        }
-
-                        int d = ins->binop.dest;
-
-                        ins->kind = Opkind::autoassign;
-                        ins->autoassign.index = d;
-                        ins->autoassign.arg.type = ArgType::Literal;
-                        ins->autoassign.arg.value = res;
-
-                        if (!is_dirty(d)) {
-                            HAS_CONST[d] = true;
-                            CONST_VALS[d] = res;
-                        }
-                    }
-                    break;
-                }
+// Switches with at least this many cases whose values span no more than JUMP_TABLE_DENSITY
+// slots per case (and at most JUMP_TABLE_MAX_SLOTS in total) dispatch through a jump table;
+// the rest go through a balanced compare tree.
+static constexpr size_t JUMP_TABLE_MIN_CASES = 4;
+static constexpr int64_t JUMP_TABLE_DENSITY = 3;
+static constexpr int64_t JUMP_TABLE_MAX_SLOTS = 4096;
+
+// Binary search over cases[lo, hi) (sorted by value): each inner node splits on `value < mid`,
+// leaves test their few cases for equality and fall back to default_label.
+static void emit_compare_tree(const vector<pair<int, LabelId>>& cases, size_t lo, size_t hi,
+                              const Arg& value, LabelId default_label, IrProgram& ir,
+                              int& next_temp_var) {
+    Arg cond;
+    cond.type = ArgType::Var;
+    Arg key;
+    key.type = ArgType::Literal;
+
+    if (hi - lo <= 3) {
+        for (size_t i = lo; i < hi; i++) {
+            cond.value = next_temp_var++;
+            key.value = cases[i].first;
+            ir.emit(cBinopOp(cond.value, value, key, BinOp::NotEqual));
+            ir.emit(cJumpIfFalseOp(cases[i].second, cond));
+        }
+        ir.emit(cJumpOp(default_label));
+        return;
+    }
 
-                case Opkind::funcall: {
-                    if (ins->funcall.arg.has_value()) {
-                        if (ins->funcall.arg->type == ArgType::Var) {
-                            if (HAS_CONST[ins->funcall.arg->value] == true &&
-                                !is_dirty(ins->funcall.arg->value)) {
-                                ins->funcall.arg->type = ArgType::Literal;
-                                ins->funcall.arg->value = CONST_VALS[ins->funcall.arg->value];
-                            }
-                        }
-                    }
-                    break;
-                }
+    const size_t mid = lo + (hi - lo) / 2;
+    const LabelId upper = ir.new_label("switch_split_", LabelKind::Merge);
+    cond.value = next_temp_var++;
+    key.value = cases[mid].first;
+    ir.emit(cBinopOp(cond.value, value, key, BinOp::Less));
+    ir.emit(cJumpIfFalseOp(upper, cond));
+    emit_compare_tree(cases, lo, mid, value, default_label, ir, next_temp_var);
+    ir.emit(cLabelOp(upper));
+    emit_compare_tree(cases, mid, hi, value, default_label, ir, next_temp_var);
+}
 
-                case Opkind::jumpiffalse: {
-                    // Propagate constants into the condition
-                    if (ins->jumpiffalse.condition.type == ArgType::Var) {
-                        if (HAS_CONST[ins->jumpiffalse.condition.value] == true &&
-                            !is_dirty(ins->jumpiffalse.condition.value)) {
-                            ins->jumpiffalse.condition.type = ArgType::Literal;
-                            ins->jumpiffalse.condition.value =
-                                CONST_VALS[ins->jumpiffalse.condition.value];
-                        }
-                    }
-                    break;
-                }
+static void switch_to_ir(const NodeSwitch* sw, string_view src, IrProgram& ir,
+                         SymbolSlots& var_map, SymbolSlots& global_var_map,
+                         SymbolSlots& is_external_map, vector<LabelId>& break_labels,
+                         int& next_temp_var) {
+    Arg value = expr_to_arg(sw->value, src, ir, var_map, global_var_map, next_temp_var);
+
+    const LabelId end_label = ir.new_label("switch_end_", LabelKind::Merge);
+    LabelId default_label = end_label;
+    vector<LabelId> case_labels;
+    vector<pair<int, LabelId>> cases;
+    case_labels.reserve(sw->cases.size());
+    for (const SwitchCase& c : sw->cases) {
+        case_labels.push_back(ir.new_label("switch_case_", LabelKind::Merge));
+        if (c.is_default) {
+            default_label = case_labels.back();
+        } else {
+            cases.emplace_back(c.value, case_labels.back());
+        }
+    }
 
-                default:
-                    break;
-            }
+    // the parser has rejected repeated values
+    sort(cases.begin(), cases.end());
+
+    const int64_t slots =
+        cases.empty() ? 0 : (int64_t)cases.back().first - cases.front().first + 1;
+    if (cases.size() >= JUMP_TABLE_MIN_CASES && slots <= JUMP_TABLE_MAX_SLOTS &&
+        slots <= JUMP_TABLE_DENSITY * (int64_t)cases.size()) {
+        const int low = cases.front().first;
+        JumpTable table{vector<LabelId>(slots, default_label), default_label, end_label};
+        for (const auto& c : cases) {
+            table.targets[c.first - low] = c.second;
         }
+        ir.jump_tables.push_back(move(table));
+        ir.emit(cJumpTableOp(value, low, ir.jump_tables.size() - 1));
+    } else {
+        emit_compare_tree(cases, 0, cases.size(), value, default_label, ir, next_temp_var);
     }
 
-    return ir;
+    break_labels.push_back(end_label);
+    for (size_t i = 0; i < sw->cases.size(); i++) {
+        ir.emit(cLabelOp(case_labels[i]));
+        for (const NodeStmt* sub_stmt : sw->cases[i].body) {
+            stmt_to_ir(sub_stmt, src, ir, var_map, global_var_map, is_external_map, break_labels,
+                       next_temp_var);
+        }
+    }
+    break_labels.pop_back();
+    ir.emit(cLabelOp(end_label));
 }
 
 // Helper function to recursively process statements
-void stmt_to_ir(const NodeStmt* stmt, vector<inst>& ir, unordered_map<string, int>& var_map,
-                unordered_map<string, int>& global_var_map,
-                unordered_map<string, bool>& is_external_map, int& next_temp_var) {
+void stmt_to_ir(const NodeStmt* stmt, string_view src, IrProgram& ir, SymbolSlots& var_map,
+                SymbolSlots& global_var_map, SymbolSlots& is_external_map,
+                vector<LabelId>& break_labels, int& next_temp_var) {
     if (stmt->type == StmtType::Assign) {
-        string var_name = stmt->ident.value.value();
+        const NodeAssign* assign = stmt->as<NodeAssign>();
+        const SymbolId var_sym = assign->ident.sym;
 
         // Check if it's a global variable
-        if (global_var_map.find(var_name) != global_var_map.end()) {
-            int global_idx = global_var_map[var_name];
-            Arg arg = expr_to_arg(stmt->expr, ir, var_map, global_var_map, next_temp_var);
-            ir.push_back(cGAssignOp(global_idx, arg));
+        if (global_var_map.has(var_sym)) {
+            int global_idx = global_var_map.get(var_sym);
+            Arg arg = expr_to_arg(assign->expr, src, ir, var_map, global_var_map, next_temp_var);
+            ir.emit(cGAssignOp(global_idx, arg));
             return;
         }
 
         // Check if it's an external variable
-        if (is_external_map.find(var_name) != is_external_map.end() && is_external_map[var_name]) {
-            cerr << "ERROR: Cannot assign to external variable '" << var_name << "'" << endl;
+        if (is_external_map.get(var_sym) == 1) {
+            cerr << "ERROR: Cannot assign to external variable '" << token_text(src, assign->ident)
+                 << "'" << endl;
             return;
         }
 
-        int var_idx = var_map[var_name];
-        Arg arg = expr_to_arg(stmt->expr, ir, var_map, global_var_map, next_temp_var);
-        ir.push_back(cAutoAssignOp(var_idx, arg));
+        int var_idx = var_map.get(var_sym, 0);
+        Arg arg = expr_to_arg(assign->expr, src, ir, var_map, global_var_map, next_temp_var);
+        ir.emit(cAutoAssignOp(var_idx, arg));
+    } else if (stmt->type == StmtType::Update) {
+        const NodeUpdate* update = stmt->as<NodeUpdate>();
+        const SymbolId var_sym = update->ident.sym;
+
+        if (is_external_map.get(var_sym) == 1) {
+            cerr << "ERROR: Cannot assign to external variable '" << token_text(src, update->ident)
+                 << "'" << endl;
+            return;
+        }
+
+        Arg dest;
+        if (global_var_map.has(var_sym)) {
+            dest.type = ArgType::Global;
+            dest.value = global_var_map.get(var_sym);
+        } else {
+            dest.type = ArgType::Var;
+            dest.value = var_map.get(var_sym, 0);
+        }
+
+        Arg value;
+        value.type = ArgType::Literal;
+        value.value = 1;  // x++ / x--
+        if (update->expr) {
+            value = expr_to_arg(update->expr, src, ir, var_map, global_var_map, next_temp_var);
+        }
+
+        const BinOp op = lower_binop(update->op);
+        if (op == BinOp::Add || op == BinOp::Sub || op == BinOp::Shl || op == BinOp::Shr) {
+            ir.emit(cUpdateOp(dest, value, op));
+            return;
+        }
+
+        // No in-place form for the rest: compute into a temporary and store it back
+        int temp_var = next_temp_var++;
+        ir.emit(cBinopOp(temp_var, dest, value, op));
+        Arg result;
+        result.type = ArgType::Var;
+        result.value = temp_var;
+        if (dest.type == ArgType::Global) {
+            ir.emit(cGAssignOp(dest.value, result));
+        } else {
+            ir.emit(cAutoAssignOp(dest.value, result));
+        }
     } else if (stmt->type == StmtType::FuncCall) {
-        optional<Arg> arg;
-        if (!stmt->args.empty()) {
-            NodeExpr* arg_expr = stmt->args[0];
+        const NodeCall* call = stmt->as<NodeCall>();
+        for (const NodeExpr* arg_expr : call->args) {
             if (arg_expr->type == ExprType::Ident) {
-                string arg_name = arg_expr->token.value.value();
-                if (is_external_map.find(arg_name) != is_external_map.end() &&
-                    is_external_map[arg_name]) {
-                    cerr << "ERROR: Cannot pass external variable as argument: " << arg_name
-                         << endl;
+                const Token& arg_tok = arg_expr->as<NodeTerm>()->token;
+                if (is_external_map.get(arg_tok.sym) == 1) {
+                    cerr << "ERROR: Cannot pass external variable as argument: "
+                         << token_text(src, arg_tok) << endl;
                     return;
                 }
             }
-
-            arg = expr_to_arg(stmt->args[0], ir, var_map, global_var_map, next_temp_var);
         }
-        ir.push_back(cFunCallOp(stmt->ident.value.value(), arg));
+        call_to_ir(call->ident.sym, call->args, -1, src, ir, var_map, global_var_map,
+                   next_temp_var);
     } else if (stmt->type == StmtType::If) {
-        string end_label = "if_end_" + to_string(next_temp_var++);
-        string else_label = "if_else_" + to_string(next_temp_var++);
+        const NodeIf* if_stmt = stmt->as<NodeIf>();
+        LabelId end_label = ir.new_label("if_end_");
+        LabelId else_label = ir.new_label("if_else_");
 
-        Arg condition = expr_to_arg(stmt->condition, ir, var_map, global_var_map, next_temp_var);
-
-        if (stmt->else_stmt) {
-            ir.push_back(cJumpIfFalseOp(else_label, condition));
-            stmt_to_ir(stmt->then_stmt, ir, var_map, global_var_map, is_external_map,
-                       next_temp_var);
-            ir.push_back(cJumpOp(end_label));
-            ir.push_back(cLabelOp(else_label));
-            stmt_to_ir(stmt->else_stmt, ir, var_map, global_var_map, is_external_map,
+        if (if_stmt->else_stmt) {
+            cond_to_ir(if_stmt->condition, else_label, src, ir, var_map, global_var_map,
                        next_temp_var);
-            ir.push_back(cLabelOp(end_label));
+            stmt_to_ir(if_stmt->then_stmt, src, ir, var_map, global_var_map, is_external_map,
+                       break_labels, next_temp_var);
+            ir.emit(cJumpOp(end_label));
+            ir.emit(cLabelOp(else_label));
+            stmt_to_ir(if_stmt->else_stmt, src, ir, var_map, global_var_map, is_external_map,
+                       break_labels, next_temp_var);
+            ir.emit(cLabelOp(end_label));
         } else {
-            ir.push_back(cJumpIfFalseOp(end_label, condition));
-            stmt_to_ir(stmt->then_stmt, ir, var_map, global_var_map, is_external_map,
+            cond_to_ir(if_stmt->condition, end_label, src, ir, var_map, global_var_map,
                        next_temp_var);
-            ir.push_back(cLabelOp(end_label));
+            stmt_to_ir(if_stmt->then_stmt, src, ir, var_map, global_var_map, is_external_map,
+                       break_labels, next_temp_var);
+            ir.emit(cLabelOp(end_label));
         }
     } else if (stmt->type == StmtType::While) {
-        string loop_start = "while_start_" + to_string(next_temp_var++);
-        string loop_end = "while_end_" + to_string(next_temp_var++);
-
-        ir.push_back(cLabelOp(loop_start));
-        Arg condition = expr_to_arg(stmt->condition, ir, var_map, global_var_map, next_temp_var);
-        ir.push_back(cJumpIfFalseOp(loop_end, condition));
-        stmt_to_ir(stmt->then_stmt, ir, var_map, global_var_map, is_external_map, next_temp_var);
-        ir.push_back(cJumpOp(loop_start));
-        ir.push_back(cLabelOp(loop_end));
+        const NodeWhile* loop = stmt->as<NodeWhile>();
+        const auto [loop_start, loop_end] = ir.new_loop();
+
+        ir.emit(cLabelOp(loop_start));
+        cond_to_ir(loop->condition, loop_end, src, ir, var_map, global_var_map, next_temp_var);
+        break_labels.push_back(loop_end);
+        stmt_to_ir(loop->body, src, ir, var_map, global_var_map, is_external_map, break_labels,
+                   next_temp_var);
+        break_labels.pop_back();
+        ir.emit(cJumpOp(loop_start));
+        ir.emit(cLabelOp(loop_end));
+    } else if (stmt->type == StmtType::Switch) {
+        switch_to_ir(stmt->as<NodeSwitch>(), src, ir, var_map, global_var_map, is_external_map,
+                     break_labels, next_temp_var);
+    } else if (stmt->type == StmtType::Break) {
+        if (break_labels.empty()) {
+            cerr << "ERROR: 'break' outside of a loop or switch" << endl;
+            return;
+        }
+        ir.emit(cJumpOp(break_labels.back()));
     } else if (stmt->type == StmtType::Return) {
+        const NodeReturn* ret = stmt->as<NodeReturn>();
         optional<Arg> value;
-        if (stmt->expr) {
-            value = expr_to_arg(stmt->expr, ir, var_map, global_var_map, next_temp_var);
+        if (ret->expr) {
+            value = expr_to_arg(ret->expr, src, ir, var_map, global_var_map, next_temp_var);
         }
-        ir.push_back(cRetOp(value));
+        ir.emit(cRetOp(value));
     } else if (stmt->type == StmtType::Block) {
-        for (const auto& sub_stmt : stmt->body) {
-            stmt_to_ir(sub_stmt, ir, var_map, global_var_map, is_external_map, next_temp_var);
+        const NodeBlock* block = stmt->as<NodeBlock>();
+        for (const auto& sub_stmt : block->body) {
+            stmt_to_ir(sub_stmt, src, ir, var_map, global_var_map, is_external_map, break_labels,
+                       next_temp_var);
         }
     }
 }
\ No newline at end of file
@@ -0,0 +1,200 @@
+#include <algorithm>
+#include <vector>
+
+#include "passes.h"
+
+using namespace std;
+
+// Control may only enter by falling through from the block above the header. The natural loops
+// built from while statements all look like that.
+size_t loop_preheader(const IrProgram& prog, const Cfg& cfg, int l) {
+    const NaturalLoop& loop = cfg.loops()[l];
+    const BasicBlock& header = cfg.blocks()[loop.header];
+    if (loop.header == 0 || prog.code[header.first].kind != Opkind::label) {
+        return 0;
+    }
+    for (int p : header.preds) {
+        if (p != loop.header - 1 && !cfg.in_loop(p, l)) {
+            return 0;
+        }
+    }
+    const inst& above = prog.code[cfg.blocks()[loop.header - 1].end - 1];
+    switch (above.kind) {
+        case Opkind::jump:
+        case Opkind::jumptable:
+        case Opkind::ret:
+            return 0;
+        case Opkind::jumpiffalse:
+            if (cfg.label_block(above.jumpiffalse.label) == loop.header) {
+                return 0;
+            }
+            break;
+        default:
+            break;
+    }
+    return header.first;
+}
+
+// Instructions that can run where they did not before: no side effects and no trap.
+static bool speculable(const inst& instr) {
+    switch (instr.kind) {
+        case Opkind::autoassign:
+        case Opkind::select:
+            return true;
+        case Opkind::unaryop:
+            return instr.unary.op == UnaryOp::Not || instr.unary.op == UnaryOp::Negate;
+        case Opkind::binop:
+            if (instr.binop.op == BinOp::Div || instr.binop.op == BinOp::Mod) {
+                // INT64_MIN / -1 traps as well as division by zero
+                return instr.binop.right.type == ArgType::Literal && instr.binop.right.value != 0 &&
+                       instr.binop.right.value != -1;
+            }
+            return true;
+        default:
+            return false;
+    }
+}
+
+bool hoist_invariants(IrProgram& prog, const Cfg& cfg, const VarNumbering& vars,
+                      const SsaForm& ssa, const BitSolution& live) {
+    const vector<BasicBlock>& blocks = cfg.blocks();
+    const vector<NaturalLoop>& loops = cfg.loops();
+    const vector<SsaValue>& values = ssa.values();
+
+    // the variables each loop modifies, and those it writes in more than one place
+    vector<BitSet> written(loops.size(), BitSet(vars.size()));
+    vector<BitSet> rewritten(loops.size(), BitSet(vars.size()));
+    vector<size_t> entry(loops.size());
+    vector<vector<int>> exits(loops.size());
+    for (size_t l = 0; l < loops.size(); l++) {
+        entry[l] = loop_preheader(prog, cfg, (int)l);
+        for (int b : loops[l].blocks) {
+            for (size_t i = blocks[b].first; i < blocks[b].end; i++) {
+                const int dest = written_var(prog.code[i]);
+                if (dest >= 0) {
+                    const int v = vars.index(dest);
+                    if (written[l].test(v)) {
+                        rewritten[l].set(v);
+                    }
+                    written[l].set(v);
+                }
+            }
+            for (int s : blocks[b].succs) {
+                if (!cfg.in_loop(s, (int)l)) {
+                    exits[l].push_back(s);
+                }
+            }
+        }
+    }
+
+    // loop whose preheader each instruction goes to, -1 if it stays, and what goes to each in
+    // the order it was picked, which has definitions ahead of their uses
+    const size_t start = cfg.func_start();
+    vector<int> target(cfg.func_end() - start, -1);
+    vector<vector<size_t>> moved(loops.size());
+    auto invariant = [&](size_t index, int l) {
+        bool all = true;
+        int slot = 0;
+        for_each_operand(prog, prog.code[index], [&](const Arg& arg) {
+            const int k = slot++;
+            if (arg.type == ArgType::Global) {
+                all = false;
+            } else if (arg.type == ArgType::Var) {
+                const int value = ssa.use(index, k);
+                if (value < 0) {
+                    all = false;
+                    return;
+                }
+                const SsaValue& def = values[value];
+                if (def.kind == ValueKind::Entry || !cfg.in_loop(def.block, l)) {
+                    return;
+                }
+                // computed in the loop, but by something already moved out past it
+                const int moved = def.kind == ValueKind::Inst ? target[def.def - start] : -1;
+                if (moved == -1 || !cfg.in_loop(loops[l].header, moved)) {
+                    all = false;
+                }
+            }
+        });
+        return all;
+    };
+
+    bool changed = false;
+    for (int b : cfg.rpo()) {
+        if (blocks[b].loop == -1) {
+            continue;
+        }
+        // outermost loop first, so an instruction goes as far out as it can
+        vector<int> chain;
+        for (int l = blocks[b].loop; l != -1; l = loops[l].parent) {
+            chain.insert(chain.begin(), l);
+        }
+
+        bool after_call = false;
+        for (size_t i = blocks[b].first; i < blocks[b].end; i++) {
+            const inst& instr = prog.code[i];
+            const int dest = written_var(instr);
+            if (instr.kind == Opkind::call) {
+                after_call = true;
+            }
+            if (dest < 0 || ssa.def(i) < 0) {
+                continue;
+            }
+            const int v = vars.index(dest);
+            const bool across = v < (int)vars.across();
+            for (int l : chain) {
+                const NaturalLoop& loop = loops[l];
+                if (entry[l] == 0 || rewritten[l].test(v) ||
+                    (across && live.in[loop.header].test(v)) || !invariant(i, l)) {
+                    continue;
+                }
+                // The header runs on every way into the loop, so even a division there can go
+                // first, unless a call before it could end the program
+                const bool header = b == loop.header;
+                if (!speculable(instr) &&
+                    !(header && !after_call && instr.kind == Opkind::binop)) {
+                    continue;
+                }
+                // Now run once up front, the value must not be seen after the loop unless every
+                // way out passes the instruction
+                bool seen_after = false;
+                for (int s : exits[l]) {
+                    seen_after |= across && live.in[s].test(v);
+                }
+                if (seen_after && !header) {
+                    continue;
+                }
+                target[i - start] = l;
+                moved[l].push_back(i);
+                changed = true;
+                break;
+            }
+        }
+    }
+    if (!changed) {
+        return false;
+    }
+
+    // Reorder the function in place, with each preheader's instructions right above the label
+    // of its loop's header
+    vector<int> header_loop(cfg.func_end() - start, -1);
+    for (size_t l = 0; l < loops.size(); l++) {
+        if (!moved[l].empty()) {
+            header_loop[entry[l] - start] = (int)l;
+        }
+    }
+    vector<inst> code;
+    code.reserve(cfg.func_end() - start);
+    for (size_t i = start; i < cfg.func_end(); i++) {
+        if (header_loop[i - start] != -1) {
+            for (size_t index : moved[header_loop[i - start]]) {
+                code.push_back(prog.code[index]);
+            }
+        }
+        if (target[i - start] == -1) {
+            code.push_back(prog.code[i]);
+        }
+    }
+    copy(code.begin(), code.end(), prog.code.begin() + start);
+    return true;
+}
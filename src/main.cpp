@@ -2,6 +2,7 @@
 
 #include <sys/stat.h>
 
+#include <algorithm>
 #include <cctype>
 #include <cstdlib>
 #include <cstring>
@@ -10,9 +11,12 @@
 #include <iostream>
 #include <optional>
 #include <sstream>
+#include <thread>
 #include <vector>
 
 #include "Parser.h"
+#include "SourceFile.h"
+#include "TokenRing.h"
 #include "Tokenizer.h"
 #include "generator.h"
 #include "ir.h"
@@ -57,7 +61,8 @@ bool parse_flags(int argc, char** argv) {
     g_program_name = argv[0];
     for (int i = 1; i < argc; i++) {
         std::string arg = argv[i];
-        if (arg[0] != '-') {
+        // a lone "-" names stdin as the input file
+        if (arg[0] != '-' || arg == "-") {
             g_positional_args.push_back(arg);
             continue;
         }
@@ -184,6 +189,14 @@ int main(int argc, char* argv[]) {
     Flag* help_flag2 = add_bool_flag("help", false, "Show this help message");
     Flag* parse_flag =
         add_bool_flag("parse", false, "Parse WASM file and show structure (WasmEdge LFX)");
+    Flag* stream_tokens_flag =
+        add_bool_flag("stream-tokens", false, "Lex on a separate thread, pipelined into parsing");
+    Flag* lex_threads_flag =
+        add_string_flag("lex-threads", "1", "Lexer threads for large inputs (0 = one per core)");
+    Flag* parse_threads_flag = add_string_flag(
+        "parse-threads", "1", "Parser threads for many-function inputs (0 = one per core)");
+    Flag* lexer_flag =
+        add_string_flag("lexer", "auto", "Lexer engine (auto, scalar, sse2, avx2)");
 
     if (!parse_flags(argc, argv)) {
         print_usage();
@@ -233,6 +246,18 @@ int main(int argc, char* argv[]) {
     bool asm_only = asm_only_flag->bool_value;
     bool wasmedge_aot = wasmedge_aot_flag->bool_value;
 
+    LexEngine lex_engine = LexEngine::Auto;
+    if (lexer_flag->value == "scalar") {
+        lex_engine = LexEngine::Scalar;
+    } else if (lexer_flag->value == "sse2") {
+        lex_engine = LexEngine::SSE2;
+    } else if (lexer_flag->value == "avx2") {
+        lex_engine = LexEngine::AVX2;
+    } else if (lexer_flag->value != "auto") {
+        std::cerr << "Error: Unknown lexer engine '" << lexer_flag->value << "'\n";
+        return 1;
+    }
+
     
     TargetRegistry& registry = TargetRegistry::instance();
     TargetAPI* target = registry.get_target(target_name);
@@ -250,36 +275,69 @@ int main(int argc, char* argv[]) {
 
     // Default output file name
     if (output_file.empty()) {
-        std::filesystem::path input_path(input_file);
-        output_file = input_path.stem().string();
+        if (input_file == "-") {
+            output_file = "a.out";
+        } else {
+            std::filesystem::path input_path(input_file);
+            output_file = input_path.stem().string();
+        }
     }
 
-    std::string contents;
-    {
-        std::stringstream f_stream;
-        std::fstream input(input_file, std::ios::in);
-        if (!input.is_open()) {
-            std::cerr << "Failed to open file: " << input_file << std::endl;
-            return 1;
+    // source backs every token and AST node, keep it alive until codegen is done
+    SourceFile source;
+    if (!source.open(input_file)) {
+        return 1;
+    }
+    std::string_view contents = source.view();
+
+    // -optimize 0 is the quick path: statements are lowered straight out of the parser, so the
+    // program's tree is never built, and the IR isn't optimised
+    const bool direct = optimize_level == 0;
+    Tokenizer tokenizer(contents, lex_engine);
+    std::optional<IrProgram> lowered;
+    if (stream_tokens_flag->bool_value) {
+        // Lex on a second thread and parse while tokens are still being produced
+        TokenRing ring;
+        std::thread lexer([&tokenizer, &ring] { tokenizer.tokenize_into(ring); });
+        Parser parser(ring, contents);
+        if (direct) {
+            lowered = parseToIr(parser, contents);
+        } else if (std::optional<NodeProg> pgram = parser.parse_prog()) {
+            lowered = astToIr(pgram.value());
+        }
+        ring.abandon();  // unblocks the lexer if parsing stopped early
+        lexer.join();
+    } else {
+        const int lex_threads = std::stoi(lex_threads_flag->value);
+        std::vector<Token> tokens = lex_threads == 1 ? tokenizer.tokenize()
+                                                     : tokenizer.tokenize_parallel(lex_threads);
+        const int parse_threads = std::stoi(parse_threads_flag->value);
+        Parser parser(std::move(tokens), contents);
+        if (direct) {
+            lowered = parseToIr(parser, contents);
+        } else {
+            std::optional<NodeProg> pgram = parse_threads == 1
+                                                ? parser.parse_prog()
+                                                : parser.parse_prog_parallel(parse_threads);
+            if (pgram.has_value()) {
+                lowered = astToIr(pgram.value());
+            }
         }
-        f_stream << input.rdbuf();
-        contents = f_stream.str();
     }
 
-    Tokenizer tokenizer(std::move(contents));
-    std::vector<Token> tokens = tokenizer.tokenize();
-
-    Parser parser(std::move(tokens));
-    std::optional<NodeProg> pgram = parser.parse_prog();
-
-    if (!pgram.has_value()) {
+    if (!lowered.has_value()) {
         std::cerr << "Failed to parse program" << std::endl;
         return 1;
     }
 
-    // Generate IR from AST
-    std::vector<inst> ir = astToIr(pgram.value());
-    ir = optimisation(std::move(ir));
+    IrProgram ir = std::move(lowered.value());
+    if (!direct) {
+        // -optimize 1 unrolls by 2, 2 by 4 and 3 by 8, within what the target allows
+        UnrollLimits unroll;
+        unroll.factor = 1 << std::clamp(optimize_level, 0, 3);
+        unroll.budget = target->unroll_budget();
+        ir = optimisation(std::move(ir), unroll);
+    }
 
     // Print IR if requested
     if (print_ir) {
@@ -287,9 +345,6 @@ int main(int argc, char* argv[]) {
         if (asm_only) return 0;
     }
 
-    // Set optimization level
-    (void)optimize_level;  // Suppress unused warning for now
-
     // Handle WasmEdge AOT pipeline
     if (wasmedge_aot) {
         target_name = "wasmedge";
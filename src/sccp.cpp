@@ -0,0 +1,399 @@
+#include <algorithm>
+#include <climits>
+#include <cstdint>
+#include <utility>
+#include <vector>
+
+#include "passes.h"
+
+using namespace std;
+
+namespace {
+
+// What a value can be: not yet seen to be computed (Top), one constant, or anything (Bottom).
+// Values only ever move down, which is what bounds the propagation.
+enum class Level : uint8_t { Top, Const, Bottom };
+
+struct Cell {
+    Level level = Level::Top;
+    int64_t value = 0;
+};
+
+const Cell BOTTOM{Level::Bottom, 0};
+
+// Arithmetic runs on 64-bit registers but a folded result has to fit an IR literal
+Cell constant(int64_t value) {
+    if (value < INT_MIN || value > INT_MAX) {
+        return BOTTOM;
+    }
+    return {Level::Const, value};
+}
+
+Cell meet(const Cell& a, const Cell& b) {
+    if (a.level == Level::Top) {
+        return b;
+    }
+    if (b.level == Level::Top) {
+        return a;
+    }
+    if (a.level == Level::Const && b.level == Level::Const && a.value == b.value) {
+        return a;
+    }
+    return BOTTOM;
+}
+
+// Folds `a op b` the way the generated code computes it; false where that is not a single
+// answer known now (division by zero, shifts out of range).
+bool fold(BinOp op, int64_t a, int64_t b, int64_t& result) {
+    switch (op) {
+        case BinOp::Add:
+            return !__builtin_add_overflow(a, b, &result);
+        case BinOp::Sub:
+            return !__builtin_sub_overflow(a, b, &result);
+        case BinOp::Mul:
+            return !__builtin_mul_overflow(a, b, &result);
+        case BinOp::Div:
+        case BinOp::Mod:
+            if (b == 0) {
+                return false;
+            }
+            result = op == BinOp::Div ? a / b : a % b;
+            return true;
+        case BinOp::EqualEqual:
+            result = a == b;
+            return true;
+        case BinOp::NotEqual:
+            result = a != b;
+            return true;
+        case BinOp::Less:
+            result = a < b;
+            return true;
+        case BinOp::LessEqual:
+            result = a <= b;
+            return true;
+        case BinOp::Greater:
+            result = a > b;
+            return true;
+        case BinOp::GreaterEqual:
+            result = a >= b;
+            return true;
+        case BinOp::And:
+            result = a && b;
+            return true;
+        case BinOp::Or:
+            result = a || b;
+            return true;
+        case BinOp::Shl:
+            if (b < 0 || b > 63) {
+                return false;
+            }
+            result = (int64_t)((uint64_t)a << b);
+            return true;
+        case BinOp::Shr:
+            // logical on x86 and ARM, arithmetic in wasm: they only agree on a non-negative value
+            if (a < 0 || b < 0 || b > 63) {
+                return false;
+            }
+            result = a >> b;
+            return true;
+    }
+    return false;
+}
+
+Cell binary(BinOp op, const Cell& left, const Cell& right) {
+    if (left.level == Level::Bottom || right.level == Level::Bottom) {
+        return BOTTOM;
+    }
+    if (left.level == Level::Top || right.level == Level::Top) {
+        return {};
+    }
+    int64_t result;
+    return fold(op, left.value, right.value, result) ? constant(result) : BOTTOM;
+}
+
+class Propagation {
+public:
+    Propagation(IrProgram& prog, const Cfg& cfg, const SsaForm& ssa)
+        : m_prog(prog), m_cfg(cfg), m_ssa(ssa) {}
+
+    void run();
+    bool rewrite();
+
+private:
+    Cell operand(size_t index, int slot, const Arg& arg) const;
+    Cell evaluate(size_t index) const;
+    LabelId table_target(const jumpTableOp& op, int64_t value) const;
+    bool taken(int from, int to) const;
+    void take(int from, int to);
+    void lower(int value, const Cell& cell);
+    void visit_phi(int phi);
+    void visit(size_t index);
+    void branch(int block);
+
+    IrProgram& m_prog;
+    const Cfg& m_cfg;
+    const SsaForm& m_ssa;
+    vector<Cell> m_cells;
+    vector<bool> m_reached;
+    vector<uint32_t> m_edge_begin;  // per block, into m_taken, one flag per successor
+    vector<bool> m_taken;
+    vector<pair<int, int>> m_flow_work;  // edges newly found to be taken
+    vector<int> m_value_work;            // values that moved down
+};
+
+Cell Propagation::operand(size_t index, int slot, const Arg& arg) const {
+    switch (arg.type) {
+        case ArgType::Literal:
+            return constant(arg.value);
+        case ArgType::Global:
+            return BOTTOM;
+        case ArgType::Var: {
+            const int value = m_ssa.use(index, slot);
+            return value < 0 ? BOTTOM : m_cells[value];
+        }
+    }
+    return BOTTOM;
+}
+
+// Slots count operands in for_each_operand order.
+Cell Propagation::evaluate(size_t index) const {
+    const inst& instr = m_prog.code[index];
+    switch (instr.kind) {
+        case Opkind::autoassign:
+            return operand(index, 0, instr.autoassign.arg);
+        case Opkind::binop:
+            return binary(instr.binop.op, operand(index, 0, instr.binop.left),
+                          operand(index, 1, instr.binop.right));
+        case Opkind::update:
+            return binary(instr.update.op, operand(index, 0, instr.update.dest),
+                          operand(index, 1, instr.update.value));
+        case Opkind::unaryop: {
+            const Cell value = operand(index, 0, instr.unary.operand);
+            if (instr.unary.op != UnaryOp::Not && instr.unary.op != UnaryOp::Negate) {
+                return BOTTOM;
+            }
+            if (value.level != Level::Const) {
+                return value;
+            }
+            return constant(instr.unary.op == UnaryOp::Not ? !value.value : -value.value);
+        }
+        case Opkind::select: {
+            const Cell condition = operand(index, 0, instr.select.condition);
+            const Cell if_true = operand(index, 1, instr.select.if_true);
+            const Cell if_false = operand(index, 2, instr.select.if_false);
+            if (condition.level == Level::Top) {
+                return {};
+            }
+            if (condition.level == Level::Const) {
+                return condition.value != 0 ? if_true : if_false;
+            }
+            return meet(if_true, if_false);
+        }
+        default:
+            return BOTTOM;  // a call's result
+    }
+}
+
+LabelId Propagation::table_target(const jumpTableOp& op, int64_t value) const {
+    const JumpTable& table = m_prog.jump_tables[op.table];
+    const int64_t slot = value - op.low;
+    if (slot < 0 || slot >= (int64_t)table.targets.size()) {
+        return table.default_label;
+    }
+    return table.targets[slot];
+}
+
+bool Propagation::taken(int from, int to) const {
+    const vector<int>& succs = m_cfg.blocks()[from].succs;
+    const size_t k = find(succs.begin(), succs.end(), to) - succs.begin();
+    return m_taken[m_edge_begin[from] + k];
+}
+
+void Propagation::take(int from, int to) {
+    const vector<int>& succs = m_cfg.blocks()[from].succs;
+    const size_t k = find(succs.begin(), succs.end(), to) - succs.begin();
+    if (k == succs.size() || m_taken[m_edge_begin[from] + k]) {
+        return;
+    }
+    m_taken[m_edge_begin[from] + k] = true;
+    m_flow_work.push_back({from, to});
+}
+
+void Propagation::lower(int value, const Cell& cell) {
+    Cell& current = m_cells[value];
+    if (current.level == cell.level && current.value == cell.value) {
+        return;
+    }
+    current = cell;
+    m_value_work.push_back(value);
+}
+
+void Propagation::visit_phi(int phi) {
+    const Phi& p = m_ssa.phis()[phi];
+    const vector<int>& preds = m_cfg.blocks()[p.block].preds;
+    Cell cell;
+    for (size_t j = 0; j < preds.size(); j++) {
+        if (p.args[j] >= 0 && taken(preds[j], p.block)) {
+            cell = meet(cell, m_cells[p.args[j]]);
+        }
+    }
+    lower(p.value, cell);
+}
+
+void Propagation::visit(size_t index) {
+    const int value = m_ssa.def(index);
+    if (value >= 0) {
+        lower(value, evaluate(index));
+    }
+}
+
+// Takes the edges out of `block` its last instruction can send control along.
+void Propagation::branch(int block) {
+    const BasicBlock& b = m_cfg.blocks()[block];
+    const size_t index = b.end - 1;
+    const inst& last = m_prog.code[index];
+    Cell cell = BOTTOM;
+    if (last.kind == Opkind::jumpiffalse) {
+        cell = operand(index, 0, last.jumpiffalse.condition);
+        if (cell.level == Level::Const) {
+            const LabelId target = last.jumpiffalse.label;
+            take(block, cell.value == 0 ? m_cfg.label_block(target) : block + 1);
+        }
+    } else if (last.kind == Opkind::jumptable) {
+        cell = operand(index, 0, last.jumptable.value);
+        if (cell.level == Level::Const) {
+            take(block, m_cfg.label_block(table_target(last.jumptable, cell.value)));
+        }
+    }
+    if (cell.level == Level::Bottom) {
+        for (int s : b.succs) {
+            take(block, s);
+        }
+    }
+}
+
+void Propagation::run() {
+    const vector<BasicBlock>& blocks = m_cfg.blocks();
+    const size_t start = m_cfg.func_start();
+
+    m_cells.assign(m_ssa.values().size(), {});
+    for (size_t v = 0; v < m_ssa.values().size(); v++) {
+        if (m_ssa.values()[v].kind == ValueKind::Entry) {
+            m_cells[v] = BOTTOM;  // parameters, and locals read before they are written
+        }
+    }
+    m_reached.assign(blocks.size(), false);
+    m_edge_begin.assign(blocks.size() + 1, 0);
+    for (size_t b = 0; b < blocks.size(); b++) {
+        m_edge_begin[b + 1] = m_edge_begin[b] + (uint32_t)blocks[b].succs.size();
+    }
+    m_taken.assign(m_edge_begin.back(), false);
+    if (blocks.empty()) {
+        return;
+    }
+
+    m_reached[0] = true;
+    for (size_t i = blocks[0].first; i < blocks[0].end; i++) {
+        visit(i);
+    }
+    branch(0);
+
+    while (!m_flow_work.empty() || !m_value_work.empty()) {
+        while (!m_flow_work.empty()) {
+            const int to = m_flow_work.back().second;
+            m_flow_work.pop_back();
+            for (int phi : m_ssa.block_phis(to)) {
+                visit_phi(phi);
+            }
+            if (!m_reached[to]) {
+                m_reached[to] = true;
+                for (size_t i = blocks[to].first; i < blocks[to].end; i++) {
+                    visit(i);
+                }
+                branch(to);
+            }
+        }
+        while (!m_value_work.empty()) {
+            const int value = m_value_work.back();
+            m_value_work.pop_back();
+            for (int user : m_ssa.users(value)) {
+                if (user < 0) {
+                    if (m_reached[m_ssa.phis()[~user].block]) {
+                        visit_phi(~user);
+                    }
+                    continue;
+                }
+                const size_t index = start + user;
+                const int b = m_cfg.block_of(index);
+                if (m_reached[b]) {
+                    visit(index);
+                    if (index + 1 == blocks[b].end) {
+                        branch(b);
+                    }
+                }
+            }
+        }
+    }
+}
+
+bool Propagation::rewrite() {
+    const vector<BasicBlock>& blocks = m_cfg.blocks();
+    bool changed = false;
+    for (size_t b = 0; b < blocks.size(); b++) {
+        for (size_t i = blocks[b].first; i < blocks[b].end; i++) {
+            inst& instr = m_prog.code[i];
+            if (!m_reached[b]) {
+                // labels stay: the wasm backend builds its blocks and loops from them
+                if (instr.kind != Opkind::label && instr.kind != Opkind::nop) {
+                    instr.kind = Opkind::nop;
+                    changed = true;
+                }
+                continue;
+            }
+
+            // an update's destination is where it writes, not just a value it reads
+            const bool in_place = instr.kind == Opkind::update;
+            int slot = 0;
+            for_each_operand(m_prog, instr, [&](Arg& arg) {
+                const int k = slot++;
+                if (arg.type != ArgType::Var || (in_place && k == 0)) {
+                    return;
+                }
+                const int value = m_ssa.use(i, k);
+                if (value >= 0 && m_cells[value].level == Level::Const) {
+                    arg = {ArgType::Literal, (int)m_cells[value].value};
+                }
+            });
+
+            const int value = m_ssa.def(i);
+            if (value >= 0 && m_cells[value].level == Level::Const &&
+                instr.kind != Opkind::autoassign) {
+                const Arg literal{ArgType::Literal, (int)m_cells[value].value};
+                instr = cAutoAssignOp(written_var(instr), literal);
+            }
+
+            if (instr.kind == Opkind::jumpiffalse &&
+                instr.jumpiffalse.condition.type == ArgType::Literal) {
+                if (instr.jumpiffalse.condition.value == 0) {
+                    instr = cJumpOp(instr.jumpiffalse.label);
+                } else {
+                    instr.kind = Opkind::nop;
+                }
+                changed = true;
+            } else if (instr.kind == Opkind::jumptable &&
+                       instr.jumptable.value.type == ArgType::Literal) {
+                instr = cJumpOp(table_target(instr.jumptable, instr.jumptable.value.value));
+                changed = true;
+            }
+        }
+    }
+    return changed;
+}
+
+}  // namespace
+
+bool propagate_constants(IrProgram& prog, const Cfg& cfg, const SsaForm& ssa) {
+    Propagation propagation(prog, cfg, ssa);
+    propagation.run();
+    return propagation.rewrite();
+}
@@ -0,0 +1,186 @@
+#include "ssa.h"
+
+#include <algorithm>
+#include <utility>
+
+using namespace std;
+
+void SsaForm::build(const IrProgram& prog, const Cfg& cfg, const VarNumbering& vars,
+                    const BitSolution& live) {
+    m_start = cfg.func_start();
+    m_values.clear();
+    m_phis.clear();
+    m_block_phis.assign(cfg.blocks().size(), {});
+    for (size_t v = 0; v < vars.size(); v++) {
+        m_values.push_back({ValueKind::Entry, (int)v, 0, 0});
+    }
+
+    place_phis(prog, cfg, vars, live);
+    rename(prog, cfg, vars);
+    link_users(cfg);
+}
+
+void SsaForm::place_phis(const IrProgram& prog, const Cfg& cfg, const VarNumbering& vars,
+                         const BitSolution& live) {
+    const vector<BasicBlock>& blocks = cfg.blocks();
+    const int count = (int)blocks.size();
+
+    // blocks that define each variable, collected in one pass over the code; only variables
+    // live across a block boundary can need a phi
+    const int across = (int)vars.across();
+    vector<vector<int>> def_blocks(across);
+    for (int b : cfg.rpo()) {
+        for (size_t i = blocks[b].first; i < blocks[b].end; i++) {
+            const int dest = written_var(prog.code[i]);
+            if (dest >= 0 && vars.index(dest) < across) {
+                vector<int>& sites = def_blocks[vars.index(dest)];
+                if (sites.empty() || sites.back() != b) {
+                    sites.push_back(b);
+                }
+            }
+        }
+    }
+
+    // stamped with the variable being placed, so neither table is cleared between variables
+    vector<int> has_phi(count, -1);
+    vector<int> queued(count, -1);
+    vector<int> work;
+    for (int v = 0; v < across; v++) {
+        work = def_blocks[v];
+        for (int b : work) {
+            queued[b] = v;
+        }
+        while (!work.empty()) {
+            const int b = work.back();
+            work.pop_back();
+            for (int join : cfg.frontier(b)) {
+                if (has_phi[join] == v || !live.in[join].test(v)) {
+                    continue;
+                }
+                has_phi[join] = v;
+                const int value = (int)m_values.size();
+                m_values.push_back({ValueKind::Phi, v, join, m_phis.size()});
+                m_block_phis[join].push_back((int)m_phis.size());
+                m_phis.push_back({value, join, vector<int>(blocks[join].preds.size(), -1)});
+                // the phi is a definition too
+                if (queued[join] != v) {
+                    queued[join] = v;
+                    work.push_back(join);
+                }
+            }
+        }
+    }
+}
+
+// Walks the dominator tree with the value each variable currently holds, undoing a block's
+// definitions on the way back up.
+void SsaForm::rename(const IrProgram& prog, const Cfg& cfg, const VarNumbering& vars) {
+    const vector<BasicBlock>& blocks = cfg.blocks();
+    const size_t length = cfg.func_end() - m_start;
+
+    m_defs.assign(length, -1);
+    m_use_begin.assign(length + 1, 0);
+    for (size_t i = m_start + 1; i < cfg.func_end(); i++) {
+        uint32_t operands = 0;
+        for_each_operand(prog, prog.code[i], [&](const Arg&) { operands++; });
+        m_use_begin[i - m_start + 1] = m_use_begin[i - m_start] + operands;
+    }
+    m_uses.assign(m_use_begin[length], -1);
+    if (blocks.empty()) {
+        return;
+    }
+
+    vector<int> current(vars.size());
+    for (size_t v = 0; v < vars.size(); v++) {
+        current[v] = (int)v;
+    }
+    vector<pair<int, int>> undo;  // variable, value it held before
+
+    auto enter = [&](int b) {
+        for (int p : m_block_phis[b]) {
+            const int v = m_values[m_phis[p].value].var;
+            undo.push_back({v, current[v]});
+            current[v] = m_phis[p].value;
+        }
+        for (size_t i = blocks[b].first; i < blocks[b].end; i++) {
+            const inst& instr = prog.code[i];
+            int* slot = m_uses.data() + m_use_begin[i - m_start];
+            for_each_operand(prog, instr, [&](const Arg& arg) {
+                if (arg.type == ArgType::Var) {
+                    *slot = current[vars.index(arg.value)];
+                }
+                slot++;
+            });
+            const int dest = written_var(instr);
+            if (dest >= 0) {
+                const int v = vars.index(dest);
+                const int value = (int)m_values.size();
+                m_values.push_back({ValueKind::Inst, v, b, i});
+                m_defs[i - m_start] = value;
+                undo.push_back({v, current[v]});
+                current[v] = value;
+            }
+        }
+        for (int s : blocks[b].succs) {
+            const vector<int>& preds = blocks[s].preds;
+            const size_t edge = find(preds.begin(), preds.end(), b) - preds.begin();
+            for (int p : m_block_phis[s]) {
+                m_phis[p].args[edge] = current[m_values[m_phis[p].value].var];
+            }
+        }
+    };
+
+    struct Frame {
+        int block;
+        size_t next_child;
+        size_t undo_mark;
+    };
+    vector<Frame> stack;
+    stack.push_back({0, 0, undo.size()});
+    enter(0);
+    while (!stack.empty()) {
+        Frame& top = stack.back();
+        const vector<int>& children = cfg.dom_children(top.block);
+        if (top.next_child < children.size()) {
+            const int child = children[top.next_child++];
+            stack.push_back({child, 0, undo.size()});
+            enter(child);
+        } else {
+            while (undo.size() > top.undo_mark) {
+                current[undo.back().first] = undo.back().second;
+                undo.pop_back();
+            }
+            stack.pop_back();
+        }
+    }
+}
+
+void SsaForm::link_users(const Cfg& cfg) {
+    const size_t length = cfg.func_end() - m_start;
+    m_user_begin.assign(m_values.size() + 1, 0);
+
+    // count, turn the counts into offsets, then fill each value's range in order
+    auto each_use = [&](auto&& note) {
+        for (size_t offset = 1; offset < length; offset++) {
+            for (uint32_t k = m_use_begin[offset]; k < m_use_begin[offset + 1]; k++) {
+                if (m_uses[k] >= 0) {
+                    note(m_uses[k], (int)offset);
+                }
+            }
+        }
+        for (size_t p = 0; p < m_phis.size(); p++) {
+            for (int arg : m_phis[p].args) {
+                if (arg >= 0) {
+                    note(arg, ~(int)p);
+                }
+            }
+        }
+    };
+    each_use([&](int value, int) { m_user_begin[value + 1]++; });
+    for (size_t v = 0; v < m_values.size(); v++) {
+        m_user_begin[v + 1] += m_user_begin[v];
+    }
+    m_users.assign(m_user_begin.back(), 0);
+    vector<uint32_t> fill(m_user_begin.begin(), m_user_begin.end() - 1);
+    each_use([&](int value, int user) { m_users[fill[value]++] = user; });
+}
@@ -0,0 +1,321 @@
+#include <cstdint>
+#include <string>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+#include "passes.h"
+
+using namespace std;
+
+namespace {
+
+// A while loop in the one shape the unroller takes on: the header only tests i < bound or
+// i <= bound, and the body, everything from that test to the jump back, steps i by a positive
+// constant exactly once per iteration and never branches out.
+struct CountedLoop {
+    size_t head;    // header label
+    size_t test;    // the comparison
+    size_t branch;  // the exit branch
+    size_t back;    // the jump back to the header
+    int var;        // i
+    Arg bound;
+    BinOp op;       // Less or LessEqual
+    int64_t step;
+    int64_t size;   // instructions in the body
+};
+
+}  // namespace
+
+// The value the step at `index` adds to `var`, or 0 if it is not a step.
+static int64_t step_of(const IrProgram& prog, size_t index, size_t first, int var) {
+    const inst& instr = prog.code[index];
+    auto literal = [](const Arg& arg, BinOp op) -> int64_t {
+        if (arg.type != ArgType::Literal) {
+            return 0;
+        }
+        return op == BinOp::Add ? arg.value : op == BinOp::Sub ? -(int64_t)arg.value : 0;
+    };
+    auto adds = [&](const binopOp& binop) -> int64_t {
+        if (binop.left.type == ArgType::Var && binop.left.value == var) {
+            return literal(binop.right, binop.op);
+        }
+        if (binop.op == BinOp::Add && binop.right.type == ArgType::Var &&
+            binop.right.value == var) {
+            return literal(binop.left, binop.op);
+        }
+        return 0;
+    };
+
+    switch (instr.kind) {
+        case Opkind::update:
+            if (instr.update.dest.type != ArgType::Var) {
+                return 0;
+            }
+            return literal(instr.update.value, instr.update.op);
+        case Opkind::binop:
+            return adds(instr.binop);
+        case Opkind::autoassign: {
+            // i = t right after t = i + c, as assignments are lowered
+            if (instr.autoassign.arg.type != ArgType::Var) {
+                return 0;
+            }
+            size_t prev = index;
+            while (prev-- > first && prog.code[prev].kind == Opkind::nop) {
+            }
+            const inst& sum = prog.code[prev];
+            if (prev < first || sum.kind != Opkind::binop ||
+                sum.binop.dest != instr.autoassign.arg.value) {
+                return 0;
+            }
+            return adds(sum.binop);
+        }
+        default:
+            return 0;
+    }
+}
+
+static bool counted_loop(const IrProgram& prog, const Cfg& cfg, int l, CountedLoop& loop) {
+    const NaturalLoop& natural = cfg.loops()[l];
+    const BasicBlock& header = cfg.blocks()[natural.header];
+    loop.head = loop_preheader(prog, cfg, l);
+    if (loop.head == 0 || natural.latches.size() != 1) {
+        return false;
+    }
+
+    vector<size_t> code;
+    for (size_t i = header.first; i < header.end; i++) {
+        if (prog.code[i].kind != Opkind::nop) {
+            code.push_back(i);
+        }
+    }
+    if (code.size() != 3) {
+        return false;
+    }
+    const inst& test = prog.code[code[1]];
+    const inst& branch = prog.code[code[2]];
+    if (test.kind != Opkind::binop ||
+        (test.binop.op != BinOp::Less && test.binop.op != BinOp::LessEqual) ||
+        test.binop.left.type != ArgType::Var || test.binop.right.type == ArgType::Global ||
+        (test.binop.right.type == ArgType::Var &&
+         test.binop.right.value == test.binop.left.value) ||
+        branch.kind != Opkind::jumpiffalse || branch.jumpiffalse.condition.type != ArgType::Var ||
+        branch.jumpiffalse.condition.value != test.binop.dest) {
+        return false;
+    }
+    loop.test = code[1];
+    loop.branch = code[2];
+    loop.var = test.binop.left.value;
+    loop.bound = test.binop.right;
+    loop.op = test.binop.op;
+
+    // the jump back is the last thing before the exit label
+    loop.back = cfg.blocks()[cfg.label_block(branch.jumpiffalse.label)].first;
+    while (--loop.back > loop.branch && prog.code[loop.back].kind == Opkind::nop) {
+    }
+    const inst& back = prog.code[loop.back];
+    if (back.kind != Opkind::jump || back.jump.label != prog.code[loop.head].label.label ||
+        cfg.block_of(loop.back) != natural.latches[0]) {
+        return false;
+    }
+    for (int b : natural.blocks) {
+        if (cfg.blocks()[b].first < loop.head || cfg.blocks()[b].end > loop.back + 1) {
+            return false;
+        }
+    }
+
+    vector<bool> inside(prog.labels.size(), false);
+    for (size_t i = loop.branch + 1; i < loop.back; i++) {
+        if (prog.code[i].kind == Opkind::label) {
+            inside[prog.code[i].label.label] = true;
+        }
+    }
+    const int bound_var = loop.bound.type == ArgType::Var ? loop.bound.value : -1;
+    size_t step = 0;
+    int steps = 0;
+    loop.size = 0;
+    for (size_t i = loop.branch + 1; i < loop.back; i++) {
+        const inst& instr = prog.code[i];
+        if (instr.kind == Opkind::nop) {
+            continue;
+        }
+        loop.size++;
+        bool leaves = instr.kind == Opkind::jumptable;
+        if (instr.kind == Opkind::jump) {
+            leaves = !inside[instr.jump.label];
+        } else if (instr.kind == Opkind::jumpiffalse) {
+            leaves = !inside[instr.jumpiffalse.label];
+        }
+        bool reads_test = false;
+        for_each_operand(prog, instr, [&](const Arg& arg) {
+            reads_test |= arg.type == ArgType::Var && arg.value == test.binop.dest;
+        });
+        const int dest = written_var(instr);
+        if (leaves || reads_test || (dest >= 0 && (dest == bound_var || dest == test.binop.dest))) {
+            return false;
+        }
+        if (dest == loop.var) {
+            step = i;
+            steps++;
+        }
+    }
+    if (steps != 1 || !cfg.dominates(cfg.block_of(step), natural.latches[0])) {
+        return false;
+    }
+    loop.step = step_of(prog, step, loop.branch + 1, loop.var);
+    return loop.step > 0;
+}
+
+// Literal i is set to in the block above the loop, if it is.
+static bool known_start(const IrProgram& prog, const Cfg& cfg, int l, const CountedLoop& loop,
+                        int64_t& start) {
+    const BasicBlock& above = cfg.blocks()[cfg.loops()[l].header - 1];
+    for (size_t i = loop.head; i-- > above.first;) {
+        const inst& instr = prog.code[i];
+        if (written_var(instr) == loop.var) {
+            if (instr.kind != Opkind::autoassign || instr.autoassign.arg.type != ArgType::Literal) {
+                return false;
+            }
+            start = instr.autoassign.arg.value;
+            return true;
+        }
+    }
+    return false;
+}
+
+// Queues a copy of the loop body for insertion before `at`, with labels of its own and its
+// own call argument lists, since passes rewrite those in place.
+static void copy_body(IrProgram& prog, const CountedLoop& loop, size_t at,
+                      vector<pair<size_t, inst>>& inserts) {
+    unordered_map<LabelId, LabelId> labels;
+    for (size_t i = loop.branch + 1; i < loop.back; i++) {
+        if (prog.code[i].kind == Opkind::label) {
+            const LabelInfo info = prog.labels[prog.code[i].label.label];
+            const string prefix = info.name.substr(0, info.name.find_last_not_of("0123456789") + 1);
+            labels[prog.code[i].label.label] = prog.new_label(prefix.c_str(), info.kind);
+        }
+    }
+    for (const auto& [from, to] : labels) {
+        const LabelId pair = prog.labels[from].pair;
+        if (pair >= 0) {
+            auto found = labels.find(pair);
+            prog.labels[to].pair = found == labels.end() ? pair : found->second;
+        }
+    }
+
+    for (size_t i = loop.branch + 1; i < loop.back; i++) {
+        inst copy = prog.code[i];
+        switch (copy.kind) {
+            case Opkind::nop:
+                continue;
+            case Opkind::label:
+                copy.label.label = labels[copy.label.label];
+                break;
+            case Opkind::jump:
+                copy.jump.label = labels[copy.jump.label];
+                break;
+            case Opkind::jumpiffalse:
+                copy.jumpiffalse.label = labels[copy.jumpiffalse.label];
+                break;
+            case Opkind::call: {
+                const uint32_t first = (uint32_t)prog.call_args.size();
+                for (uint32_t k = 0; k < copy.call.arg_count; k++) {
+                    const Arg arg = prog.call_args[copy.call.first_arg + k];
+                    prog.call_args.push_back(arg);
+                }
+                copy.call.first_arg = first;
+                break;
+            }
+            default:
+                break;
+        }
+        inserts.push_back({at, copy});
+    }
+}
+
+// A loop that runs a known, small number of times is replaced by that many copies of its body.
+// Otherwise a copy of the loop that runs `factor` iterations per test goes in front of it, and
+// the loop itself is left to run the iterations that remain. That copy tests both i < bound and
+// bound - i > (factor - 1) * step; the subtraction cannot wrap as long as i < bound, and when
+// it would wrap it comes out negative, which just leaves the work to the original loop. A
+// literal bound needs only i < bound - (factor - 1) * step.
+bool unroll_loops(IrProgram& prog, const Cfg& cfg, const VarNumbering& vars,
+                  const UnrollLimits& limits) {
+    const vector<NaturalLoop>& loops = cfg.loops();
+    if (limits.factor < 2) {
+        return false;
+    }
+    vector<bool> outer(loops.size(), false);
+    for (const NaturalLoop& loop : loops) {
+        if (loop.parent >= 0) {
+            outer[loop.parent] = true;
+        }
+    }
+
+    int next_var = first_free_var(prog, cfg, vars);
+    const int64_t budget = (int64_t)limits.budget;
+    vector<pair<size_t, inst>> inserts;
+    CountedLoop loop;
+    for (size_t l = 0; l < loops.size(); l++) {
+        if (outer[l] || !counted_loop(prog, cfg, (int)l, loop)) {
+            continue;
+        }
+
+        int64_t start;
+        if (loop.bound.type == ArgType::Literal && known_start(prog, cfg, (int)l, loop, start)) {
+            const int64_t end = loop.bound.value + (loop.op == BinOp::LessEqual ? 1 : 0);
+            const int64_t trips = start < end ? (end - start + loop.step - 1) / loop.step : 0;
+            if (trips > 0 && trips <= budget / loop.size) {
+                for (size_t i : {loop.head, loop.test, loop.branch, loop.back}) {
+                    prog.code[i].kind = Opkind::nop;
+                }
+                for (int64_t k = 1; k < trips; k++) {
+                    copy_body(prog, loop, loop.back, inserts);
+                }
+                continue;
+            }
+        }
+
+        int64_t factor = limits.factor;
+        while (factor > 1 && factor * loop.size > budget) {
+            factor--;
+        }
+        const int64_t reach = (factor - 1) * loop.step;
+        if (factor < 2 || reach > INT32_MAX) {
+            continue;
+        }
+        const auto [head, exit] = prog.new_loop();
+        const Arg i{ArgType::Var, loop.var};
+        const int in_range = next_var++;
+        if (loop.bound.type == ArgType::Literal && loop.bound.value - reach >= INT32_MIN) {
+            // with a literal bound the two tests fold into one
+            const Arg last{ArgType::Literal, (int)(loop.bound.value - reach)};
+            inserts.push_back({loop.head, cLabelOp(head)});
+            inserts.push_back({loop.head, cBinopOp(in_range, i, last, loop.op)});
+            inserts.push_back({loop.head, cJumpIfFalseOp(exit, {ArgType::Var, in_range})});
+        } else {
+            const int distance = next_var++;
+            const int room = next_var++;
+            const BinOp enough = loop.op == BinOp::Less ? BinOp::Greater : BinOp::GreaterEqual;
+            for (const inst& instr :
+                 {cLabelOp(head), cBinopOp(in_range, i, loop.bound, loop.op),
+                  cJumpIfFalseOp(exit, {ArgType::Var, in_range}),
+                  cBinopOp(distance, loop.bound, i, BinOp::Sub),
+                  cBinopOp(room, {ArgType::Var, distance}, {ArgType::Literal, (int)reach}, enough),
+                  cJumpIfFalseOp(exit, {ArgType::Var, room})}) {
+                inserts.push_back({loop.head, instr});
+            }
+        }
+        for (int64_t k = 0; k < factor; k++) {
+            copy_body(prog, loop, loop.head, inserts);
+        }
+        inserts.push_back({loop.head, cJumpOp(head)});
+        inserts.push_back({loop.head, cLabelOp(exit)});
+    }
+
+    if (inserts.empty()) {
+        return false;
+    }
+    insert_code(prog, std::move(inserts));
+    return true;
+}
@@ -0,0 +1,283 @@
+// Front-end throughput benchmark.
+//
+//   bench_frontend [-repeat N] FILE
+//
+// Runs Tokenizer, Parser and astToIr over FILE (usually produced by gen_program) and reports
+// items/sec per phase plus the heap high-water mark reached inside each phase. The `direct`
+// phase is parse and lower in one go via parseToIr, the -optimize 0 path. Every phase is
+// repeated N times and the fastest run is reported.
+#include <sys/resource.h>
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <iostream>
+#include <malloc.h>
+#include <new>
+#include <optional>
+#include <string>
+#include <vector>
+
+#include "Parser.h"
+#include "SourceFile.h"
+#include "Tokenizer.h"
+#include "ir.h"
+
+// Heap accounting: every allocation in the process goes through these, so a phase's peak is
+// the live-byte high-water mark since the phase started minus what was live going in.
+static std::atomic<size_t> g_live{0};
+static std::atomic<size_t> g_peak{0};
+
+static void note_alloc(void* p) {
+    size_t live = g_live.fetch_add(malloc_usable_size(p)) + malloc_usable_size(p);
+    size_t peak = g_peak.load();
+    while (live > peak && !g_peak.compare_exchange_weak(peak, live)) {
+    }
+}
+
+void* operator new(size_t size) {
+    void* p = std::malloc(size ? size : 1);
+    if (p == nullptr) {
+        throw std::bad_alloc();
+    }
+    note_alloc(p);
+    return p;
+}
+
+void operator delete(void* p) noexcept {
+    if (p != nullptr) {
+        g_live.fetch_sub(malloc_usable_size(p));
+        std::free(p);
+    }
+}
+
+void operator delete(void* p, size_t) noexcept {
+    operator delete(p);
+}
+
+struct PhaseResult {
+    const char* name;
+    const char* unit;
+    size_t items = 0;
+    double best_sec = 0;
+    size_t peak_bytes = 0;
+};
+
+class PhaseTimer {
+   public:
+    explicit PhaseTimer(PhaseResult& result) : m_result(result) {
+        m_base = g_live.load();
+        g_peak.store(m_base);
+        m_start = std::chrono::steady_clock::now();
+    }
+
+    ~PhaseTimer() {
+        double sec = std::chrono::duration<double>(std::chrono::steady_clock::now() - m_start)
+                         .count();
+        if (m_result.best_sec == 0 || sec < m_result.best_sec) {
+            m_result.best_sec = sec;
+        }
+        m_result.peak_bytes = std::max(m_result.peak_bytes, g_peak.load() - m_base);
+    }
+
+   private:
+    PhaseResult& m_result;
+    size_t m_base;
+    std::chrono::steady_clock::time_point m_start;
+};
+
+// Every expression kind is listed, so -Wswitch points here when one is added.
+static size_t count_expr(const NodeExpr* expr) {
+    if (expr == nullptr) {
+        return 0;
+    }
+    switch (expr->type) {
+        case ExprType::IntLit:
+        case ExprType::Ident:
+            return 1;
+        case ExprType::BinaryOp: {
+            const NodeBinExpr* bin = expr->as<NodeBinExpr>();
+            return 1 + count_expr(bin->left) + count_expr(bin->right);
+        }
+        case ExprType::UnaryOp:
+            return 1 + count_expr(expr->as<NodeUnaryExpr>()->operand);
+        case ExprType::Ternary: {
+            const NodeTernary* ternary = expr->as<NodeTernary>();
+            return 1 + count_expr(ternary->condition) + count_expr(ternary->if_true) +
+                   count_expr(ternary->if_false);
+        }
+        case ExprType::Call: {
+            size_t n = 1;
+            for (const NodeExpr* arg : expr->as<NodeCallExpr>()->args) {
+                n += count_expr(arg);
+            }
+            return n;
+        }
+    }
+    return 1;
+}
+
+// Every statement kind is listed, so -Wswitch points here when one is added.
+static size_t count_stmt(const NodeStmt* stmt) {
+    if (stmt == nullptr) {
+        return 0;
+    }
+    size_t n = 1;
+    switch (stmt->type) {
+        case StmtType::Auto:
+        case StmtType::Extern:
+        case StmtType::Global:
+        case StmtType::Case:
+        case StmtType::Goto:
+        case StmtType::Break:
+            break;
+        case StmtType::Assign:
+            n += count_expr(stmt->as<NodeAssign>()->expr);
+            break;
+        case StmtType::Update:
+            n += count_expr(stmt->as<NodeUpdate>()->expr);
+            break;
+        case StmtType::FuncCall:
+            for (const NodeExpr* arg : stmt->as<NodeCall>()->args) {
+                n += count_expr(arg);
+            }
+            break;
+        case StmtType::If: {
+            const NodeIf* branch = stmt->as<NodeIf>();
+            n += count_expr(branch->condition) + count_stmt(branch->then_stmt) +
+                 count_stmt(branch->else_stmt);
+            break;
+        }
+        case StmtType::While: {
+            const NodeWhile* loop = stmt->as<NodeWhile>();
+            n += count_expr(loop->condition) + count_stmt(loop->body);
+            break;
+        }
+        case StmtType::Switch: {
+            const NodeSwitch* sw = stmt->as<NodeSwitch>();
+            n += count_expr(sw->value);
+            for (const SwitchCase& label : sw->cases) {
+                for (const NodeStmt* sub : label.body) {
+                    n += count_stmt(sub);
+                }
+            }
+            break;
+        }
+        case StmtType::Return:
+            n += count_expr(stmt->as<NodeReturn>()->expr);
+            break;
+        case StmtType::Block:
+            for (const NodeStmt* sub : stmt->as<NodeBlock>()->body) {
+                n += count_stmt(sub);
+            }
+            break;
+    }
+    return n;
+}
+
+static size_t count_nodes(const NodeProg& prog) {
+    size_t n = 1;
+    for (const NodeFunc* func : prog.funcs) {
+        n++;
+        for (const NodeStmt* stmt : func->body) {
+            n += count_stmt(stmt);
+        }
+    }
+    return n;
+}
+
+static void report(const PhaseResult& r) {
+    double rate = r.best_sec > 0 ? r.items / r.best_sec : 0;
+    std::printf("%-10s %12zu %-10s %10.3f ms %14.0f %-10s/s %10.1f MiB peak\n", r.name, r.items,
+                r.unit, r.best_sec * 1e3, rate, r.unit, r.peak_bytes / (1024.0 * 1024.0));
+}
+
+int main(int argc, char* argv[]) {
+    int repeat = 3;
+    const char* path = nullptr;
+    for (int i = 1; i < argc; i++) {
+        if (std::strcmp(argv[i], "-repeat") == 0 && i + 1 < argc) {
+            repeat = std::max(1, std::atoi(argv[++i]));
+        } else {
+            path = argv[i];
+        }
+    }
+    if (path == nullptr) {
+        std::cerr << "usage: bench_frontend [-repeat N] FILE" << std::endl;
+        return 1;
+    }
+
+    SourceFile source;
+    if (!source.open(path)) {
+        return 1;
+    }
+    std::string_view src = source.view();
+
+    PhaseResult lex{"tokenize", "tokens"};
+    PhaseResult parse{"parse", "nodes"};
+    PhaseResult lower{"astToIr", "insts"};
+    PhaseResult direct{"direct", "insts"};
+
+    // the first run's tree is kept for lowering, later ones are dropped with their arena
+    std::optional<NodeProg> prog;
+    for (int r = 0; r < repeat; r++) {
+        std::vector<Token> tokens;
+        {
+            PhaseTimer t(lex);
+            tokens = Tokenizer(src).tokenize();
+        }
+        lex.items = tokens.size();
+
+        std::optional<NodeProg> parsed;
+        {
+            PhaseTimer t(parse);
+            parsed = Parser(std::move(tokens), src).parse_prog();
+        }
+        if (!parsed.has_value()) {
+            std::cerr << "Failed to parse " << path << std::endl;
+            return 1;
+        }
+        parse.items = count_nodes(parsed.value());
+        if (!prog.has_value()) {
+            prog = std::move(parsed);
+        }
+    }
+
+    for (int r = 0; r < repeat; r++) {
+        IrProgram ir;
+        {
+            PhaseTimer t(lower);
+            ir = astToIr(prog.value());
+        }
+        lower.items = ir.code.size();
+    }
+
+    for (int r = 0; r < repeat; r++) {
+        std::vector<Token> tokens = Tokenizer(src).tokenize();
+        std::optional<IrProgram> ir;
+        {
+            PhaseTimer t(direct);
+            Parser parser(std::move(tokens), src);
+            ir = parseToIr(parser, src);
+        }
+        if (!ir.has_value()) {
+            std::cerr << "Failed to parse " << path << std::endl;
+            return 1;
+        }
+        direct.items = ir->code.size();
+    }
+
+    struct rusage usage;
+    getrusage(RUSAGE_SELF, &usage);
+
+    std::printf("%s: %zu bytes, best of %d\n", path, src.size(), repeat);
+    report(lex);
+    report(parse);
+    report(lower);
+    report(direct);
+    std::printf("max rss    %10.1f MiB\n", usage.ru_maxrss / 1024.0);
+    return 0;
+}
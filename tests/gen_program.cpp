@@ -0,0 +1,169 @@
+// Synthetic Bboop program generator for the front-end benchmark.
+//
+//   gen_program [-lines N] [-depth D] [-expr E] [-idents I] [-func-lines F] [-seed S]
+//
+// Writes a syntactically valid program of roughly N lines to stdout. Statements nest up to
+// D levels of if/else/while blocks, expressions have up to E operands and every function
+// declares I locals. The body is split into functions of about F lines each (f0, f1, ...)
+// followed by main, so very large inputs don't end up as one giant function.
+#include <algorithm>
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
+#include <iostream>
+#include <string>
+
+static const char* const kOps[] = {"+", "-", "*", "/", "%", "==", "!=", "<", "<=", ">", ">=",
+                                   "&", "|", "<<", ">>"};
+
+struct GenOptions {
+    uint64_t lines = 10000;
+    int depth = 3;
+    int expr_len = 4;
+    int idents = 32;
+    uint64_t func_lines = 2000;
+    uint64_t seed = 1;
+};
+
+class ProgramGen {
+   public:
+    explicit ProgramGen(const GenOptions& opts) : m_opts(opts), m_state(opts.seed | 1) {
+    }
+
+    void run() {
+        int func = 0;
+        while (m_lines < m_opts.lines) {
+            uint64_t budget = std::min(m_opts.func_lines, m_opts.lines - m_lines);
+            bool last = m_lines + budget >= m_opts.lines;
+            emit_func(last ? std::string("main") : "f" + std::to_string(func++), budget);
+        }
+        std::cout.write(m_out.data(), m_out.size());
+    }
+
+   private:
+    // xorshift64*: deterministic for a given seed across platforms
+    uint64_t next() {
+        m_state ^= m_state >> 12;
+        m_state ^= m_state << 25;
+        m_state ^= m_state >> 27;
+        return m_state * 2685821657736338717ull;
+    }
+    int pick(int n) {
+        return static_cast<int>(next() % static_cast<uint64_t>(n));
+    }
+
+    void line(int indent, const std::string& text) {
+        m_out.append(indent * 4, ' ');
+        m_out += text;
+        m_out += '\n';
+        m_lines++;
+    }
+
+    std::string var() {
+        return "v" + std::to_string(pick(m_opts.idents));
+    }
+
+    std::string operand() {
+        // literals are never 0 so constant folding can't hit a division by zero
+        return pick(3) == 0 ? std::to_string(1 + pick(99)) : var();
+    }
+
+    std::string expr() {
+        std::string e = operand();
+        int extra = pick(m_opts.expr_len);
+        for (int i = 0; i < extra; i++) {
+            e += ' ';
+            e += kOps[pick(sizeof(kOps) / sizeof(kOps[0]))];
+            e += ' ';
+            e += operand();
+        }
+        return e;
+    }
+
+    void emit_func(const std::string& name, uint64_t budget) {
+        uint64_t end = m_lines + budget;
+        line(0, name + "() {");
+        line(1, "extern putchar;");
+        for (int i = 0; i < m_opts.idents; i += 16) {
+            std::string decl = "auto v" + std::to_string(i);
+            for (int j = i + 1; j < std::min(i + 16, m_opts.idents); j++) {
+                decl += ", v" + std::to_string(j);
+            }
+            line(1, decl + ";");
+        }
+        while (m_lines + 2 < end) {
+            emit_stmt(1, 0, end - 1);
+        }
+        line(1, "return (0);");
+        line(0, "}");
+    }
+
+    void emit_stmt(int indent, int depth, uint64_t end) {
+        // compound statements need at least three lines (header, body, closing brace)
+        int kind = pick(10);
+        if (depth >= m_opts.depth || m_lines + 3 >= end) {
+            kind = 0;
+        }
+
+        if (kind <= 5) {
+            line(indent, var() + " = " + expr() + ";");
+        } else if (kind == 6) {
+            line(indent, "putchar(" + expr() + ");");
+        } else if (kind == 7) {
+            line(indent, "while (" + expr() + ") {");
+            emit_block(indent, depth, end - 1);
+            line(indent, "}");
+        } else {
+            line(indent, "if (" + expr() + ") {");
+            emit_block(indent, depth, end - 1);
+            if (kind == 9 && m_lines + 3 < end) {
+                line(indent, "} else {");
+                emit_block(indent, depth, end - 1);
+            }
+            line(indent, "}");
+        }
+    }
+
+    void emit_block(int indent, int depth, uint64_t end) {
+        int count = 1 + pick(4);
+        for (int i = 0; i < count && m_lines < end; i++) {
+            emit_stmt(indent + 1, depth + 1, end);
+        }
+    }
+
+    GenOptions m_opts;
+    uint64_t m_state;
+    uint64_t m_lines = 0;
+    std::string m_out;
+};
+
+int main(int argc, char* argv[]) {
+    GenOptions opts;
+    for (int i = 1; i < argc; i++) {
+        if (i + 1 >= argc) {
+            std::cerr << "Missing value for " << argv[i] << std::endl;
+            return 1;
+        }
+        const char* name = argv[i];
+        uint64_t value = std::strtoull(argv[++i], nullptr, 10);
+        if (std::strcmp(name, "-lines") == 0) {
+            opts.lines = value;
+        } else if (std::strcmp(name, "-depth") == 0) {
+            opts.depth = static_cast<int>(value);
+        } else if (std::strcmp(name, "-expr") == 0) {
+            opts.expr_len = std::max<int>(1, static_cast<int>(value));
+        } else if (std::strcmp(name, "-idents") == 0) {
+            opts.idents = std::max<int>(1, static_cast<int>(value));
+        } else if (std::strcmp(name, "-func-lines") == 0) {
+            opts.func_lines = std::max<uint64_t>(16, value);
+        } else if (std::strcmp(name, "-seed") == 0) {
+            opts.seed = value;
+        } else {
+            std::cerr << "Unknown option: " << name << std::endl;
+            return 1;
+        }
+    }
+
+    ProgramGen(opts).run();
+    return 0;
+}
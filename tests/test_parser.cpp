@@ -17,8 +17,9 @@ int main(int argc, char* argv[]) {
     }
     std::stringstream ss;
     ss << f.rdbuf();
-    Tokenizer t(ss.str());
-    Parser p(t.tokenize());
+    const std::string src = ss.str();
+    Tokenizer t(src);
+    Parser p(t.tokenize(), src);
     auto prog = p.parse_prog();
     assert(prog.has_value());
     std::cout << "Parsed " << argv[1] << " successfully." << std::endl;